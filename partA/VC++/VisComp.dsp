@@ -92,6 +92,22 @@ SOURCE=..\src\pyramid\blend.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\pyramid\blend_batch.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\pyramid\blend_video.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\morphing\field_warp.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\pyramid\fuse.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\gl\glutils.cxx
 # End Source File
 # Begin Source File
@@ -164,6 +180,10 @@ SOURCE=..\src\morphing\morphing_ui.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\thread\parallel.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\inpainting\patch_db.cxx
 # End Source File
 # Begin Source File
@@ -176,6 +196,10 @@ SOURCE=..\src\pyramid\pyramid.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\pyramid\pyramid_kernels.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\imdraw\read_drawing.cxx
 # End Source File
 # Begin Source File
@@ -184,6 +208,14 @@ SOURCE=..\src\gl\Texture.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\pyramid\tile_store.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\pyramid\tiled_pyramid.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\VisCompUI.cxx
 # End Source File
 # End Group
@@ -192,6 +224,14 @@ SOURCE=..\src\VisCompUI.cxx
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=..\src\pyramid\blend_batch.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\pyramid\blend_video.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\file_callbacks\callback_open_drawing.h
 # End Source File
 # Begin Source File
@@ -204,10 +244,18 @@ SOURCE=..\src\file_callbacks\callback_save_image.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\morphing\field_warp.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\fltk_includes.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\pyramid\fuse.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\gl\glutils.h
 # End Source File
 # Begin Source File
@@ -244,6 +292,10 @@ SOURCE=..\src\morphing\morphing.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\thread\parallel.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\inpainting\psi.h
 # End Source File
 # Begin Source File
@@ -252,10 +304,26 @@ SOURCE=..\src\pyramid\pyramid.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\pyramid\pyramid_kernels.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\gl\Texture.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\src\thread\thread.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\pyramid\tile_store.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\src\pyramid\tiled_pyramid.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\src\VisCompUI.h
 # End Source File
 # Begin Source File
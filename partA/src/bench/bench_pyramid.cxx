@@ -0,0 +1,424 @@
+// bench_pyramid.cxx : Benchmarks of the pyramid and blending routines
+//
+// The program times the main entry points of the pyramid code over a
+// matrix of image sizes, plane counts and values of the "a" parameter,
+// on synthetic images and on the images of test_images/blending:
+//
+//     reduce   pyramid::reduce_level() of level 0
+//     expand   pyramid::expand_level() of level 1 to level 0
+//     build    the pyramid constructor
+//     g        reconstructing level 0 of the Gauss pyramid with g()
+//     blend    blending two images with a mask through the blending
+//              class, as the -blending command-line mode does
+//
+// Every case runs in a child process, so that the peak resident set
+// size reported for it is its own (on Windows the cases run in the
+// benchmark process itself, and the peak working set reported for a
+// case is that of all the cases run so far). The results are written as JSON,
+// one case per line, with the throughput in megapixels per second,
+// the time per pixel (of level 0) and the peak RSS. If a baseline
+// (a JSON file written by an earlier run) is given, every case whose
+// time per pixel exceeds that of the baseline by more than the
+// threshold is reported as a regression, and the program exits with
+// status 1
+
+#include "../vxl_includes.h"
+
+#include "../file/load_image.h"
+#include "../pyramid/pyramid.h"
+#include "../thread/parallel.h"
+
+#include <vcl_vector.h>
+#include <vcl_map.h>
+#include <vcl_cstdio.h>
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+
+// the entry points being timed
+enum bench_op {Reduce, Expand, Build, Gauss, Blend};
+static const char* op_names[] = {"reduce", "expand", "build", "g", "blend"};
+
+// A benchmark case
+struct bench_case {
+	bench_op op;
+	// the image the case runs on: "synthetic" or the filename of a
+	// test image (Source0 of the blend cases)
+	vcl_string image;
+	// the filenames of Source1 and the mask of the blend cases on
+	// test images
+	vcl_string image1, mask;
+	int ni, nj, nplanes;
+	double a;
+};
+
+// The measurements of a case
+struct bench_result {
+	bool ok;
+	int iterations;
+	// the best time of an iteration, in seconds
+	double seconds;
+	long peak_rss_kb;
+};
+
+// A synthetic image: smooth gradients with some noise, which neither
+// compresses the pyramid levels to zero nor makes them pure noise
+static vil_image_view<vxl_byte> synthetic_image(int ni, int nj, int nplanes, int seed)
+{
+	vil_image_view<vxl_byte> im(ni, nj, nplanes);
+	unsigned int r = 12345 + seed;
+
+	for (int p=0; p<nplanes; p++)
+		for (int j=0; j<nj; j++)
+			for (int i=0; i<ni; i++) {
+				r = r*1103515245 + 12345;
+				im(i,j,p) = (vxl_byte) ((i*(p+1) + j*(seed+1) + (r >> 27)) & 255);
+			}
+	return im;
+}
+
+// The same image with interleaved RGB pixels
+static vil_image_view<vil_rgb<vxl_byte> > synthetic_rgb(int ni, int nj, int seed)
+{
+	vil_image_view<vil_rgb<vxl_byte> > im(ni, nj);
+	vil_image_view<vxl_byte> planes = vil_view_as_planes(im);
+
+	vil_copy_reformat(synthetic_image(ni, nj, 3, seed), planes);
+	return im;
+}
+
+// A mask that is 0 on the left half of the image and 255 on the right
+static vil_image_view<vxl_byte> half_mask(int ni, int nj)
+{
+	vil_image_view<vxl_byte> mask(ni, nj);
+
+	for (int j=0; j<nj; j++)
+		for (int i=0; i<ni; i++)
+			mask(i,j) = (i < ni/2) ? 0 : 255;
+	return mask;
+}
+
+// The inputs of a case, prepared before the timing starts
+struct bench_input {
+	vil_image_view<vxl_byte> im;
+	// the sources and the mask of the blend cases
+	vil_image_view<vil_rgb<vxl_byte> > source0;
+	vil_image_view<vil_rgb<vxl_byte> > source1;
+	vil_image_view<vxl_byte> mask;
+	// level 1 of the Gauss pyramid of im, for the expand cases
+	vil_image_view<vxl_byte> g1;
+	// the pyramid of im, for the g cases
+	pyramid* pyr;
+	double w_hat_data[5];
+};
+
+static bool prepare(const bench_case& c, bench_input& in)
+{
+	if (c.op == Blend) {
+		if (c.image == "synthetic") {
+			in.source0 = synthetic_rgb(c.ni, c.nj, 0);
+			in.source1 = synthetic_rgb(c.ni, c.nj, 1);
+			in.mask = half_mask(c.ni, c.nj);
+		} else {
+			in.source0 = load_image(c.image);
+			in.source1 = load_image(c.image1);
+			in.mask = load_image1(c.mask);
+		}
+		if (((bool) in.source0 == false) || ((bool) in.source1 == false) || 
+			((bool) in.mask == false))
+			return false;
+		in.im = vil_view_as_planes(in.source0);
+	} else if (c.image == "synthetic")
+		in.im = synthetic_image(c.ni, c.nj, c.nplanes, 0);
+	else
+		// the test images are loaded as RGB images, which the pyramid
+		// routines view as 3 planes
+		in.im = vil_view_as_planes(load_image(c.image));
+	if ((bool) in.im == false)
+		return false;
+
+	double* w_hat = in.w_hat_data + 2;
+	pyramid::kernel(c.a, w_hat);
+	in.pyr = 0;
+	if (c.op == Expand)
+		pyramid::reduce_level(in.im, w_hat, in.g1);
+	if (c.op == Gauss)
+		in.pyr = new pyramid(in.im, c.a);
+
+	return true;
+}
+
+// Run one iteration of a case
+static bool run(const bench_case& c, bench_input& in)
+{
+	const double* w_hat = in.w_hat_data + 2;
+
+	switch (c.op) {
+	case Reduce: {
+		vil_image_view<vxl_byte> g1;
+		pyramid::reduce_level(in.im, w_hat, g1);
+		return true;
+	}
+	case Expand: {
+		vil_image_view<vxl_byte> g0;
+		pyramid::expand_level(in.g1, w_hat, in.im.ni(), in.im.nj(), g0);
+		return true;
+	}
+	case Build: {
+		pyramid pyr(in.im, c.a);
+		return true;
+	}
+	case Gauss: {
+		vil_image_view<vxl_byte> g0;
+		return in.pyr->g(0, g0);
+	}
+	case Blend: {
+		blending B;
+		B.set_a(c.a);
+		return (B.set(B.Source0, in.source0) && B.set(B.Source1, in.source1) &&
+		        B.set(B.Mask, in.mask) && B.compute());
+	}
+	}
+	return false;
+}
+
+// Time a case: the iterations are repeated for at least min_time
+// seconds, and the best one is kept
+static bench_result time_case(const bench_case& c, double min_time)
+{
+	bench_result r;
+	bench_input in;
+
+	r.ok = prepare(c, in);
+	r.iterations = 0;
+	r.seconds = 0;
+
+	vul_timer total;
+	while (r.ok && ((r.iterations == 0) || (total.real() < 1000*min_time))) {
+		vul_timer timer;
+		int n = 0;
+		// vul_timer measures wall time in milliseconds, so short
+		// iterations are timed in groups of at least 100 ms
+		do {
+			r.ok = run(c, in);
+			n++;
+		} while (r.ok && (timer.real() < 10*n) && (timer.real() < 100));
+		double t = timer.real()/1000.0/n;
+		if ((r.iterations == 0) || (t < r.seconds))
+			r.seconds = t;
+		r.iterations += n;
+	}
+	delete in.pyr;
+
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS usage;
+	GetProcessMemoryInfo(GetCurrentProcess(), &usage, sizeof(usage));
+	r.peak_rss_kb = (long) (usage.PeakWorkingSetSize/1024);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	r.peak_rss_kb = usage.ru_maxrss;
+#endif
+
+	return r;
+}
+
+// Time a case in a child process; the child sends its measurements
+// back through a pipe
+static bench_result time_case_in_child(const bench_case& c, double min_time)
+{
+#ifdef _WIN32
+	return time_case(c, min_time);
+#else
+	bench_result r;
+	int fd[2];
+
+	r.ok = false;
+	if (pipe(fd) != 0)
+		return r;
+
+	vcl_cout.flush();
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fd[0]);
+		r = time_case(c, min_time);
+		ssize_t written = write(fd[1], &r, sizeof(r));
+		_exit(written == (ssize_t) sizeof(r) ? 0 : 1);
+	}
+	close(fd[1]);
+	if ((pid < 0) || (read(fd[0], &r, sizeof(r)) != (ssize_t) sizeof(r)))
+		r.ok = false;
+	close(fd[0]);
+	if (pid > 0)
+		waitpid(pid, 0, 0);
+
+	return r;
+#endif
+}
+
+// The name identifying a case in the results and the baseline
+static vcl_string case_name(const bench_case& c)
+{
+	char buf[512];
+	vcl_string image = c.image.substr(c.image.find_last_of('/') + 1);
+
+	vcl_sprintf(buf, "%s/%s/%dx%dx%d/a%g", op_names[c.op], image.c_str(),
+	            c.ni, c.nj, c.nplanes, c.a);
+	return buf;
+}
+
+// Read the time per pixel of every case of a results file
+static bool read_baseline(const char* fname, vcl_map<vcl_string, double>& ns_per_px)
+{
+	vcl_ifstream in(fname);
+	vcl_string line;
+
+	if (!in)
+		return false;
+
+	// every case is on a line of its own
+	while (vcl_getline(in, line)) {
+		vcl_string::size_type n = line.find("\"name\": \"");
+		vcl_string::size_type t = line.find("\"ns_per_px\": ");
+		if ((n == vcl_string::npos) || (t == vcl_string::npos))
+			continue;
+		n += 9;
+		vcl_string name = line.substr(n, line.find('"', n) - n);
+		ns_per_px[name] = vcl_atof(line.c_str() + t + 13);
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	vul_arg_info_list arg_list;
+
+	vul_arg<vcl_string> out(arg_list, "-o", "The JSON file the results are written to (standard output by default)", "");
+	vul_arg<vcl_string> baseline(arg_list, "-baseline", "The JSON results of an earlier run to compare with", "");
+	vul_arg<double> threshold(arg_list, "-threshold", "The slowdown (per pixel) relative to the baseline reported as a regression", 0.10);
+	vul_arg<int> max_size(arg_list, "-max_size", "The largest synthetic image size (sizes are 2^k+1, from 257 to 8193)", 8193);
+	vul_arg<double> min_time(arg_list, "-min_time", "The time (in seconds) each case is repeated for", 0.5);
+	vul_arg<int> threads(arg_list, "-threads", "The number of threads used by the pyramid routines", 1);
+	vul_arg<vcl_string> images(arg_list, "-images", "The directory holding the blending test images", "../test_images/blending");
+	arg_list.set_help_option("-help");
+	arg_list.parse(argc, argv, true);
+
+	set_parallel_threads(threads());
+
+	//
+	// the benchmark matrix
+	//
+	vcl_vector<bench_case> cases;
+	static const double as[] = {0.4, 0.3};
+	static const int planes[] = {1, 3};
+
+	for (int n=257; n<=max_size(); n=2*n-1)
+		for (int op=Reduce; op<=Blend; op++)
+			for (int p=0; p<2; p++)
+				for (int k=0; k<2; k++) {
+					// the blend cases are always RGB
+					if ((op == Blend) && (planes[p] != 3))
+						continue;
+					// the a parameter does not change the cost of the
+					// fixed-point kernels, so only the default is timed
+					// for the largest images
+					if ((k > 0) && (n > 2049))
+						continue;
+					bench_case c;
+					c.op = (bench_op) op;
+					c.image = "synthetic";
+					c.ni = c.nj = n;
+					c.nplanes = planes[p];
+					c.a = as[k];
+					cases.push_back(c);
+				}
+
+	// the test images, with the masks they are distributed with
+	static const char* test_sets[][3] = {
+		{"apple.jpg", "tomato.jpg", "tomato_mask.bmp"},
+		{"blue_cup.jpg", "green_cup.jpg", "cup_mask.bmp"},
+		{"orchid.jpg", "violet.jpg", "orchid_mask.bmp"}
+	};
+	for (int s=0; s<3; s++) {
+		vcl_string dir = images() + "/";
+		vil_image_view<vxl_byte> im = vil_view_as_planes(load_image(dir + test_sets[s][0]));
+		if ((bool) im == false) {
+			vcl_cerr << "bench_pyramid: cannot read " << dir + test_sets[s][0] << vcl_endl;
+			continue;
+		}
+		for (int op=Reduce; op<=Blend; op++) {
+			bench_case c;
+			c.op = (bench_op) op;
+			c.image = dir + test_sets[s][0];
+			c.image1 = dir + test_sets[s][1];
+			c.mask = dir + test_sets[s][2];
+			c.ni = im.ni();
+			c.nj = im.nj();
+			c.nplanes = im.nplanes();
+			c.a = 0.4;
+			cases.push_back(c);
+		}
+	}
+
+	//
+	// run the cases and write the results
+	//
+	vcl_map<vcl_string, double> base;
+	if (baseline.set() && (read_baseline(baseline().c_str(), base) == false)) {
+		vcl_cerr << "bench_pyramid: cannot read the baseline " << baseline() << vcl_endl;
+		return 2;
+	}
+
+	vcl_FILE* f = stdout;
+	if (out.set() && ((f = vcl_fopen(out().c_str(), "w")) == 0)) {
+		vcl_cerr << "bench_pyramid: cannot write " << out() << vcl_endl;
+		return 2;
+	}
+
+	int regressions = 0, nresults = 0;
+	vcl_fprintf(f, "{\n\"benchmark\": \"bench_pyramid\",\n\"threads\": %d,\n\"results\": [\n",
+	            threads());
+	for (unsigned int k=0; k<cases.size(); k++) {
+		const bench_case& c = cases[k];
+		vcl_string name = case_name(c);
+		bench_result r = time_case_in_child(c, min_time());
+
+		if (!r.ok) {
+			vcl_cerr << "bench_pyramid: " << name << " failed" << vcl_endl;
+			continue;
+		}
+
+		double pixels = (double) c.ni*c.nj;
+		double ns_per_px = 1e9*r.seconds/pixels;
+		vcl_fprintf(f, "%s{\"name\": \"%s\", \"op\": \"%s\", \"image\": \"%s\", "
+		            "\"ni\": %d, \"nj\": %d, \"nplanes\": %d, \"a\": %g, "
+		            "\"iterations\": %d, \"seconds\": %.6f, \"mpix_per_s\": %.3f, "
+		            "\"ns_per_px\": %.3f, \"peak_rss_kb\": %ld}",
+		            (nresults++ > 0) ? ",\n" : "", name.c_str(), op_names[c.op], c.image.c_str(),
+		            c.ni, c.nj, c.nplanes, c.a, r.iterations, r.seconds,
+		            pixels/r.seconds/1e6, ns_per_px, r.peak_rss_kb);
+		vcl_fflush(f);
+
+		vcl_map<vcl_string, double>::const_iterator b = base.find(name);
+		if ((b != base.end()) && (ns_per_px > b->second*(1 + threshold()))) {
+			vcl_cerr << "bench_pyramid: regression in " << name << ": " << ns_per_px
+			         << " ns/pixel (baseline " << b->second << " ns/pixel)" << vcl_endl;
+			regressions++;
+		}
+	}
+	vcl_fprintf(f, "\n]\n}\n");
+	if (f != stdout)
+		vcl_fclose(f);
+
+	if (baseline.set())
+		vcl_cerr << "bench_pyramid: " << regressions << " regression(s) above "
+		         << 100*threshold() << "%" << vcl_endl;
+
+	return (regressions > 0) ? 1 : 0;
+}
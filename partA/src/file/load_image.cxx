@@ -2,6 +2,11 @@
 
 #include "../vxl_includes.h"
 
+#include <vcl_algorithm.h>
+#include <vcl_vector.h>
+#include <core/vil/file_formats/vil_jpeglib.h>
+#include <setjmp.h>
+
 // function takes a filename as input and returns a 3-component
 // rgb VXL image, upon failure, the returned image has 0 rows and
 // columns
@@ -48,4 +53,133 @@ vil_image_view<vxl_byte> load_image1(vcl_string fname)
 	return vil_convert_cast(vxl_byte(), vil_load(fname.c_str()));
 }
 
+// the error handler of the scaled JPEG decoder: libjpeg's default
+// handler exits the program, so errors jump back to the decoder,
+// which returns an empty image
+struct scaled_jpeg_error {
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+static void scaled_jpeg_error_exit(j_common_ptr cinfo)
+{
+	longjmp(((scaled_jpeg_error*) cinfo->err)->jump, 1);
+}
+
+// Decode a JPEG file at 1/2^l of its resolution (0<=l<=3), letting
+// libjpeg scale the 8x8 blocks in the DCT domain. The routine returns
+// false if the file is not a grayscale or YCbCr/RGB JPEG image, or
+// if it cannot be decoded
+static bool load_jpeg_scaled(const char* fname, int l,
+                             vil_image_view<vil_rgb<vxl_byte> >& im)
+{
+	struct jpeg_decompress_struct cinfo;
+	scaled_jpeg_error err;
+	vcl_vector<JSAMPLE> row;
+	vcl_FILE* f = vcl_fopen(fname, "rb");
+
+	if (f == 0)
+		return false;
+	// only look at files that start with a JPEG SOI marker
+	if ((vcl_fgetc(f) != 0xFF) || (vcl_fgetc(f) != 0xD8)) {
+		vcl_fclose(f);
+		return false;
+	}
+	vcl_rewind(f);
+
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = scaled_jpeg_error_exit;
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&cinfo);
+		vcl_fclose(f);
+		im = vil_image_view<vil_rgb<vxl_byte> >();
+		return false;
+	}
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, f);
+	jpeg_read_header(&cinfo, TRUE);
+	if ((cinfo.jpeg_color_space != JCS_GRAYSCALE) &&
+		(cinfo.jpeg_color_space != JCS_YCbCr) && (cinfo.jpeg_color_space != JCS_RGB)) {
+		jpeg_destroy_decompress(&cinfo);
+		vcl_fclose(f);
+		return false;
+	}
+	// the decoded dimensions are ceil(M/2^l)xceil(P/2^l)
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1 << l;
+	cinfo.out_color_space = (cinfo.jpeg_color_space == JCS_GRAYSCALE) ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+
+	int n = cinfo.output_components;
+	im.set_size(cinfo.output_width, cinfo.output_height);
+	row.resize(cinfo.output_width*n);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		int j = cinfo.output_scanline;
+		JSAMPROW rows = &row[0];
+		jpeg_read_scanlines(&cinfo, &rows, 1);
+		for (unsigned i=0; i<cinfo.output_width; i++) {
+			const JSAMPLE* p = &row[i*n];
+			// grayscale images get 3 identical planes, like load_image()
+			im(i,j) = (n == 1) ? vil_rgb<vxl_byte>(p[0], p[0], p[0]) 
+			                   : vil_rgb<vxl_byte>(p[0], p[1], p[2]);
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	vcl_fclose(f);
+
+	return true;
+}
+
+// Reduce an image by 2 along each axis by averaging blocks of 2x2
+// pixels (the blocks of the last row and column are clipped)
+static vil_image_view<vil_rgb<vxl_byte> > halve(const vil_image_view<vil_rgb<vxl_byte> >& im)
+{
+	int ni = (im.ni() + 1)/2;
+	int nj = (im.nj() + 1)/2;
+	vil_image_view<vil_rgb<vxl_byte> > half(ni, nj);
+
+	for (int j=0; j<nj; j++)
+		for (int i=0; i<ni; i++) {
+			int i1 = vcl_min(2*i + 1, (int) im.ni() - 1);
+			int j1 = vcl_min(2*j + 1, (int) im.nj() - 1);
+			int r = 0, g = 0, b = 0, n = 0;
+			for (int jj=2*j; jj<=j1; jj++)
+				for (int ii=2*i; ii<=i1; ii++) {
+					const vil_rgb<vxl_byte>& p = im(ii,jj);
+					r += p.r;
+					g += p.g;
+					b += p.b;
+					n++;
+				}
+			half(i,j) = vil_rgb<vxl_byte>((r + n/2)/n, (g + n/2)/n, (b + n/2)/n);
+		}
+
+	return half;
+}
+
+// function takes a filename and a pyramid level l as input and 
+// returns a 3-component rgb VXL image of the file reduced l times,
+// upon failure, the returned image has 0 rows and columns
+vil_image_view<vil_rgb<vxl_byte> > load_image_scaled(vcl_string fname, int l)
+{
+	vil_image_view<vil_rgb<vxl_byte> > im;
+
+	// if the filename string was empty
+	if ((fname.empty() == true) || (l < 0))
+		// return an empty image
+		return im;
+
+	// libjpeg scales by at most 8, and the remaining levels are
+	// reduced from the 1/8 image; other formats are decoded in full
+	int k = vcl_min(l, 3);
+	if (load_jpeg_scaled(fname.c_str(), k, im) == false) {
+		im = load_image(fname);
+		k = 0;
+	}
+	for (; (k < l) && (im.ni() > 0) && (im.nj() > 0); k++)
+		im = halve(im);
 
+	return im;
+}
@@ -19,6 +19,18 @@ vil_image_view<vil_rgb<vxl_byte> > load_image(vcl_string fname);
 // jpeg and pnm images
 vil_image_view<vxl_byte> load_image1(vcl_string fname);
 
+// a function that takes a filename as input and returns a 3-component
+// rgb VXL image of the file reduced l times by 2 along each axis, ie.
+// of dimensions ceil(M/2^l)xceil(P/2^l) for an MxP image (the
+// dimensions of level l of its pyramid). JPEG images are decoded
+// directly at 1/2, 1/4 or 1/8 of their resolution, which skips most
+// of the inverse DCT and of the color conversion; images in other
+// formats (and levels above 3) are reduced by averaging blocks of
+// 2x2 pixels. The result approximates level l of the Gauss pyramid
+// of the image, not its exact value. Upon failure, the returned
+// image has zero rows and columns
+vil_image_view<vil_rgb<vxl_byte> > load_image_scaled(vcl_string fname, int l);
+
 
 #endif
 
@@ -20,6 +20,23 @@
 // code the implements morphing operations
 #include "morphing/morphing.h"
 
+// parallel loops used by the pyramid routines
+#include "thread/parallel.h"
+
+// out-of-core pyramids for blending very large images
+#include "pyramid/tiled_pyramid.h"
+
+// blending many image sets listed in a manifest
+#include "pyramid/blend_batch.h"
+#include "pyramid/fuse.h"
+#include "pyramid/blend_video.h"
+
+
+// Return true if fname names a pyramid saved in binary form
+static bool is_pyr_file(const vcl_string& fname)
+{
+	return (fname.size() > 4) && (fname.compare(fname.size() - 4, 4, ".pyr") == 0);
+}
 
 // Routine for processing the command-line arguments (defined below)
 // It returns false if the program should exit immediately after this
@@ -99,6 +116,9 @@ bool process_args(int argc, char** argv, matting& M, inpainting* I,
 	 vul_arg<double> mt(arg_list, "-mt","The t parameter",morphing::get_t_default());
 	 vul_arg<int> mnum(arg_list, "-mnum","The number of intermediate images to generate", morphing::get_num_images_default());
 	 vul_arg<vcl_string> mlines(arg_list,"-mlines","The file containing line pairs","");
+	 vul_arg<int> mthreads(arg_list, "-mthreads", "The number of threads used to warp and cross-dissolve the images", 1);
+	 vul_arg<double> mtol(arg_list, "-mtol", "Approximate the warps on an adaptive grid, refining its cells until the displacements are within the given number of pixels", 0);
+	 vul_arg<int> mgrid(arg_list, "-mgrid", "The spacing of the coarsest grid of -mtol (a power of 2)", 8);
 
 	 // blending options
 	 vul_arg<bool> blend(arg_list, "-blending", "Run the pyramid blending algorithm", false);
@@ -114,6 +134,19 @@ bool process_args(int argc, char** argv, matting& M, inpainting* I,
 	 vul_arg<bool> blpyr1(arg_list, "-blpyr1", "Save the Laplacian pyramid of Source1", false);
 	 vul_arg<bool> blpyrm(arg_list, "-blpyrm", "Save the Laplacian pyramid of Mask", false);
 	 vul_arg<bool> blpyrb(arg_list, "-blpyrb", "Save the Laplacian pyramid of the Blended image", false);
+	 vul_arg<bool> bpyrfile(arg_list, "-bpyrfile", "Save the pyramids of the sources, the mask and the Blended image as binary .pyr files, which can be given to -bsource0/-bsource1 instead of images", false);
+	 vul_arg<bool> bref(arg_list, "-bref", "Use the (slow) floating-point reduce/expand routines instead of the fixed-point ones", false);
+	 vul_arg<int> bthreads(arg_list, "-bthreads", "The number of threads used to build, blend and collapse pyramids", 1);
+	 vul_arg<int> bsparse(arg_list, "-bsparse", "Blend with the given number of pyramid levels, only near the seam (the other pixels are copied from the sources)", 0);
+	 vul_arg<int> bpreview(arg_list, "-bpreview", "Blend progressively in the interface: show the result at the given pyramid level first and refine it in the background", 0);
+	 vul_arg<int> bapprox(arg_list, "-bapprox", "Seed the given number of Gauss levels of the source pyramids with scaled decodes of -bsource0/-bsource1 (fast, but the levels and the blend are approximate)", 0);
+	 vul_arg<vcl_string> btiled(arg_list, "-btiled", "Blend out of core, keeping the pyramids in the given scratch file (the result is written to <bblend>.ppm)", "");
+	 vul_arg<int> bbudget(arg_list, "-bbudget", "The memory (in MB) available to the tiles of out-of-core pyramids", 256);
+	 vul_arg<vcl_string> bmanifest(arg_list, "-bmanifest", "Blend every (source0 source1 mask blended) set of filenames listed in the given file", "");
+	 vul_arg<int> bworkers(arg_list, "-bworkers", "The number of image sets of -bmanifest blended at the same time (at most -bthreads)", 0);
+	 vul_arg<vcl_string> bfuse(arg_list, "-bfuse", "Fuse the (image weight) pairs of filenames listed in the given file into <bblend>.jpg", "");
+	 vul_arg<bool> bvideo(arg_list, "-bvideo", "Blend two frame sequences with the -bmask image: -bsource0, -bsource1 and -bblend are printf patterns of numbered image files (eg. frame%04d.png) or .y4m streams", false);
+	 vul_arg<int> bvfirst(arg_list, "-bvfirst", "The number of the first frame of numbered -bvideo sequences", 0);
 
     
      // Now set the switch for the help option
@@ -215,6 +248,12 @@ bool process_args(int argc, char** argv, matting& M, inpainting* I,
 		 Mrph->set_p(mp());
 		 Mrph->set_t(mt());
 		 Mrph->set_num_images(mnum());
+		 // should the warps be approximated?
+		 if (mtol.set() == true)
+			 Mrph->set_warp_tolerance(mtol(), mgrid());
+		 // how many threads should warp the images?
+		 if (mthreads.set() == true)
+			 set_parallel_threads(mthreads());
 		 // set the output filenames to use
 		 if (mbase.set() == true) {
 			 Mrph->set_morph_basename(mbase());
@@ -244,21 +283,150 @@ bool process_args(int argc, char** argv, matting& M, inpainting* I,
 	 //    now we process the blending arguments
 	 //
 	 if (blend.set() == true) {
-		 // did the user supply an image for Source0?
+		 // should we use the reference (floating-point) implementations of
+		 // reduce() and expand()?
+		 if (bref.set() == true)
+			 pyramid::use_reference_kernels(true);
+		 // how many threads should the pyramid routines use?
+		 if (bthreads.set() == true)
+			 set_parallel_threads(bthreads());
+		 // should we only blend near the seam?
+		 if (bsparse.set() == true)
+			 B->set_sparse(bsparse());
+		 // should the interface preview the blends at a low resolution?
+		 if (bpreview.set() == true)
+			 B->set_progressive(bpreview());
+		 // should we blend the images out of core? The images are read
+		 // and the result is written one tile at a time, so they never
+		 // have to fit in memory; the program exits when done
+		 if (btiled.set() == true) {
+			 if (!(bsource0.set() && bsource1.set() && bmask.set() && bblend.set())) {
+				 vcl_cerr << "-btiled requires -bsource0, -bsource1, -bmask and -bblend" << vcl_endl;
+				 return false;
+			 }
+			 vil_image_resource_sptr source0 = vil_load_image_resource(bsource0().c_str());
+			 vil_image_resource_sptr source1 = vil_load_image_resource(bsource1().c_str());
+			 vil_image_resource_sptr mask = vil_load_image_resource(bmask().c_str());
+			 if ((!source0) || (!source1) || (!mask)) {
+				 vcl_cerr << "vil_load_image_resource: error reading the input images" << vcl_endl;
+				 return false;
+			 }
+			 // PNM files can be written one tile at a time
+			 vcl_string name = bblend() + ".ppm";
+			 vil_image_resource_sptr result = 
+				 vil_new_image_resource(name.c_str(), source0->ni(), source0->nj(), 
+				                        source0->nplanes(), VIL_PIXEL_FORMAT_BYTE, "pnm");
+			 if (!result) {
+				 vcl_cerr << "vil_new_image_resource: error creating " << name << vcl_endl;
+				 return false;
+			 }
+
+			 vcl_cerr << "process_args(): blending the images out of core..." << vcl_endl;
+			 if (blend_tiled(source0, source1, mask, result, btiled().c_str(), 
+			                 (vcl_size_t) bbudget() << 20) == false)
+				 vcl_cerr << "blend_tiled(): An error occured -- exiting" << vcl_endl;
+			 return false;
+		 }
+		 // should we blend all the image sets listed in a manifest? The 
+		 // images of the next sets are decoded while the current ones
+		 // are blended; the program exits when done
+		 if (bmanifest.set() == true) {
+			 vcl_vector<blend_job> jobs;
+			 if (read_blend_manifest(bmanifest().c_str(), jobs) == false) {
+				 vcl_cerr << "read_blend_manifest(): error reading " << bmanifest() << vcl_endl;
+				 return false;
+			 }
+			 // by default, every thread blends its own image set
+			 int workers = (bworkers.set() == true) ? bworkers() : parallel_threads();
+
+			 vcl_cerr << "process_args(): blending " << jobs.size() << " image sets..." << vcl_endl;
+			 if (blend_batch(jobs, workers, vcl_cerr) > 0)
+				 vcl_cerr << "blend_batch(): some image sets could not be blended" << vcl_endl;
+			 return false;
+		 }
+		 // should we fuse the images listed in a manifest, weighted by
+		 // their weight maps? The program exits when done
+		 if (bfuse.set() == true) {
+			 vcl_vector<fuse_input> inputs;
+			 vil_image_view<vxl_byte> fused;
+			 if (!bblend.set()) {
+				 vcl_cerr << "-bfuse requires -bblend" << vcl_endl;
+				 return false;
+			 }
+			 if (read_fuse_manifest(bfuse().c_str(), inputs) == false) {
+				 vcl_cerr << "read_fuse_manifest(): error reading " << bfuse() << vcl_endl;
+				 return false;
+			 }
+
+			 vcl_cerr << "process_args(): fusing " << inputs.size() << " images..." << vcl_endl;
+			 vcl_string name = bblend() + ".jpg";
+			 if (fuse(inputs, fused) == false)
+				 vcl_cerr << "fuse(): An error occured -- exiting" << vcl_endl;
+			 else if (vil_save(fused, name.c_str()) == false)
+				 vcl_cerr << "vil_save(): error writing " << name << vcl_endl;
+			 return false;
+		 }
+		 // should we blend two frame sequences? The mask pyramid is built
+		 // once for all the frames; the program exits when done
+		 if (bvideo.set() == true) {
+			 if (!(bsource0.set() && bsource1.set() && bmask.set() && bblend.set())) {
+				 vcl_cerr << "-bvideo requires -bsource0, -bsource1, -bmask and -bblend" << vcl_endl;
+				 return false;
+			 }
+			 vil_image_view<vxl_byte> mask = load_image1(bmask());
+			 if ((mask.ni() == 0) || (mask.nj() == 0)) {
+				 vcl_cerr << "load_image1(): error reading " << bmask() << vcl_endl;
+				 return false;
+			 }
+
+			 vcl_cerr << "process_args(): blending the frame sequences..." << vcl_endl;
+			 if (blend_video(bsource0().c_str(), bsource1().c_str(), mask, 
+			                 bblend().c_str(), bvfirst(), vcl_cerr) == false)
+				 vcl_cerr << "blend_video(): An error occured -- exiting" << vcl_endl;
+			 return false;
+		 }
+		 // did the user supply an image for Source0? Sources can also be
+		 // given as pyramids saved with -bpyrfile, which are not rebuilt
 		 if (bsource0.set() == true) {
 			 vcl_cerr << "process_args(): loading input image(s) ..." << vcl_endl;
-			 if (B->set(B->Source0, load_image(bsource0())) == false) {
+			 bool ok;
+			 if (is_pyr_file(bsource0()) == true)
+				 ok = B->load_pyramid_file(B->Source0, bsource0().c_str());
+			 else
+				 ok = B->set(B->Source0, load_image(bsource0()));
+			 if (ok == false) {
 				vcl_cerr << "blending::set: error reading image " << bsource0() << vcl_endl;
 				return false;
 			 }
+			 // should the coarse levels of its pyramid be approximated?
+			 if ((bapprox() > 0) && (is_pyr_file(bsource0()) == false)) {
+				 vcl_vector<vil_image_view<vil_rgb<vxl_byte> > > coarse;
+				 for (int l=1; l<=bapprox(); l++)
+					 coarse.push_back(load_image_scaled(bsource0(), l));
+				 if (B->set_seeds(B->Source0, coarse) == false)
+					 vcl_cerr << "blending::set_seeds: error decoding " << bsource0() << " at a lower resolution" << vcl_endl;
+			 }
 		 }
 		 // did the user supply an image for Source1?
 		 if (bsource1.set() == true) {
 			 vcl_cerr << "process_args(): loading input image(s) ..." << vcl_endl;
-			 if (B->set(B->Source1, load_image(bsource1())) == false) {
+			 bool ok;
+			 if (is_pyr_file(bsource1()) == true)
+				 ok = B->load_pyramid_file(B->Source1, bsource1().c_str());
+			 else
+				 ok = B->set(B->Source1, load_image(bsource1()));
+			 if (ok == false) {
 				vcl_cerr << "blending::set: error reading image " << bsource1() << vcl_endl;
 				return false;
 			 }
+			 // should the coarse levels of its pyramid be approximated?
+			 if ((bapprox() > 0) && (is_pyr_file(bsource1()) == false)) {
+				 vcl_vector<vil_image_view<vil_rgb<vxl_byte> > > coarse;
+				 for (int l=1; l<=bapprox(); l++)
+					 coarse.push_back(load_image_scaled(bsource1(), l));
+				 if (B->set_seeds(B->Source1, coarse) == false)
+					 vcl_cerr << "blending::set_seeds: error decoding " << bsource1() << " at a lower resolution" << vcl_endl;
+			 }
 		 }
 		 // did the user supply an image for the Mask?
 		 if (bmask.set() == true) {
@@ -289,6 +457,17 @@ bool process_args(int argc, char** argv, matting& M, inpainting* I,
 				 vcl_cerr << "vil_save: error occured while saving blended image" << vcl_endl;
 		 }
 		 //
+		 // saving the pyramids in binary form
+		 //
+		 if (bpyrfile.set() == true) {
+			 const char* basename = (bblend.set() == true) ? bblend().c_str() : "Pyramid";
+			 if ((B->save_pyramid_file(B->Source0, basename) == false) ||
+			     (B->save_pyramid_file(B->Source1, basename) == false) ||
+			     (B->save_pyramid_file(B->Mask, basename) == false) ||
+			     (B->save_pyramid_file(B->Blend, basename) == false))
+				 vcl_cerr << "pyramid::save: error occured while saving the .pyr files" << vcl_endl;
+		 }
+		 //
 		 // saving the Gauss pyramids
 		 //
 		 // write the source0 pyramid
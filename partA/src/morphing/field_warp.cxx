@@ -0,0 +1,727 @@
+#include "field_warp.h"
+#include "../thread/parallel.h"
+#include "../thread/thread.h"
+
+#include <vcl_algorithm.h>
+#include <vcl_cmath.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// the smallest value of a + dist, which keeps the weights finite
+// when a is 0
+static const float min_denominator = 1e-6f;
+
+// the largest weight of a line: with a = 0 and a large b, the weight
+// of a line for the pixels on it is too large for a float, and the
+// sums of the weighted displacements would overflow to inf (and the
+// displacements to NaN). Pixels on several lines get equal weights
+// from all of them
+static const float max_weight = 1e30f;
+
+field_warp_lines::field_warp_lines(const linepairs& lps, double a_, double b_, double p)
+{
+	// the coordinates are read in place (see linepairs.h)
+	const double *P_i = lps.P_i(0), *P_j = lps.P_j(0), *Q_i = lps.Q_i(0), *Q_j = lps.Q_j(0);
+	const double *Pp_i = lps.P_i(1), *Pp_j = lps.P_j(1), *Qp_i = lps.Q_i(1), *Qp_j = lps.Q_j(1);
+
+	n = lps.size();
+	a = (float) a_;
+	b = (float) b_;
+
+	pi.resize(n); pj.resize(n); len.resize(n);
+	ui_i.resize(n); ui_j.resize(n); vi_i.resize(n); vi_j.resize(n);
+	spi.resize(n); spj.resize(n); sdi.resize(n); sdj.resize(n);
+	sni.resize(n); snj.resize(n);
+	len_pb.resize(n);
+
+	// pairs with a zero-length line have no defined coordinates and
+	// are skipped, as interpolate() does (see linepairs.h)
+	int m = 0;
+	for (int k=0; k<n; k++) {
+		// the line in the destination
+		double di = Qp_i[k] - Pp_i[k];
+		double dj = Qp_j[k] - Pp_j[k];
+		double len2 = di*di + dj*dj;
+		double len_k = vcl_sqrt(len2);
+		// the line in the source
+		double sdi_k = Q_i[k] - P_i[k];
+		double sdj_k = Q_j[k] - P_j[k];
+		double slen = vcl_sqrt(sdi_k*sdi_k + sdj_k*sdj_k);
+		if ((len2 == 0) || (slen == 0))
+			continue;
+
+		pi[m] = (float) Pp_i[k];
+		pj[m] = (float) Pp_j[k];
+		len[m] = (float) len_k;
+		ui_i[m] = (float) (di/len2);
+		ui_j[m] = (float) (dj/len2);
+		vi_i[m] = (float) (-dj/len_k);
+		vi_j[m] = (float) (di/len_k);
+		spi[m] = (float) P_i[k];
+		spj[m] = (float) P_j[k];
+		sdi[m] = (float) sdi_k;
+		sdj[m] = (float) sdj_k;
+		sni[m] = (float) (-sdj_k/slen);
+		snj[m] = (float) (sdi_k/slen);
+		len_pb[m] = (float) vcl_min(vcl_pow(len_k, p*b_), (double) max_weight);
+		m++;
+	}
+
+	n = m;
+	pi.resize(n); pj.resize(n); len.resize(n);
+	ui_i.resize(n); ui_j.resize(n); vi_i.resize(n); vi_j.resize(n);
+	spi.resize(n); spj.resize(n); sdi.resize(n); sdj.resize(n);
+	sni.resize(n); snj.resize(n);
+	len_pb.resize(n);
+}
+
+// The terms of the line equations that only depend on the row j of
+// the pixels, for every line k:
+//
+//   u  = X ui_i + cu,  v = X vi_i + cv
+//   displacement along j = spj - j + u sdj + v snj
+//
+struct field_warp_row {
+	vcl_vector<float> cu, cv, cj;
+
+	void set(const field_warp_lines& L, int j)
+	{
+		cu.resize(L.n); cv.resize(L.n); cj.resize(L.n);
+		for (int k=0; k<L.n; k++) {
+			float yp = j - L.pj[k];
+			cu[k] = yp*L.ui_j[k] - L.pi[k]*L.ui_i[k];
+			cv[k] = yp*L.vi_j[k] - L.pi[k]*L.vi_i[k];
+			cj[k] = L.spj[k] - j;
+		}
+	}
+};
+
+#ifdef __AVX2__
+
+// a*b + c, with a single rounding when the compiler targets FMA
+static inline __m256 madd(__m256 a, __m256 b, __m256 c)
+{
+#ifdef __FMA__
+	return _mm256_fmadd_ps(a, b, c);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+// log2(x) for normal x > 0: with x = m 2^e and m in [sqrt(1/2),sqrt(2)),
+// log2(m) = 2 atanh(s)/ln(2) with s = (m-1)/(m+1), |s| < 0.172, whose
+// series is truncated after s^5 (absolute error below 2e-6)
+static inline __m256 log2_avx2(__m256 x)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256i bits = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23),
+	                                               _mm256_set1_epi32(127)));
+	__m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+		_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+		_mm256_set1_epi32(0x3f800000)));
+	__m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GE_OQ);
+	m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+	e = _mm256_add_ps(e, _mm256_and_ps(big, one));
+
+	// 1/(m+1) by a reciprocal estimate refined by a Newton step, which
+	// is much faster than a division
+	__m256 m1 = _mm256_add_ps(m, one);
+	__m256 r = _mm256_rcp_ps(m1);
+	r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(2.0f), _mm256_mul_ps(m1, r)));
+	__m256 s = _mm256_mul_ps(_mm256_sub_ps(m, one), r);
+	__m256 s2 = _mm256_mul_ps(s, s);
+	__m256 poly = _mm256_set1_ps(0.57707802f);               // 2/(5 ln 2)
+	poly = madd(poly, s2, _mm256_set1_ps(0.96179669f));      // 2/(3 ln 2)
+	poly = madd(poly, s2, _mm256_set1_ps(2.88539008f));      // 2/ln 2
+	return madd(s, poly, e);
+}
+
+// 2^y: with y = n + f, n an integer and |f| <= 1/2, 2^f is the
+// Taylor series of exp(f ln 2) truncated after f^5 (relative error
+// below 3e-6)
+static inline __m256 exp2_avx2(__m256 y)
+{
+	y = _mm256_min_ps(_mm256_max_ps(y, _mm256_set1_ps(-126.0f)), _mm256_set1_ps(126.0f));
+	__m256 n = _mm256_round_ps(y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 f = _mm256_sub_ps(y, n);
+
+	__m256 poly = _mm256_set1_ps(1.3333558e-3f);
+	poly = madd(poly, f, _mm256_set1_ps(9.6181291e-3f));
+	poly = madd(poly, f, _mm256_set1_ps(5.5504109e-2f));
+	poly = madd(poly, f, _mm256_set1_ps(0.24022651f));
+	poly = madd(poly, f, _mm256_set1_ps(0.69314718f));
+	poly = madd(poly, f, _mm256_set1_ps(1.0f));
+
+	__m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n),
+	                                                   _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(poly, _mm256_castsi256_ps(scale));
+}
+
+// The weight of a line for the 8 pixels with projections u and v
+// on the line, w = |Q'-P'|^(pb) (a + dist)^(-b), where dist^2 is v^2
+// plus the square of the distance along the line beyond P' (u < 0)
+// or Q' (u > 1); w is at most max_weight
+static inline __m256 weight_avx2(__m256 u, __m256 v, __m256 len, __m256 len_pb,
+                                 __m256 a, __m256 minus_b)
+{
+	__m256 beyond = _mm256_sub_ps(u, _mm256_min_ps(_mm256_max_ps(u, _mm256_setzero_ps()),
+	                                               _mm256_set1_ps(1.0f)));
+	beyond = _mm256_mul_ps(beyond, len);
+	__m256 dist2 = madd(beyond, beyond, _mm256_mul_ps(v, v));
+
+	__m256 denominator = _mm256_max_ps(_mm256_add_ps(a, _mm256_sqrt_ps(dist2)),
+	                                   _mm256_set1_ps(min_denominator));
+	__m256 w = _mm256_mul_ps(len_pb, exp2_avx2(_mm256_mul_ps(minus_b, log2_avx2(denominator))));
+	return _mm256_min_ps(w, _mm256_set1_ps(max_weight));
+}
+
+// Compute the source positions of the pixels i0,...,i1-1 of row j;
+// si and sj must have room for i1-i0 rounded up to a multiple of 16
+// (see field_warp_row for the terms of u, v and the displacements)
+static void warp_row(const field_warp_lines& L, const field_warp_row& R,
+                     int j, int i0, int i1, float* si, float* sj)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 a = _mm256_set1_ps(L.a);
+	const __m256 minus_b = _mm256_set1_ps(-L.b);
+	const __m256 ramp = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 Y = _mm256_set1_ps((float) j);
+
+	for (int i=i0; i<i1; i+=16) {
+		// two independent vectors of 8 pixels, whose instructions can be
+		// interleaved
+		__m256 X[2], sum_i[2], sum_j[2], sum_w[2];
+		X[0] = _mm256_add_ps(_mm256_set1_ps((float) i), ramp);
+		X[1] = _mm256_add_ps(_mm256_set1_ps((float) (i + 8)), ramp);
+		sum_i[0] = sum_i[1] = sum_j[0] = sum_j[1] = sum_w[0] = sum_w[1] = zero;
+
+		for (int k=0; k<L.n; k++) {
+			const __m256 ui_i = _mm256_set1_ps(L.ui_i[k]), cu = _mm256_set1_ps(R.cu[k]);
+			const __m256 vi_i = _mm256_set1_ps(L.vi_i[k]), cv = _mm256_set1_ps(R.cv[k]);
+			const __m256 spi = _mm256_set1_ps(L.spi[k]), cj = _mm256_set1_ps(R.cj[k]);
+			const __m256 sdi = _mm256_set1_ps(L.sdi[k]), sdj = _mm256_set1_ps(L.sdj[k]);
+			const __m256 sni = _mm256_set1_ps(L.sni[k]), snj = _mm256_set1_ps(L.snj[k]);
+			const __m256 len = _mm256_set1_ps(L.len[k]), len_pb = _mm256_set1_ps(L.len_pb[k]);
+
+			for (int h=0; h<2; h++) {
+				__m256 u = madd(X[h], ui_i, cu);
+				__m256 v = madd(X[h], vi_i, cv);
+
+				// the displacement X'-X
+				__m256 disp_i = madd(u, sdi, _mm256_sub_ps(spi, X[h]));
+				disp_i = madd(v, sni, disp_i);
+				__m256 disp_j = madd(v, snj, madd(u, sdj, cj));
+
+				__m256 w = weight_avx2(u, v, len, len_pb, a, minus_b);
+
+				sum_i[h] = madd(disp_i, w, sum_i[h]);
+				sum_j[h] = madd(disp_j, w, sum_j[h]);
+				sum_w[h] = _mm256_add_ps(sum_w[h], w);
+			}
+		}
+
+		for (int h=0; h<2; h++) {
+			_mm256_storeu_ps(si + (i - i0) + 8*h, _mm256_add_ps(X[h], _mm256_div_ps(sum_i[h], sum_w[h])));
+			_mm256_storeu_ps(sj + (i - i0) + 8*h, _mm256_add_ps(Y, _mm256_div_ps(sum_j[h], sum_w[h])));
+		}
+	}
+}
+
+// Compute the source positions (si,sj) of the count points (X,Y);
+// the arrays must have room for count rounded up to a multiple of 16
+// (the padding of X and Y must hold valid coordinates)
+static void warp_points(const field_warp_lines& L, int count,
+                        const float* X, const float* Y, float* si, float* sj)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 a = _mm256_set1_ps(L.a);
+	const __m256 minus_b = _mm256_set1_ps(-L.b);
+
+	for (int m=0; m<count; m+=16) {
+		__m256 x[2], y[2], sum_i[2], sum_j[2], sum_w[2];
+		for (int h=0; h<2; h++) {
+			x[h] = _mm256_loadu_ps(X + m + 8*h);
+			y[h] = _mm256_loadu_ps(Y + m + 8*h);
+			sum_i[h] = sum_j[h] = sum_w[h] = zero;
+		}
+
+		for (int k=0; k<L.n; k++) {
+			const __m256 pi = _mm256_set1_ps(L.pi[k]), pj = _mm256_set1_ps(L.pj[k]);
+			const __m256 ui_i = _mm256_set1_ps(L.ui_i[k]), ui_j = _mm256_set1_ps(L.ui_j[k]);
+			const __m256 vi_i = _mm256_set1_ps(L.vi_i[k]), vi_j = _mm256_set1_ps(L.vi_j[k]);
+			const __m256 spi = _mm256_set1_ps(L.spi[k]), spj = _mm256_set1_ps(L.spj[k]);
+			const __m256 sdi = _mm256_set1_ps(L.sdi[k]), sdj = _mm256_set1_ps(L.sdj[k]);
+			const __m256 sni = _mm256_set1_ps(L.sni[k]), snj = _mm256_set1_ps(L.snj[k]);
+			const __m256 len = _mm256_set1_ps(L.len[k]), len_pb = _mm256_set1_ps(L.len_pb[k]);
+
+			for (int h=0; h<2; h++) {
+				__m256 xp = _mm256_sub_ps(x[h], pi);
+				__m256 yp = _mm256_sub_ps(y[h], pj);
+				__m256 u = madd(xp, ui_i, _mm256_mul_ps(yp, ui_j));
+				__m256 v = madd(xp, vi_i, _mm256_mul_ps(yp, vi_j));
+
+				__m256 disp_i = madd(v, sni, madd(u, sdi, _mm256_sub_ps(spi, x[h])));
+				__m256 disp_j = madd(v, snj, madd(u, sdj, _mm256_sub_ps(spj, y[h])));
+				__m256 w = weight_avx2(u, v, len, len_pb, a, minus_b);
+
+				sum_i[h] = madd(disp_i, w, sum_i[h]);
+				sum_j[h] = madd(disp_j, w, sum_j[h]);
+				sum_w[h] = _mm256_add_ps(sum_w[h], w);
+			}
+		}
+
+		for (int h=0; h<2; h++) {
+			_mm256_storeu_ps(si + m + 8*h, _mm256_add_ps(x[h], _mm256_div_ps(sum_i[h], sum_w[h])));
+			_mm256_storeu_ps(sj + m + 8*h, _mm256_add_ps(y[h], _mm256_div_ps(sum_j[h], sum_w[h])));
+		}
+	}
+}
+
+#else
+
+// The weight of line k for a pixel with projections u and v on the
+// line (see weight_avx2())
+static inline float weight(const field_warp_lines& L, int k, float u, float v)
+{
+	float beyond = (u - vcl_min(vcl_max(u, 0.0f), 1.0f))*L.len[k];
+	float dist2 = beyond*beyond + v*v;
+
+	float denominator = vcl_max(L.a + vcl_sqrt(dist2), min_denominator);
+	return vcl_min(L.len_pb[k]*vcl_pow(denominator, -L.b), max_weight);
+}
+
+static void warp_row(const field_warp_lines& L, const field_warp_row& R,
+                     int j, int i0, int i1, float* si, float* sj)
+{
+	for (int i=i0; i<i1; i++) {
+		float X = (float) i;
+		float sum_i = 0, sum_j = 0, sum_w = 0;
+
+		for (int k=0; k<L.n; k++) {
+			float u = X*L.ui_i[k] + R.cu[k];
+			float v = X*L.vi_i[k] + R.cv[k];
+			float disp_i = L.spi[k] - X + u*L.sdi[k] + v*L.sni[k];
+			float disp_j = R.cj[k] + u*L.sdj[k] + v*L.snj[k];
+			float w = weight(L, k, u, v);
+			sum_i += disp_i*w;
+			sum_j += disp_j*w;
+			sum_w += w;
+		}
+
+		si[i - i0] = X + sum_i/sum_w;
+		sj[i - i0] = j + sum_j/sum_w;
+	}
+}
+
+static void warp_points(const field_warp_lines& L, int count,
+                        const float* X, const float* Y, float* si, float* sj)
+{
+	for (int m=0; m<count; m++) {
+		float sum_i = 0, sum_j = 0, sum_w = 0;
+
+		for (int k=0; k<L.n; k++) {
+			float xp = X[m] - L.pi[k];
+			float yp = Y[m] - L.pj[k];
+			float u = xp*L.ui_i[k] + yp*L.ui_j[k];
+			float v = xp*L.vi_i[k] + yp*L.vi_j[k];
+			float disp_i = L.spi[k] - X[m] + u*L.sdi[k] + v*L.sni[k];
+			float disp_j = L.spj[k] - Y[m] + u*L.sdj[k] + v*L.snj[k];
+			float w = weight(L, k, u, v);
+			sum_i += disp_i*w;
+			sum_j += disp_j*w;
+			sum_w += w;
+		}
+
+		si[m] = X[m] + sum_i/sum_w;
+		sj[m] = Y[m] + sum_j/sum_w;
+	}
+}
+
+#endif
+
+// Sample the source bilinearly at (x,y), clamped to the image
+static inline vil_rgb<vxl_byte> sample(const vil_image_view<vil_rgb<vxl_byte> >& im,
+                                       float x, float y)
+{
+	int ni = im.ni();
+	int nj = im.nj();
+
+	// the comparisons also map NaNs to the border
+	x = (x > 0) ? vcl_min(x, (float) (ni - 1)) : 0;
+	y = (y > 0) ? vcl_min(y, (float) (nj - 1)) : 0;
+
+	int i = (int) x;
+	int j = (int) y;
+	float fx = x - i;
+	float fy = y - j;
+	int di = (i + 1 < ni) ? im.istep() : 0;
+	int dj = (j + 1 < nj) ? im.jstep() : 0;
+
+	const vil_rgb<vxl_byte>* p00 = im.top_left_ptr() + i*im.istep() + j*im.jstep();
+	const vil_rgb<vxl_byte>* p10 = p00 + di;
+	const vil_rgb<vxl_byte>* p01 = p00 + dj;
+	const vil_rgb<vxl_byte>* p11 = p01 + di;
+
+	float r0 = p00->r + fx*(p10->r - p00->r), r1 = p01->r + fx*(p11->r - p01->r);
+	float g0 = p00->g + fx*(p10->g - p00->g), g1 = p01->g + fx*(p11->g - p01->g);
+	float b0 = p00->b + fx*(p10->b - p00->b), b1 = p01->b + fx*(p11->b - p01->b);
+
+	return vil_rgb<vxl_byte>((vxl_byte) (r0 + fy*(r1 - r0) + 0.5f),
+	                         (vxl_byte) (g0 + fy*(g1 - g0) + 0.5f),
+	                         (vxl_byte) (b0 + fy*(b1 - b0) + 0.5f));
+}
+
+field_warp_grid::field_warp_grid(int spacing_, float tolerance_)
+{
+	// the largest power of 2 not above the spacing
+	spacing = 1;
+	while (2*spacing <= spacing_)
+		spacing *= 2;
+	tolerance = tolerance_;
+	pixels = points = refined = 0;
+}
+
+// The displacements of the nodes of an adaptive grid covering a
+// region, at the coordinates (x,y) relative to the corner of the
+// region; the nodes whose displacements are requested are evaluated
+// together by evaluate()
+struct grid_field {
+	const field_warp_lines& L;
+	int i0, j0;
+	// the nodes span (nx+1)x(ny+1) pixels
+	int nx;
+	vcl_vector<float> di, dj;
+	// whether the displacements of a node were requested
+	vcl_vector<bool> requested;
+	// the nodes to evaluate, with their coordinates in the image and
+	// their source positions (evaluate() pads the arrays to a multiple
+	// of 16)
+	vcl_vector<int> pending;
+	vcl_vector<float> X, Y, si, sj;
+	long points;
+
+	grid_field(const field_warp_lines& lines, int i0_, int j0_, int nx_, int ny_)
+		: L(lines), i0(i0_), j0(j0_), nx(nx_),
+		  di((nx_+1)*(ny_+1)), dj((nx_+1)*(ny_+1)), requested((nx_+1)*(ny_+1), false),
+		  points(0)
+	{
+	}
+
+	int node(int x, int y) const { return y*(nx+1) + x; }
+
+	void request(int x, int y)
+	{
+		int k = node(x, y);
+		if (!requested[k]) {
+			requested[k] = true;
+			pending.push_back(k);
+			X.push_back((float) (i0 + x));
+			Y.push_back((float) (j0 + y));
+		}
+	}
+
+	void evaluate()
+	{
+		int n = pending.size();
+		if (n == 0)
+			return;
+
+		int padded = ((n + 15)/16)*16;
+		X.resize(padded, X[0]);
+		Y.resize(padded, Y[0]);
+		si.resize(padded);
+		sj.resize(padded);
+		warp_points(L, n, &X[0], &Y[0], &si[0], &sj[0]);
+		for (int m=0; m<n; m++) {
+			di[pending[m]] = si[m] - X[m];
+			dj[pending[m]] = sj[m] - Y[m];
+		}
+		points += n;
+		pending.clear();
+		X.clear();
+		Y.clear();
+	}
+};
+
+// Is the segment (pi,pj)-(qi,qj) within distance r of (x,y)?
+static bool segment_near(float pi, float pj, float qi, float qj, float x, float y, float r)
+{
+	float di = qi - pi, dj = qj - pj;
+	float u = ((x - pi)*di + (y - pj)*dj)/(di*di + dj*dj);
+	u = vcl_min(vcl_max(u, 0.0f), 1.0f);
+	float ei = pi + u*di - x, ej = pj + u*dj - y;
+
+	return ei*ei + ej*ej <= r*r;
+}
+
+// A square cell of an adaptive grid, of the given size
+struct grid_cell {
+	int x, y, size;
+};
+
+// Warp the pixels of a region with the displacements interpolated on
+// an adaptive grid (see field_warp_grid)
+static void adaptive_warp_region(const vil_image_view<vil_rgb<vxl_byte> >& source,
+                                 const field_warp_lines& lines,
+                                 int i0, int j0, int i1, int j1,
+                                 vil_image_view<vil_rgb<vxl_byte> >& destination,
+                                 field_warp_grid& grid)
+{
+	const int G = grid.spacing;
+	// the cells cover the region, and may extend beyond it
+	int ncx = (i1 - i0 + G - 1)/G;
+	int ncy = (j1 - j0 + G - 1)/G;
+	grid_field field(lines, i0, j0, ncx*G, ncy*G);
+	vcl_vector<grid_cell> cells, split;
+	int x, y, c, k;
+
+	// the displacements change quickly close to the lines and at their
+	// ends, so the cells that a line crosses are always split; these
+	// are the lines close to the region, with their ends relative to
+	// its corner
+	vcl_vector<float> near_pi, near_pj, near_qi, near_qj;
+	for (k=0; k<lines.n; k++) {
+		float len2 = lines.len[k]*lines.len[k];
+		float pi = lines.pi[k] - i0, pj = lines.pj[k] - j0;
+		float qi = pi + lines.ui_i[k]*len2, qj = pj + lines.ui_j[k]*len2;
+		if ((vcl_max(pi, qi) >= -G) && (vcl_min(pi, qi) <= (ncx + 1)*G) &&
+		    (vcl_max(pj, qj) >= -G) && (vcl_min(pj, qj) <= (ncy + 1)*G)) {
+			near_pi.push_back(pi);
+			near_pj.push_back(pj);
+			near_qi.push_back(qi);
+			near_qj.push_back(qj);
+		}
+	}
+
+	for (y=0; y<=ncy; y++)
+		for (x=0; x<=ncx; x++)
+			field.request(x*G, y*G);
+	field.evaluate();
+	for (y=0; y<ncy; y++)
+		for (x=0; x<ncx; x++) {
+			grid_cell cell = {x*G, y*G, G};
+			cells.push_back(cell);
+		}
+
+	while (!cells.empty()) {
+		for (c=0; c<(int) cells.size(); c++)
+			if (cells[c].size > 1)
+				field.request(cells[c].x + cells[c].size/2, cells[c].y + cells[c].size/2);
+		field.evaluate();
+
+		split.clear();
+		for (c=0; c<(int) cells.size(); c++) {
+			const grid_cell& cell = cells[c];
+			int s = cell.size, h = s/2;
+			int n00 = field.node(cell.x, cell.y), n10 = field.node(cell.x + s, cell.y);
+			int n01 = field.node(cell.x, cell.y + s), n11 = field.node(cell.x + s, cell.y + s);
+
+			if (s > 1) {
+				int nc = field.node(cell.x + h, cell.y + h);
+				float ei = field.di[nc] - 0.25f*(field.di[n00] + field.di[n10] + field.di[n01] + field.di[n11]);
+				float ej = field.dj[nc] - 0.25f*(field.dj[n00] + field.dj[n10] + field.dj[n01] + field.dj[n11]);
+				bool split_cell = (vcl_fabs(ei) > grid.tolerance) || (vcl_fabs(ej) > grid.tolerance);
+				for (k=0; (k<(int) near_pi.size()) && (!split_cell); k++)
+					split_cell = segment_near(near_pi[k], near_pj[k], near_qi[k], near_qj[k],
+					                          cell.x + 0.5f*s, cell.y + 0.5f*s, 0.75f*s);
+				if (split_cell) {
+					field.request(cell.x + h, cell.y);
+					field.request(cell.x, cell.y + h);
+					field.request(cell.x + s, cell.y + h);
+					field.request(cell.x + h, cell.y + s);
+					for (k=0; k<4; k++) {
+						grid_cell sub = {cell.x + (k & 1)*h, cell.y + (k >> 1)*h, h};
+						// (skipping those beyond the region)
+						if ((sub.x < i1 - i0) && (sub.y < j1 - j0))
+							split.push_back(sub);
+					}
+					grid.refined++;
+					continue;
+				}
+			}
+
+			// the cell is final: the displacements of the pixels
+			// [x,x+s)x[y,y+s) of the region are interpolated from its
+			// corners
+			int xe = vcl_min(cell.x + s, i1 - i0), ye = vcl_min(cell.y + s, j1 - j0);
+			float inv_s = 1.0f/s;
+			for (y=cell.y; y<ye; y++) {
+				float fy = (y - cell.y)*inv_s;
+				float left_i = field.di[n00] + fy*(field.di[n01] - field.di[n00]);
+				float left_j = field.dj[n00] + fy*(field.dj[n01] - field.dj[n00]);
+				float right_i = field.di[n10] + fy*(field.di[n11] - field.di[n10]);
+				float right_j = field.dj[n10] + fy*(field.dj[n11] - field.dj[n10]);
+				float step_i = (right_i - left_i)*inv_s, step_j = (right_j - left_j)*inv_s;
+				for (x=cell.x; x<xe; x++) {
+					float fx = (float) (x - cell.x);
+					destination(i0 + x, j0 + y) = sample(source, i0 + x + left_i + fx*step_i,
+					                                     j0 + y + left_j + fx*step_j);
+				}
+			}
+		}
+		field.evaluate();
+		cells.swap(split);
+	}
+
+	grid.pixels += (long) (i1 - i0)*(j1 - j0);
+	grid.points += field.points;
+}
+
+void field_warp_region(const vil_image_view<vil_rgb<vxl_byte> >& source,
+                       const field_warp_lines& lines,
+                       int i0, int j0, int i1, int j1,
+                       vil_image_view<vil_rgb<vxl_byte> >& destination,
+                       field_warp_grid* grid)
+{
+	if ((i0 >= i1) || (j0 >= j1))
+		return;
+
+	if (lines.n == 0) {
+		for (int j=j0; j<j1; j++)
+			for (int i=i0; i<i1; i++)
+				destination(i,j) = source(i,j);
+		return;
+	}
+
+	if (grid != 0) {
+		adaptive_warp_region(source, lines, i0, j0, i1, j1, destination, *grid);
+		return;
+	}
+
+	// the source positions of a row, padded to a multiple of 16
+	int n = ((i1 - i0 + 15)/16)*16;
+	vcl_vector<float> si(n), sj(n);
+	field_warp_row row;
+
+	for (int j=j0; j<j1; j++) {
+		row.set(lines, j);
+		warp_row(lines, row, j, i0, i1, &si[0], &sj[0]);
+		for (int i=i0; i<i1; i++)
+			destination(i,j) = sample(source, si[i - i0], sj[i - i0]);
+	}
+}
+
+// the dimensions of the tiles of the parallel warps: wide tiles
+// amortize the per-row terms of the lines, and an 8K frame still has
+// thousands of them
+static const int tile_ni = 128;
+static const int tile_nj = 64;
+
+// The arguments of a tile-parallel warp; source1 is 0 when a single
+// image is warped
+struct tile_job {
+	const vil_image_view<vil_rgb<vxl_byte> >* source0;
+	const field_warp_lines* lines0;
+	const vil_image_view<vil_rgb<vxl_byte> >* source1;
+	const field_warp_lines* lines1;
+	double t;
+	vil_image_view<vil_rgb<vxl_byte> >* warped0;
+	vil_image_view<vil_rgb<vxl_byte> >* warped1;
+	vil_image_view<vil_rgb<vxl_byte> >* morph;
+	// the grid of approximated warps, or 0; its statistics are
+	// updated under the mutex
+	field_warp_grid* grid;
+	thread_mutex mutex;
+	// the number of tiles in a row of tiles
+	int tiles_i;
+};
+
+static void warp_tiles(int begin, int end, void* arg)
+{
+	tile_job* job = (tile_job*) arg;
+	const double t = job->t;
+
+	for (int k=begin; k<end; k++) {
+		int i0 = (k % job->tiles_i)*tile_ni;
+		int j0 = (k / job->tiles_i)*tile_nj;
+		int i1 = vcl_min(i0 + tile_ni, (int) job->warped0->ni());
+		int j1 = vcl_min(j0 + tile_nj, (int) job->warped0->nj());
+
+		// the grid of the tile, with its own statistics (only the
+		// parameters of the shared grid are read without the mutex)
+		field_warp_grid grid = job->grid ? field_warp_grid(job->grid->spacing, job->grid->tolerance)
+		                                 : field_warp_grid();
+		field_warp_grid* tile_grid = job->grid ? &grid : 0;
+
+		field_warp_region(*job->source0, *job->lines0, i0, j0, i1, j1, *job->warped0, tile_grid);
+		if (job->source1 != 0)
+			field_warp_region(*job->source1, *job->lines1, i0, j0, i1, j1, *job->warped1, tile_grid);
+
+		if (job->grid != 0) {
+			thread_mutex_lock(&job->mutex);
+			job->grid->pixels += grid.pixels;
+			job->grid->points += grid.points;
+			job->grid->refined += grid.refined;
+			thread_mutex_unlock(&job->mutex);
+		}
+		if (job->source1 == 0)
+			continue;
+
+		for (int j=j0; j<j1; j++)
+			for (int i=i0; i<i1; i++) {
+				const vil_rgb<vxl_byte>& c0 = (*job->warped0)(i,j);
+				const vil_rgb<vxl_byte>& c1 = (*job->warped1)(i,j);
+				(*job->morph)(i,j) = vil_rgb<vxl_byte>(
+					(vxl_byte) ((1 - t)*c0.r + t*c1.r + 0.5),
+					(vxl_byte) ((1 - t)*c0.g + t*c1.g + 0.5),
+					(vxl_byte) ((1 - t)*c0.b + t*c1.b + 0.5));
+			}
+	}
+}
+
+// Run the tiles of a job with a work-stealing loop
+static void run_tiles(tile_job& job)
+{
+	int ni = job.warped0->ni(), nj = job.warped0->nj();
+
+	job.tiles_i = (ni + tile_ni - 1)/tile_ni;
+	thread_mutex_init(&job.mutex);
+	parallel_for_stealing(job.tiles_i*((nj + tile_nj - 1)/tile_nj), warp_tiles, &job);
+	thread_mutex_destroy(&job.mutex);
+}
+
+void field_warp_tiles(const vil_image_view<vil_rgb<vxl_byte> >& source,
+                      const field_warp_lines& lines,
+                      vil_image_view<vil_rgb<vxl_byte> >& destination,
+                      field_warp_grid* grid)
+{
+	tile_job job;
+
+	job.source0 = &source;
+	job.lines0 = &lines;
+	job.source1 = 0;
+	job.lines1 = 0;
+	job.t = 0;
+	job.warped0 = &destination;
+	job.warped1 = 0;
+	job.morph = 0;
+	job.grid = grid;
+	run_tiles(job);
+}
+
+void field_morph_tiles(const vil_image_view<vil_rgb<vxl_byte> >& source0,
+                       const field_warp_lines& lines0,
+                       const vil_image_view<vil_rgb<vxl_byte> >& source1,
+                       const field_warp_lines& lines1,
+                       double t,
+                       vil_image_view<vil_rgb<vxl_byte> >& warped0,
+                       vil_image_view<vil_rgb<vxl_byte> >& warped1,
+                       vil_image_view<vil_rgb<vxl_byte> >& morph,
+                       field_warp_grid* grid)
+{
+	tile_job job;
+
+	job.source0 = &source0;
+	job.lines0 = &lines0;
+	job.source1 = &source1;
+	job.lines1 = &lines1;
+	job.t = t;
+	job.warped0 = &warped0;
+	job.warped1 = &warped1;
+	job.morph = &morph;
+	job.grid = grid;
+	run_tiles(job);
+}
@@ -0,0 +1,127 @@
+#ifndef _field_warp_h
+#define _field_warp_h
+
+#include "../vxl_includes.h"
+
+#include <vcl_vector.h>
+
+#include "linepairs.h"
+
+//
+// The Beier-Neely field warping engine used by morphing::field_warp()
+//
+// Every pixel X of the destination image is mapped to the source
+// image by every line pair: with P'Q' the line in the destination and
+// PQ the corresponding line in the source,
+//
+//     u  = (X-P').(Q'-P') / |Q'-P'|^2
+//     v  = (X-P').Perp(Q'-P') / |Q'-P'|
+//     X' = P + u (Q-P) + v Perp(Q-P) / |Q-P|
+//
+// and the displacements X'-X are averaged with the weights
+//
+//     w  = (|Q'-P'|^p / (a + dist))^b
+//
+// where dist is the distance from X to the segment P'Q' and
+// Perp(i,j) = (-j,i); w is capped at 1e30, so that the displacements
+// of the pixels on a line stay finite when a = 0. The pixel is then
+// sampled bilinearly at X plus the average displacement (positions
+// outside the source are clamped to its border).
+//
+// The line pairs are extracted once per warp into float tables in
+// structure-of-arrays form, which hold everything about a line that
+// does not depend on X: the projections onto the line and onto its
+// perpendicular, the perpendicular of the source line and
+// |Q'-P'|^(pb). When the compiler targets AVX2, the displacements of
+// 16 consecutive pixels of a row are computed at a time by two
+// interleaved vectors of 8 floats, and (a + dist)^(-b) is evaluated
+// with polynomial approximations of log2 and exp2 (relative error
+// below 1e-5). The last group of a row is padded, so every pixel is
+// computed by the same instructions and the results do not depend
+// on how the image is divided into regions. The scalar code computes
+// the same formulas with vcl_pow
+//
+// Warps can also be approximated by interpolating the displacements
+// on an adaptive grid (see field_warp_grid), which evaluates the
+// lines at a small fraction of the pixels
+//
+
+// The line pairs of a warp, with index 0 the lines in the source
+// image and index 1 those in the destination
+struct field_warp_lines {
+	// the number of line pairs, without those with a zero-length line
+	int n;
+	// the a and b parameters of the weights
+	float a, b;
+	// the destination lines: P', |Q'-P'|, and the coefficients of the
+	// projections u = (X-P').ui and v = (X-P').vi
+	vcl_vector<float> pi, pj, len, ui_i, ui_j, vi_i, vi_j;
+	// the source lines: P, Q-P and Perp(Q-P)/|Q-P|
+	vcl_vector<float> spi, spj, sdi, sdj, sni, snj;
+	// |Q'-P'|^(pb)
+	vcl_vector<float> len_pb;
+
+	field_warp_lines(const linepairs& lps, double a, double b, double p);
+};
+
+// The parameters and statistics of approximated warps
+//
+// The displacements are evaluated exactly on a grid of the given
+// spacing and interpolated bilinearly inside its cells. A cell is
+// split in four when the exact displacement at its center is further
+// than the tolerance (in pixels) from the one interpolated from its
+// corners, and so on recursively down to cells of one pixel. Cells
+// crossed by a line are always split, since the displacements change
+// quickly close to the lines. The field is smooth elsewhere, so most
+// cells are not refined
+struct field_warp_grid {
+	// the spacing of the coarse grid (rounded down to a power of 2)
+	int spacing;
+	// the largest error allowed at the center of a cell
+	float tolerance;
+	// the statistics, accumulated by the warps: the number of pixels
+	// warped, the number of points where the displacements were
+	// evaluated exactly (each point evaluates every line) and the
+	// number of cells that were split
+	long pixels, points, refined;
+
+	field_warp_grid(int spacing = 8, float tolerance = 0.5f);
+};
+
+// Warp the pixels [i0,i1)x[j0,j1) of destination, which must have
+// the dimensions of source. With no line pairs, the pixels are
+// copied from source. When grid is not 0, the displacements are
+// approximated on its adaptive grid
+void field_warp_region(const vil_image_view<vil_rgb<vxl_byte> >& source,
+                       const field_warp_lines& lines,
+                       int i0, int j0, int i1, int j1,
+                       vil_image_view<vil_rgb<vxl_byte> >& destination,
+                       field_warp_grid* grid = 0);
+
+// Warp all of destination, dividing it into tiles that are warped in
+// parallel (see thread/parallel.h); the result is identical to that
+// of a single field_warp_region() call (only for exact warps: the
+// grids of approximated warps start at the corners of the tiles)
+void field_warp_tiles(const vil_image_view<vil_rgb<vxl_byte> >& source,
+                      const field_warp_lines& lines,
+                      vil_image_view<vil_rgb<vxl_byte> >& destination,
+                      field_warp_grid* grid = 0);
+
+// Warp source0 into warped0 with lines0 and source1 into warped1 with
+// lines1, and cross-dissolve the warped images into morph with the
+// weights 1-t and t. Each tile of the images is warped and dissolved
+// by one task of a work-stealing loop, since the tiles near dense
+// clusters of lines cost much more than the others; the result is
+// identical to that of the serial computation. All the images must
+// have the same dimensions
+void field_morph_tiles(const vil_image_view<vil_rgb<vxl_byte> >& source0,
+                       const field_warp_lines& lines0,
+                       const vil_image_view<vil_rgb<vxl_byte> >& source1,
+                       const field_warp_lines& lines1,
+                       double t,
+                       vil_image_view<vil_rgb<vxl_byte> >& warped0,
+                       vil_image_view<vil_rgb<vxl_byte> >& warped1,
+                       vil_image_view<vil_rgb<vxl_byte> >& morph,
+                       field_warp_grid* grid = 0);
+
+#endif
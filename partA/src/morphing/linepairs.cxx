@@ -57,22 +57,14 @@ bool linepairs::load(const char* fname)
 		} 
 		if (ok) {
 			// new line data is ok, so we copy it from the
-			// temporary space to our queue, after emptying the
-			// existing one
-			while (pairs_.size() != 0) {
-				linepair* lp;
-				lp = pairs_.front();
-				pairs_.pop();
-				delete lp;
-			}
-			while (new_linepairs.pairs_.size() != 0) {
-				linepair* lp;
-				lp = new_linepairs.pairs_.front();
-				add(lp->P_i[0], lp->P_j[0], lp->Q_i[0], lp->Q_j[0],
-				    lp->P_i[1], lp->P_j[1], lp->Q_i[1], lp->Q_j[1]);
-				new_linepairs.pairs_.pop();
-				delete lp;
-			}
+			// temporary space to our arrays, after emptying the
+			// existing ones
+			clear();
+			for (int l=0; l<new_linepairs.size(); l++)
+				add(new_linepairs.P_i_[0][l], new_linepairs.P_j_[0][l],
+				    new_linepairs.Q_i_[0][l], new_linepairs.Q_j_[0][l],
+				    new_linepairs.P_i_[1][l], new_linepairs.P_j_[1][l],
+				    new_linepairs.Q_i_[1][l], new_linepairs.Q_j_[1][l]);
 			ok = true;
 		} else 
 			ok = false;
@@ -80,27 +72,23 @@ bool linepairs::load(const char* fname)
 	return ok;
 }
 
-bool linepairs::save(const char* fname)
+bool linepairs::save(const char* fname) const
 {
 	vcl_ofstream outfile(fname);
-	char buf[80];
 	int n;
 
 	if (!outfile)
 		return false;
 
-	vnl_matrix<double> P, Q, P_prime, Q_prime;
-	get(P, Q, P_prime, Q_prime);
-
 	outfile << "% Line pairs for field morphing\n";
-	outfile << P.cols() << "\n";
-	for (n=0; n<P.cols(); n++) 
+	outfile << size() << "\n";
+	for (n=0; n<size(); n++) 
 		if (outfile.good())
 			outfile << "% Line " << n << "\n"
-				<< P(0,n) << " " << P(1,n) << " " 
-				<< Q(0,n) << " " << Q(1,n) << " " 
-				<< P_prime(0,n) << " " << P_prime(1,n) << " " 
-				<< Q_prime(0,n) << " " << Q_prime(1,n) << "\n";
+				<< P_i_[0][n] << " " << P_j_[0][n] << " " 
+				<< Q_i_[0][n] << " " << Q_j_[0][n] << " " 
+				<< P_i_[1][n] << " " << P_j_[1][n] << " " 
+				<< Q_i_[1][n] << " " << Q_j_[1][n] << "\n";
 		else
 			return false;
 	
@@ -109,31 +97,96 @@ bool linepairs::save(const char* fname)
 
 void linepairs::clear()
 {
-	while (pairs_.size() != 0)
-		pairs_.pop();
+	for (int k=0; k<2; k++) {
+		P_i_[k].clear();
+		P_j_[k].clear();
+		Q_i_[k].clear();
+		Q_j_[k].clear();
+	}
+	ids_.clear();
+	// max_id is kept, so the ids of the removed pairs are not reused;
+	// the hash table keeps its slots, so that refilling the set does
+	// not allocate memory
+	vcl_fill(index_.begin(), index_.end(), -1);
+}
+
+void linepairs::push(int id, double P_i, double P_j, double Q_i, double Q_j, 
+		             double Pp_i, double Pp_j, double Qp_i, double Qp_j)
+{
+	if (2*(size() + 1) > (int) index_.size())
+		rehash(vcl_max(8, 2*(int) index_.size()));
+	index_[slot(id)] = size();
+	ids_.push_back(id);
+
+	P_i_[0].push_back(P_i);
+	P_j_[0].push_back(P_j);
+	Q_i_[0].push_back(Q_i);
+	Q_j_[0].push_back(Q_j);
+	P_i_[1].push_back(Pp_i);
+	P_j_[1].push_back(Pp_j);
+	Q_i_[1].push_back(Qp_i);
+	Q_j_[1].push_back(Qp_j);
+}
+
+int linepairs::slot(int id) const
+{
+	// ids are mostly consecutive, so their low bits spread them over
+	// the table
+	int mask = (int) index_.size() - 1;
+	int s = id & mask;
+	while ((index_[s] >= 0) && (ids_[index_[s]] != id))
+		s = (s + 1) & mask;
+	return s;
+}
+
+void linepairs::erase_slot(int s)
+{
+	int mask = (int) index_.size() - 1;
+
+	for (;;) {
+		index_[s] = -1;
+		// find the next pair whose probe sequence went through s: one
+		// whose home slot h is not cyclically in (s,t]
+		int t = s;
+		for (;;) {
+			t = (t + 1) & mask;
+			if (index_[t] < 0)
+				return;
+			int h = ids_[index_[t]] & mask;
+			bool stays = (s <= t) ? ((s < h) && (h <= t)) : ((s < h) || (h <= t));
+			if (!stays)
+				break;
+		}
+		index_[s] = index_[t];
+		s = t;
+	}
+}
+
+void linepairs::rehash(int slots)
+{
+	index_.assign(slots, -1);
+	for (int l=0; l<size(); l++)
+		index_[slot(ids_[l])] = l;
+}
+
+int linepairs::position(int id) const
+{
+	if ((id < 0) || index_.empty())
+		return -1;
+	return index_[slot(id)];
 }
 
 int linepairs::add(double P_i, double P_j, double Q_i, double Q_j, 
 		            double Pp_i, double Pp_j, double Qp_i, double Qp_j)
 {
-	linepair* lp = new linepair;
-
 	// we only add non-degenerate lines (ie. lines that do not have identical endpoints)
 	if (((P_i == Q_i) && (P_j == Q_j)) || ((Pp_i == Qp_i) && (Pp_j == Qp_j)))
 		return -1;
 
-	lp->P_i[0] = P_i;
-	lp->P_j[0] = P_j;
-	lp->Q_i[0] = Q_i;
-	lp->Q_j[0] = Q_j;
-	lp->P_i[1] = Pp_i;
-	lp->P_j[1] = Pp_j;
-	lp->Q_i[1] = Qp_i;
-	lp->Q_j[1] = Qp_j;
-	lp->id = (max_id)++;
-	pairs_.push(lp);
-
-	return lp->id;
+	int id = (max_id)++;
+	push(id, P_i, P_j, Q_i, Q_j, Pp_i, Pp_j, Qp_i, Qp_j);
+
+	return id;
 }
 
 void linepairs::print(const linepair& p) {
@@ -142,64 +195,55 @@ void linepairs::print(const linepair& p) {
 }
 
 void linepairs::get(vnl_matrix<double>& P, vnl_matrix<double>& Q, 
-					vnl_matrix<double>& P_prime, vnl_matrix<double>& Q_prime)
+					vnl_matrix<double>& P_prime, vnl_matrix<double>& Q_prime) const
 {
-	linepair* lp;
-	int n = pairs_.size();
-
-	if (n > 0) {
-		P.set_size(2, pairs_.size());
-		Q.set_size(2, pairs_.size());
-		P_prime.set_size(2, pairs_.size());
-		Q_prime.set_size(2, pairs_.size());
+	int n = size();
+
+	P.set_size(2, n);
+	Q.set_size(2, n);
+	P_prime.set_size(2, n);
+	Q_prime.set_size(2, n);
 	
-		for (int i=0; i<n; i++) {
-			lp = pairs_.front();
-			pairs_.pop();
-			P(0,i) = lp->P_i[0];
-			P(1,i) = lp->P_j[0];
-			Q(0,i) = lp->Q_i[0];
-			Q(1,i) = lp->Q_j[0];
-			P_prime(0,i) = lp->P_i[1];
-			P_prime(1,i) = lp->P_j[1];
-			Q_prime(0,i) = lp->Q_i[1];
-			Q_prime(1,i) = lp->Q_j[1];
-			pairs_.push(lp);
-		}
-	} else {
-		P.set_size(2, 0);
-		Q.set_size(2, 0);
-		P_prime.set_size(2, 0);
-		Q_prime.set_size(2, 0);
+	for (int i=0; i<n; i++) {
+		P(0,i) = P_i_[0][i];
+		P(1,i) = P_j_[0][i];
+		Q(0,i) = Q_i_[0][i];
+		Q(1,i) = Q_j_[0][i];
+		P_prime(0,i) = P_i_[1][i];
+		P_prime(1,i) = P_j_[1][i];
+		Q_prime(0,i) = Q_i_[1][i];
+		Q_prime(1,i) = Q_j_[1][i];
 	}
 }
 
-bool linepairs::find_closest(int i, int j, int index, bool& isP, int& minid)
+bool linepairs::find_closest(int i, int j, int index, bool& isP, int& minid) const
 {
-	linepair *lp, *bestlp;
-	int n = pairs_.size();
-	bool found=false;
+	int n = size();
 	double dist, diP, djP, diQ, djQ, distP, distQ, mindist;
 
+	if ((index != 0) && (index != 1))
+		return false;
+
+	const double* Pi = P_i(index);
+	const double* Pj = P_j(index);
+	const double* Qi = Q_i(index);
+	const double* Qj = Q_j(index);
+
 	mindist = -1;
 	for (int l=0; l<n; l++) {
-		lp = pairs_.front();
-		pairs_.pop();
-		diP = lp->P_i[index]-i;
-		djP = lp->P_j[index]-j;
-		diQ = lp->Q_i[index]-i;
-		djQ = lp->Q_j[index]-j;
+		diP = Pi[l]-i;
+		djP = Pj[l]-j;
+		diQ = Qi[l]-i;
+		djQ = Qj[l]-j;
 		distP = diP*diP + djP*djP;
 		distQ = diQ*diQ + djQ*djQ;
 		dist = vcl_min(distP, distQ);
 		if ((mindist == -1) || ((mindist >=0) && 
 			(dist < mindist))) {
 			mindist = dist;
-			minid = lp->id;
+			minid = ids_[l];
 			isP = (mindist == distP);
-			bestlp = lp;
 		} 
-		pairs_.push(lp);
 	}
 			
 	return (mindist != -1);
@@ -210,110 +254,115 @@ bool linepairs::modify(int id, int index, bool isP, int ni, int nj)
 	if ((index != 0) && (index != 1))
 		return false;
 
-	linepair* lp;
-	bool found=false;
-	int n = pairs_.size();
+	int l = position(id);
+	if (l < 0)
+		return false;
 
-	for (int i=0; i<n; i++) {
-		lp = pairs_.front();
-		pairs_.pop();
-		if (lp->id == id) {
-			found = true;
-			if (isP) {
-				lp->P_i[index] = ni;
-				lp->P_j[index] = nj;
-			} else {
-				lp->Q_i[index] = ni;
-				lp->Q_j[index] = nj;
-			}
-		}
-		pairs_.push(lp);
+	if (isP) {
+		P_i_[index][l] = ni;
+		P_j_[index][l] = nj;
+	} else {
+		Q_i_[index][l] = ni;
+		Q_j_[index][l] = nj;
 	}
 		
-	return found;
+	return true;
 }
 
 
 bool linepairs::remove(int id)
 {
-	bool found=false;
-	int n = pairs_.size();
-
-	for (int i=0; i<n; i++) {
-		linepair* lp;
-
-		lp = pairs_.front();
-		pairs_.pop();
-		if (lp->id == id) {
-			found = true;
-			delete lp;
-		} else
-			pairs_.push(lp);
+	int l = position(id);
+	if (l < 0)
+		return false;
+	int s = slot(id);
+
+	// move the last line pair into the place of the removed one
+	int last = size() - 1;
+	index_[slot(ids_[last])] = l;
+	for (int k=0; k<2; k++) {
+		P_i_[k][l] = P_i_[k][last];
+		P_j_[k][l] = P_j_[k][last];
+		Q_i_[k][l] = Q_i_[k][last];
+		Q_j_[k][l] = Q_j_[k][last];
+		P_i_[k].pop_back();
+		P_j_[k].pop_back();
+		Q_i_[k].pop_back();
+		Q_j_[k].pop_back();
 	}
+	ids_[l] = ids_[last];
+	erase_slot(s);
+	ids_.pop_back();
 				
-	return found;
+	return true;
 }
 
-linepairs linepairs::interpolate(double t)
+linepairs linepairs::interpolate(double t) const
 {
 	linepairs interp;
-    double new_P_prime_i, new_P_prime_j, new_Q_prime_i, new_Q_prime_j;
-	int n = pairs_.size();
 
-	for (int i=0; i<n; i++) {
-		linepair* lp = pairs_.front();
-
-		pairs_.pop();
-		new_P_prime_i = lp->P_i[0]*(1-t) + lp->P_i[1]*t;
-		new_P_prime_j = lp->P_j[0]*(1-t) + lp->P_j[1]*t;
-		new_Q_prime_i = lp->Q_i[0]*(1-t) + lp->Q_i[1]*t;
-		new_Q_prime_j = lp->Q_j[0]*(1-t) + lp->Q_j[1]*t;
-		pairs_.push(lp);
-		interp.add(lp->P_i[0], lp->P_j[0], lp->Q_i[0], lp->Q_j[0], 
-			    new_P_prime_i, new_P_prime_j, 
-				new_Q_prime_i, new_Q_prime_j); 
-	}
+	interpolate(t, interp);
 
 	return interp;
 }
 
-linepairs linepairs::swap()
+void linepairs::interpolate(double t, linepairs& interp) const
 {
-	linepairs swapped;
-	linepair* lp;
     double new_P_prime_i, new_P_prime_j, new_Q_prime_i, new_Q_prime_j;
-	int n = pairs_.size();
+	int n = size();
 
+	interp.clear();
+	interp.max_id = max_id;
 	for (int i=0; i<n; i++) {
-		lp = pairs_.front();
-		pairs_.pop();
-		swapped.add(lp->P_i[1], lp->P_j[1], lp->Q_i[1], lp->Q_j[1], 
-			        lp->P_i[0], lp->P_j[0], lp->Q_i[0], lp->Q_j[0]);
-		pairs_.push(lp);
+		new_P_prime_i = P_i_[0][i]*(1-t) + P_i_[1][i]*t;
+		new_P_prime_j = P_j_[0][i]*(1-t) + P_j_[1][i]*t;
+		new_Q_prime_i = Q_i_[0][i]*(1-t) + Q_i_[1][i]*t;
+		new_Q_prime_j = Q_j_[0][i]*(1-t) + Q_j_[1][i]*t;
+		// like add(), skip the pairs whose interpolated line is degenerate
+		if ((new_P_prime_i == new_Q_prime_i) && (new_P_prime_j == new_Q_prime_j))
+			continue;
+		interp.push(ids_[i], P_i_[0][i], P_j_[0][i], Q_i_[0][i], Q_j_[0][i], 
+			        new_P_prime_i, new_P_prime_j, 
+			        new_Q_prime_i, new_Q_prime_j); 
 	}
+}
+
+linepairs linepairs::swap() const
+{
+	linepairs swapped;
+
+	swap(swapped);
 
 	return swapped;
 }
 
-linepairs linepairs::copy(int from, int to)
+void linepairs::swap(linepairs& swapped) const
+{
+	swapped.P_i_[0] = P_i_[1];
+	swapped.P_j_[0] = P_j_[1];
+	swapped.Q_i_[0] = Q_i_[1];
+	swapped.Q_j_[0] = Q_j_[1];
+	swapped.P_i_[1] = P_i_[0];
+	swapped.P_j_[1] = P_j_[0];
+	swapped.Q_i_[1] = Q_i_[0];
+	swapped.Q_j_[1] = Q_j_[0];
+	swapped.ids_ = ids_;
+	swapped.index_ = index_;
+	swapped.max_id = max_id;
+}
+
+linepairs linepairs::copy(int from, int to) const
 {
 	linepairs copied;
 
 	if ((from < 0) || (from > 1) || (to < 0) || (to > 1))
 		return copied;
 
-	linepair* lp;
-    double new_P_prime_i, new_P_prime_j, new_Q_prime_i, new_Q_prime_j;
-	int n = pairs_.size();
+	int n = size();
 
-	for (int i=0; i<n; i++) {
-		lp = pairs_.front();
-		pairs_.pop();
-		copied.add(lp->P_i[from], lp->P_j[from], lp->Q_i[from], lp->Q_j[from], 
-				   lp->P_i[from], lp->P_j[from], lp->Q_i[from], lp->Q_j[from]);
-		pairs_.push(lp);
-	}
+	for (int i=0; i<n; i++)
+		copied.add(P_i_[from][i], P_j_[from][i], Q_i_[from][i], Q_j_[from][i], 
+				   P_i_[from][i], P_j_[from][i], Q_i_[from][i], Q_j_[from][i]);
 
 	return copied;
 }
-
@@ -5,6 +5,8 @@
 
 #include "../vxl_includes.h"
 
+#include <vcl_vector.h>
+
 ///////////////////////////////////////////////////////
 // A class & methods for manipulating pairs of lines //
 ///////////////////////////////////////////////////////
@@ -37,14 +39,42 @@ typedef struct linepair_struct {
 // This class models the set of user-specified corresponding
 // line pairs in a pair of images (usually I0 and I1).
 // 
-// The class is implemented as a queue of pointers to 
-// linepair structures
+// The class is implemented as contiguous arrays holding each
+// coordinate of the line pairs (see the coordinate accessors below)
+// and a hash table mapping line pair ids to their position in the
+// arrays. The table is open-addressed with linear probing and kept
+// at most half full, so its size follows the number of line pairs
+// in the set rather than the largest id ever handed out (ids are
+// never reused). Removing a line pair moves the last line pair into
+// its place
 //
 class linepairs {
 	// the maximum id of lines in the line set; this is used
 	// for generating new unique line pair id's
 	int max_id;
-	vcl_queue<linepair *> pairs_;
+	// P_i_[k][l] is the i coordinate of the P endpoint of the l-th
+	// line pair in image Ik, and so on
+	vcl_vector<double> P_i_[2], P_j_[2], Q_i_[2], Q_j_[2];
+	// ids_[l] is the id of the l-th line pair
+	vcl_vector<int> ids_;
+	// the hash table: index_[s] is the position in the arrays of a
+	// line pair, or -1 if slot s is empty. A line pair id is stored
+	// in the first slot from id & (index_.size()-1) on that is not
+	// taken by another pair
+	vcl_vector<int> index_;
+
+	// append a line pair with the given id, without checking it
+	void push(int id, double P_i, double P_j, double Q_i, double Q_j,
+		      double Pp_i, double Pp_j, double Qp_i, double Qp_j);
+	// the slot of line pair id, or the empty slot where it would go
+	int slot(int id) const;
+	// empty slot s, moving up the pairs that probed past it
+	void erase_slot(int s);
+	// resize the hash table to the given power of 2 and reinsert
+	// the line pairs
+	void rehash(int slots);
+	// the position of line pair id, or -1 if it is not in the set
+	int position(int id) const;
 public:
 	linepairs();
 	// Add a pair of lines to the existing set and return the id 
@@ -67,7 +97,22 @@ public:
 	//  index: 0 if the coordinates refer to image I0 and 1 if they refer to I1
 	//  id:    the id of the line pair whose endpoint is closest to (i,j)
 	//  isP:   true if that endpoint is the P endpoint and if it is the Q endpoint
-	bool find_closest(int i, int j, int index, bool& isP, int& id);
+	bool find_closest(int i, int j, int index, bool& isP, int& id) const;
+
+	// the number of line pairs in the set
+	int size() const { return (int) ids_.size(); }
+	// the id of the l-th line pair, 0 <= l < size()
+	int id(int l) const { return ids_[l]; }
+
+	// direct access to the coordinates of the line pairs: P_i(k)[l]
+	// is the i coordinate of the P endpoint of the l-th line pair in
+	// image Ik (k is 0 or 1), and so on. The arrays hold size()
+	// values and remain valid until the set is modified; they are 0
+	// when the set is empty
+	const double* P_i(int k) const { return ids_.empty() ? 0 : &P_i_[k][0]; }
+	const double* P_j(int k) const { return ids_.empty() ? 0 : &P_j_[k][0]; }
+	const double* Q_i(int k) const { return ids_.empty() ? 0 : &Q_i_[k][0]; }
+	const double* Q_j(int k) const { return ids_.empty() ? 0 : &Q_j_[k][0]; }
 
 	//
 	// linepair interpolation routine
@@ -85,7 +130,14 @@ public:
 	//      Ai = (1-t)*Pi[0] + t*Pi[1], Aj = (1-t)*Pj[0] + t*Pj[1]
 	//      Bi = (1-t)*Qi[0] + t*Qi[1], Bj = (1-t)*Qj[0] + t*Qj[1]
 	//
-	linepairs interpolate(double t);
+	// The pairs keep their ids, and those whose line (Ai,Aj)->(Bi,Bj)
+	// is degenerate are left out
+	//
+	linepairs interpolate(double t) const;
+	// the same, storing the new set in result (which must not be this
+	// set). Once result has held as many line pairs, this does not
+	// allocate memory
+	void interpolate(double t, linepairs& result) const;
 
 	//
 	// linepair swapping routine
@@ -98,7 +150,10 @@ public:
 	//  { (Ai,Aj)->(Bi,Bj) , (Ci,Cj)->(Di,Dj) }
 	// the new set will contain the pair
 	//  { (Ci,Cj)->(Di,Dj) , (Ai,Aj)->(Bi,Bj) }
-	linepairs swap();
+	linepairs swap() const;
+	// the same, storing the new set in result (which must not be this
+	// set) and keeping the ids of the line pairs
+	void swap(linepairs& result) const;
 
 	// 
 	// routine that copies lines from I0 to I1 and vice versa
@@ -113,7 +168,7 @@ public:
     // 
 	// where the input parameter from is either 0 or 1
 	//
-	linepairs copy(int from, int to);
+	linepairs copy(int from, int to) const;
 
 	// dumping linepair data into a matrix
 	//
@@ -128,8 +183,11 @@ public:
 	//   Q0                                    Q                             I0
 	//   P1                                    P                             I1
 	//   Q1                                    Q                             I1
+	//
+	// (the coordinate accessors above give the same data without
+	// copying it)
 	void get(vnl_matrix<double>& P0, vnl_matrix<double>& Q0, 
-		     vnl_matrix<double>& P1, vnl_matrix<double>& Q1);
+		     vnl_matrix<double>& P1, vnl_matrix<double>& Q1) const;
 
 	// delete all line pairs, producing an empty line pair set
 	void clear();
@@ -149,7 +207,7 @@ public:
 	bool load(const char* fname);
 
 	// save linepair data into a file of the given name
-	bool save(const char* fname);
+	bool save(const char* fname) const;
 
 	// print the linepair data to stderr
 	static void print(const linepair& lp);
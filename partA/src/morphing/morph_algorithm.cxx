@@ -1,6 +1,9 @@
 // DO NOT MODIFY ANYWHERE EXCEPT WHERE EXPLICITLY NOTED!!
 
 #include "morphing.h"
+#include "field_warp.h"
+#include "../thread/parallel.h"
+#include "../thread/thread.h"
 
 // 
 // Top-level morphing routine
@@ -17,6 +20,11 @@ bool morphing::compute()
 	int iter;
 	bool ok = true;
 
+	// with several threads, the frames of a sequence are
+	// computed in parallel
+	if ((num_images_ > 1) && (parallel_threads() > 1))
+		return compute_sequence();
+
 	// if num_images > 1, we compute the t_ parameter
 	// automatically before executing the morph
 	if (num_images_ > 1) 
@@ -86,51 +94,7 @@ bool morphing::morph_iteration(int iter)
 	}
 
 	// write to disk
-	if (write_morph_ == true) {
-		//
-		// build the file name in the form <basefilename>.XXX.jpg
-		// where XXX is the zero-padded iteration number
-		//
-		char fname[256];
-		vcl_ostringstream mfname(fname);
-		mfname 
-			<< morph_basename_ << "." 
-			<< vcl_setfill('0') << vcl_setw(3) << iter 
-			<< ".jpg" << vcl_ends;
-		 
-		// to save, we need to access a (char *) representation
-		// of the output string stream
-		vcl_cerr << "writing Morph to file:" 
-			<< (mfname.str()).c_str() << "\n";
-		vil_save((vil_image_view<vxl_byte>)morph_, 
-			     (mfname.str()).c_str());
-	}
-	if (write_warped_ == true) {
-		char fname0[256];
-		char fname1[256];
-		vcl_ostringstream w0fname(fname0);
-		vcl_ostringstream w1fname(fname1);
-
-		w0fname 
-			<< morph_basename_ << "." 
-			<< "W0." 
-			<< vcl_setfill('0') << vcl_setw(3) << iter 
-			<< ".jpg" << vcl_ends;
-		w1fname 
-			<< morph_basename_ << "." 
-			<< "W1." 
-			<< vcl_setfill('0') << vcl_setw(3) << iter 
-			<< ".jpg" << vcl_ends;
-
-		vcl_cerr << "writing WarpedI0 to file " 
-			<< (w0fname.str()).c_str() << "\n";
-		vil_save((vil_image_view<vxl_byte>)warped_I0_, 
-			     (w0fname.str()).c_str());
-		vcl_cerr << "writing WarpedI1 to file " 
-			<< (w1fname.str()).c_str() << "\n";
-		vil_save((vil_image_view<vxl_byte>)warped_I1_, 
-			     (w1fname.str()).c_str());
-	}
+	write_iteration(iter, warped_I0_, warped_I1_, morph_);
 
 	return true;
 }
@@ -174,17 +138,11 @@ void morphing::compute_morph()
 	// PLACE YOUR CODE BETWEEN THESE LINES //
 	/////////////////////////////////////////
 
-	// dummy implementation
-
-	// just copy the input images to the result variables
-	vil_copy_deep(I0_, warped_I0_);
-	vil_copy_deep(I1_, warped_I1_);
-	vil_copy_deep(I1_, morph_);
+	field_warp_grid grid;
 
-	// create a linepair where bot the original and
-	// the warped lines are identical and equal to the
-	// user-specified lines in image I0
-	I0W0_linepairs_ = I0I1_linepairs_.copy(0, 1);
+	render_morph(t_, I0W0_linepairs_, I1I0_linepairs_, I1W1_linepairs_,
+	             warped_I0_, warped_I1_, morph_, grid);
+	print_warp_stats(t_, grid);
 
 	////////////////////////////////////////
 }
@@ -215,6 +173,12 @@ void morphing::field_warp(
 	// PLACE YOUR CODE BETWEEN THESE LINES //
 	/////////////////////////////////////////
 
+	// the line pairs are converted once to the tables of the warping
+	// engine (see field_warp.h)
+	field_warp_lines lines(lps, a, b, p);
+
+	field_warp_tiles(source, lines, destination);
+
 	////////////////////////////////////////
 }
 
@@ -223,5 +187,246 @@ void morphing::field_warp(
 // BETWEEN THESE LINES                //
 ////////////////////////////////////////
 
+void morphing::render_morph(double t,
+                            linepairs& I0W0_linepairs,
+                            linepairs& I1I0_linepairs,
+                            linepairs& I1W1_linepairs,
+                            vil_image_view<vil_rgb<vxl_byte> >& warped_I0,
+                            vil_image_view<vil_rgb<vxl_byte> >& warped_I1,
+                            vil_image_view<vil_rgb<vxl_byte> >& morph,
+                            field_warp_grid& grid) const
+{
+	// the lines of the in-between image are interpolated between
+	// the lines of I0 and those of I1; I1 is warped with the pairs
+	// swapped, so that its lines come first
+	I0I1_linepairs_.interpolate(t, I0W0_linepairs);
+	I0I1_linepairs_.swap(I1I0_linepairs);
+	I1I0_linepairs.interpolate(1 - t, I1W1_linepairs);
+
+	// the tiles of the images are warped and dissolved in parallel
+	// (see field_warp.h)
+	field_warp_lines I0_lines(I0W0_linepairs, a_, b_, p_);
+	field_warp_lines I1_lines(I1W1_linepairs, a_, b_, p_);
+
+	if (warp_tolerance_ > 0) {
+		// approximated warps (see field_warp_grid)
+		grid = field_warp_grid(warp_spacing_, (float) warp_tolerance_);
+		field_morph_tiles(I0_, I0_lines, I1_, I1_lines, t, warped_I0, warped_I1, morph, &grid);
+	} else
+		field_morph_tiles(I0_, I0_lines, I1_, I1_lines, t, warped_I0, warped_I1, morph);
+}
+
+void morphing::print_warp_stats(double t, const field_warp_grid& grid) const
+{
+	if (warp_tolerance_ > 0)
+		vcl_cerr << "Approximated the warps for t=" << t << ": lines evaluated at "
+		         << grid.points << " of " << grid.pixels << " pixels, "
+		         << grid.refined << " cells refined\n";
+}
+
+void morphing::write_iteration(int iter,
+                               const vil_image_view<vil_rgb<vxl_byte> >& warped_I0,
+                               const vil_image_view<vil_rgb<vxl_byte> >& warped_I1,
+                               const vil_image_view<vil_rgb<vxl_byte> >& morph) const
+{
+	if (write_morph_ == true) {
+		//
+		// build the file name in the form <basefilename>.XXX.jpg
+		// where XXX is the zero-padded iteration number
+		//
+		char fname[256];
+		vcl_ostringstream mfname(fname);
+		mfname 
+			<< morph_basename_ << "." 
+			<< vcl_setfill('0') << vcl_setw(3) << iter 
+			<< ".jpg" << vcl_ends;
+		 
+		// to save, we need to access a (char *) representation
+		// of the output string stream
+		vcl_cerr << "writing Morph to file:" 
+			<< (mfname.str()).c_str() << "\n";
+		vil_save((vil_image_view<vxl_byte>)morph, 
+			     (mfname.str()).c_str());
+	}
+	if (write_warped_ == true) {
+		char fname0[256];
+		char fname1[256];
+		vcl_ostringstream w0fname(fname0);
+		vcl_ostringstream w1fname(fname1);
+
+		w0fname 
+			<< morph_basename_ << "." 
+			<< "W0." 
+			<< vcl_setfill('0') << vcl_setw(3) << iter 
+			<< ".jpg" << vcl_ends;
+		w1fname 
+			<< morph_basename_ << "." 
+			<< "W1." 
+			<< vcl_setfill('0') << vcl_setw(3) << iter 
+			<< ".jpg" << vcl_ends;
+
+		vcl_cerr << "writing WarpedI0 to file " 
+			<< (w0fname.str()).c_str() << "\n";
+		vil_save((vil_image_view<vxl_byte>)warped_I0, 
+			     (w0fname.str()).c_str());
+		vcl_cerr << "writing WarpedI1 to file " 
+			<< (w1fname.str()).c_str() << "\n";
+		vil_save((vil_image_view<vxl_byte>)warped_I1, 
+			     (w1fname.str()).c_str());
+	}
+}
+
+//
+// Parallel computation of a morph sequence
+//
+// Each thread of a parallel loop takes the next frame of the
+// sequence and computes it into its own morph_frame, with its share
+// of the thread budget for the tiles of the frame (see
+// field_morph_tiles()). A separate thread writes the frames to disk
+// in order as they are completed. The frames are kept in a ring of
+// slots, and a frame is only started when its slot has been written,
+// so at most that many frames wait to be written out of order
+//
+
+struct morphing::sequence_state {
+	morphing* M;
+	// the number of frames
+	int n;
+	// the frames being computed or waiting to be written; frame k is
+	// kept in slot k % slots.size()
+	vcl_vector<morph_frame> slots;
+	vcl_vector<bool> rendered;
+	// the next frame to compute and the next frame to write
+	int next;
+	int written;
+
+	thread_mutex mutex;
+	// signalled when a frame is computed and when a slot is written
+	thread_cond frame_rendered;
+	thread_cond slot_free;
+};
+
+void morphing::render_frames(void* arg)
+{
+	sequence_state* s = (sequence_state*) arg;
+
+	for (;;) {
+		thread_mutex_lock(&s->mutex);
+		while ((s->next < s->n) && (s->next >= s->written + (int) s->slots.size()))
+			thread_cond_wait(&s->slot_free, &s->mutex);
+		if (s->next >= s->n) {
+			thread_mutex_unlock(&s->mutex);
+			return;
+		}
+		int k = s->next++;
+		morph_frame& f = s->slots[k % s->slots.size()];
+		f.t = (k+1)*1.0/(s->n+1);
+		vcl_cerr << "Computing morph for t=" << f.t << "\n";
+		thread_mutex_unlock(&s->mutex);
+
+		s->M->render_morph(f.t, f.I0W0_linepairs, f.I1I0_linepairs, f.I1W1_linepairs,
+		                   f.warped_I0, f.warped_I1, f.morph, f.grid);
+
+		thread_mutex_lock(&s->mutex);
+		s->rendered[k % s->slots.size()] = true;
+		thread_cond_broadcast(&s->frame_rendered);
+		thread_mutex_unlock(&s->mutex);
+	}
+}
+
+void* morphing::write_frames(void* arg)
+{
+	sequence_state* s = (sequence_state*) arg;
+
+	for (int k=0; k<s->n; k++) {
+		int slot = k % s->slots.size();
+
+		const morph_frame& f = s->slots[slot];
+
+		// the messages of the threads are printed under the lock
+		thread_mutex_lock(&s->mutex);
+		while (!s->rendered[slot])
+			thread_cond_wait(&s->frame_rendered, &s->mutex);
+		s->M->print_warp_stats(f.t, f.grid);
+		thread_mutex_unlock(&s->mutex);
+
+		s->M->write_iteration(k, f.warped_I0, f.warped_I1, f.morph);
+
+		thread_mutex_lock(&s->mutex);
+		s->rendered[slot] = false;
+		s->written = k + 1;
+		thread_cond_broadcast(&s->slot_free);
+		thread_mutex_unlock(&s->mutex);
+	}
+
+	return 0;
+}
+
+// Allocate the slots of the frames of a sequence
+void morphing::allocate_frames(sequence_state& s, int nslots) const
+{
+	s.slots.resize(nslots);
+	s.rendered.resize(nslots, false);
+	for (int k=0; k<nslots; k++) {
+		s.slots[k].warped_I0.set_size(I0_.ni(), I0_.nj());
+		s.slots[k].warped_I1.set_size(I0_.ni(), I0_.nj());
+		s.slots[k].morph.set_size(I0_.ni(), I0_.nj());
+	}
+}
+
+bool morphing::compute_sequence()
+{
+	if (((bool) I0_ == false) || 
+		((bool) I1_ == false))
+		return false;
+
+	sequence_state s;
+	thread_id writer;
+	int workers = vcl_min(parallel_threads(), num_images_);
+
+	s.M = this;
+	s.n = num_images_;
+	s.next = 0;
+	s.written = 0;
+	thread_mutex_init(&s.mutex);
+	thread_cond_init(&s.frame_rendered);
+	thread_cond_init(&s.slot_free);
+
+	// every worker can have a frame waiting to be written while it
+	// computes the next one
+	allocate_frames(s, vcl_min(2*workers, s.n));
+	bool started = thread_create(&writer, write_frames, &s);
+	if (!started)
+		// without a writing thread, the frames are written once they
+		// have all been computed
+		allocate_frames(s, s.n);
+
+	// each worker has its share of the thread budget for the tiles of
+	// its frames
+	parallel_run(workers, render_frames, &s);
+
+	if (started)
+		thread_join(writer);
+	else
+		write_frames(&s);
+	thread_cond_destroy(&s.slot_free);
+	thread_cond_destroy(&s.frame_rendered);
+	thread_mutex_destroy(&s.mutex);
+
+	// the last frame is kept, as after a serial computation
+	morph_frame& last = s.slots[(s.n-1) % s.slots.size()];
+	set_t(last.t);
+	I0W0_linepairs_ = last.I0W0_linepairs;
+	I1I0_linepairs_ = last.I1I0_linepairs;
+	I1W1_linepairs_ = last.I1W1_linepairs;
+	warped_I0_ = last.warped_I0;
+	warped_I1_ = last.warped_I1;
+	morph_ = last.morph;
+	morph_computed_ = true;
+	outdated_ = false;
+
+	return true;
+}
+
 ////////////////////////////////////////
 
@@ -74,6 +74,9 @@ void morphing::default_params()
 	t_ = get_t_default();
 	// by default, compute a single morph
 	num_images_ = get_num_images_default();
+	// by default, the warps are exact
+	warp_tolerance_ = 0;
+	warp_spacing_ = 8;
 }
 
 //
@@ -178,6 +181,14 @@ void morphing::set_num_images(int n)
 		num_images_ = n;
 }
 
+void morphing::set_warp_tolerance(double tolerance, int spacing)
+{
+	if ((warp_tolerance_ != tolerance) || (warp_spacing_ != spacing))
+		outdated_ = true;
+	warp_tolerance_ = vcl_max(tolerance, 0.0);
+	warp_spacing_ = vcl_max(spacing, 1);
+}
+
 void morphing::set_t(double t)
 {
 	if (t_ != t)
@@ -9,6 +9,7 @@
 #include "../imdraw/imdraw.h"
 
 #include "linepairs.h"
+#include "field_warp.h"
 
 // the main morphing class
 class morphing {
@@ -51,6 +52,11 @@ private:
 	// the data structures holding the set of computed corresponding
 	// line pairs between image I0_ and warped_I0_
 	linepairs I0W0_linepairs_;
+	// the line pairs of I0_ and I1_ swapped, and those between I1_
+	// and warped_I1_; they are kept between calls so that computing a
+	// morph does not allocate memory for them
+	linepairs I1I0_linepairs_;
+	linepairs I1W1_linepairs_;
 
 	// the algorithm's t interpolation parameter (controls the
 	// interpolation between the line pairs and the cross dissolve)
@@ -66,6 +72,11 @@ private:
 	double a_;
 	double b_;
 	double p_;
+	// the tolerance (in pixels) and the grid spacing of approximated
+	// warps (see field_warp_grid in field_warp.h); the warps are exact
+	// when the tolerance is 0
+	double warp_tolerance_;
+	int warp_spacing_;
 
 	//
 	//  Private methods
@@ -149,6 +160,52 @@ private:
 	// PLACE YOUR CODE BETWEEN THESE LINES          //
 	//////////////////////////////////////////////////
 
+	// Compute the morph at parameter t from I0_, I1_ and the line
+	// pairs between them, using the given line pair sets and images
+	// (allocated by the caller) for the results and intermediate data;
+	// compute_morph() calls it with the members of the class. The
+	// statistics of approximated warps are stored in grid, and are
+	// left to the caller to print (see print_warp_stats())
+	void render_morph(double t,
+	                  linepairs& I0W0_linepairs,
+	                  linepairs& I1I0_linepairs,
+	                  linepairs& I1W1_linepairs,
+	                  vil_image_view<vil_rgb<vxl_byte> >& warped_I0,
+	                  vil_image_view<vil_rgb<vxl_byte> >& warped_I1,
+	                  vil_image_view<vil_rgb<vxl_byte> >& morph,
+	                  field_warp_grid& grid) const;
+	// Print the statistics of the warps of the morph at parameter t
+	// to stderr, if the warps are approximated
+	void print_warp_stats(double t, const field_warp_grid& grid) const;
+
+	// Write the images of iteration iter to disk, as selected by
+	// write_morph_ and write_warped_
+	void write_iteration(int iter,
+	                     const vil_image_view<vil_rgb<vxl_byte> >& warped_I0,
+	                     const vil_image_view<vil_rgb<vxl_byte> >& warped_I1,
+	                     const vil_image_view<vil_rgb<vxl_byte> >& morph) const;
+
+	// The images and line pairs of one frame of a morph sequence, so
+	// that several frames can be computed at the same time
+	struct morph_frame {
+		double t;
+		linepairs I0W0_linepairs, I1I0_linepairs, I1W1_linepairs;
+		vil_image_view<vil_rgb<vxl_byte> > warped_I0, warped_I1, morph;
+		// the statistics of the warps, printed when the frame is
+		// written so that they come out in order
+		field_warp_grid grid;
+	};
+	// the state shared by the threads computing a sequence
+	struct sequence_state;
+
+	// Compute the num_images_ frames of a sequence in parallel (see
+	// compute()), leaving the last one in the members of the class
+	bool compute_sequence();
+	void allocate_frames(sequence_state& s, int nslots) const;
+	// the bodies of the threads computing and writing the frames
+	static void render_frames(void* arg);
+	static void* write_frames(void* arg);
+
 	//////////////////////////////////////////////////
 
 public:
@@ -181,6 +238,10 @@ public:
 	void set_t(double t);
 	void set_num_images(int n);
 	void set_morph_basename(vcl_string& str);
+	// approximate the warps on an adaptive grid of the given spacing,
+	// splitting its cells until the displacements are within the
+	// tolerance (in pixels); a tolerance of 0 makes the warps exact
+	void set_warp_tolerance(double tolerance, int spacing);
 
 	// write warped images I0 and I1 to disk
 	void write_warped();
@@ -6,7 +6,249 @@
 // DO NOT MODIFY ANYTHING ABOVE THIS LINE
 ////////////////////////////////////////////////////////////////
 
+#include <core/vil/vil_plane.h>
+#include <vcl_vector.h>
+#include <vcl_cstring.h>
 
+#include "blend_video.h"
+#include "../thread/parallel.h"
+
+// the images holding the Laplacian levels of a pyramid
+typedef vil_image_view<pyramid::laplacian_type> laplacian_image;
+
+// The number of rows of the bands in which each level is blended
+static const int blend_band_rows = 128;
+
+// Return a view of rows j0,...,j0+nj-1 of an image. Unlike vil_crop(),
+// the view does not share the memory chunk of the image, so the
+// threads of blend() can create such views of the same image without
+// updating the reference count of the chunk concurrently
+template <class T>
+static vil_image_view<T> row_view(const vil_image_view<T>& im, int j0, int nj)
+{
+	return vil_image_view<T>(im.top_left_ptr() + j0*im.jstep(), im.ni(), nj,
+	                         im.nplanes(), im.istep(), im.jstep(), im.planestep());
+}
+
+// Return a view of region r of an image, which (like row_view()) 
+// does not share the memory chunk of the image
+template <class T>
+static vil_image_view<T> window_view(const vil_image_view<T>& im, const blend_region& r)
+{
+	return vil_image_view<T>(im.top_left_ptr() + r.i0*im.istep() + r.j0*im.jstep(), 
+	                         r.i1-r.i0, r.j1-r.j0, im.nplanes(), 
+	                         im.istep(), im.jstep(), im.planestep());
+}
+
+// The arguments of the routine that builds the Gauss pyramids of
+// the two sources and of the mask in parallel
+struct blend_gauss_job {
+	const double* w_hat;
+	int N;
+	// levels 0,...,N of the three pyramids; level 0 is the image
+	vcl_vector<vil_image_view<vxl_byte> >* g[3];
+};
+
+static void blend_gauss(int begin, int end, void* arg)
+{
+	blend_gauss_job* job = (blend_gauss_job*) arg;
+
+	for (int k=begin; k<end; k++) {
+		vcl_vector<vil_image_view<vxl_byte> >& g = *job->g[k];
+		for (int l=1; l<=job->N; l++)
+			pyramid::reduce_level(g[l-1], job->w_hat, g[l]);
+	}
+}
+
+// The arguments of the routine that blends the bands of a level
+struct blend_band_job {
+	const double* w_hat;
+	// level l of the Laplacian pyramids of the two sources, or 0 if
+	// these levels must be computed from the Gauss levels below
+	const laplacian_image* LA;
+	const laplacian_image* LB;
+	// levels l and l+1 of the Gauss pyramids of the two sources
+	// (only used when LA and LB are 0)
+	const vil_image_view<vxl_byte>* gA;
+	const vil_image_view<vxl_byte>* gB;
+	const vil_image_view<vxl_byte>* gA_up;
+	const vil_image_view<vxl_byte>* gB_up;
+	// level l of the Gauss pyramid of the mask
+	const vil_image_view<vxl_byte>* gR;
+	// levels l+1 and l of the Gauss pyramid of the result
+	const vil_image_view<vxl_byte>* gS_up;
+	vil_image_view<vxl_byte>* gS;
+	// the band that band 0 of blend_bands() stands for
+	int band0;
+};
+
+// Combine n pixels of the Laplacian rows a and b using the weights w
+// (a weight of 0 selects a and a weight of 255 selects b), storing
+// (255-w)*a + w*b divided by 255 and rounded to the nearest integer
+// in s. Adding bias*255 to the dividend makes it positive, so that the
+// division rounds in the same direction for negative values; this is
+// exact as long as the Laplacian values are in [-bias,bias]
+static void blend_row(const pyramid::laplacian_type* a, 
+                      const pyramid::laplacian_type* b,
+                      const vxl_byte* w, vcl_ptrdiff_t wstep,
+                      pyramid::laplacian_type* s, int n)
+{
+	const int bias = 1024;
+	int i;
+
+	// separate loops for contiguous weights, which the compiler can
+	// vectorize
+	if (wstep == 1)
+		for (i=0; i<n; i++)
+			s[i] = ((255-w[i])*a[i] + w[i]*b[i] + 127 + 255*bias)/255 - bias;
+	else
+		for (i=0; i<n; i++) {
+			int wi = w[i*wstep];
+			s[i] = ((255-wi)*a[i] + wi*b[i] + 127 + 255*bias)/255 - bias;
+		}
+}
+
+// Blend bands b0,...,b1-1 of a level. For each band, the Laplacian
+// levels of the two sources are computed (unless they are given), 
+// combined using the Gauss level of the mask as weights (a mask value
+// of 0 selects source0 and a value of 255 selects source1), and added
+// to the expanded level above of the result
+static void blend_bands(int b0, int b1, void* arg)
+{
+	blend_band_job* job = (blend_band_job*) arg;
+	const vil_image_view<vxl_byte>& gR = *job->gR;
+	int ni = job->gS->ni(), nj = job->gS->nj(), np = job->gS->nplanes();
+	int nj_up = job->gS_up->nj();
+	laplacian_image LA, LB, LS, bufA, bufB;
+	vil_image_view<vxl_byte> g, band;
+
+	for (int b=job->band0+b0; b<job->band0+b1; b++) {
+		int j0 = b*blend_band_rows, j1 = vcl_min(nj, j0+blend_band_rows);
+
+		// the rows of the level above under the kernel of the band;
+		// they expand to the rows of level l starting at 2*y0, and 
+		// the expanded rows have an odd count only if they reach the
+		// last row of an odd-sized level
+		int y0 = vcl_max(0, j0/2-1), y1 = vcl_min(nj_up, j1/2+2);
+		int ej = (y1 == nj_up) ? nj-2*y0 : 2*(y1-y0);
+
+		if (job->LA) {
+			LA = row_view(*job->LA, 2*y0, ej);
+			LB = row_view(*job->LB, 2*y0, ej);
+		} else {
+			bufA.set_size(ni, ej, np);
+			bufB.set_size(ni, ej, np);
+			pyramid::laplacian(row_view(*job->gA, 2*y0, ej), 
+			                   row_view(*job->gA_up, y0, y1-y0), job->w_hat, bufA);
+			pyramid::laplacian(row_view(*job->gB, 2*y0, ej), 
+			                   row_view(*job->gB_up, y0, y1-y0), job->w_hat, bufB);
+			LA = bufA;
+			LB = bufB;
+		}
+
+		// only the rows of the band are combined and kept, since the
+		// rows near the edges of the window lack some of their 
+		// neighbours; all the Laplacian rows are contiguous
+		LS.set_size(ni, ej, np);
+		for (int p=0; p<np; p++)
+			for (int j=j0; j<j1; j++)
+				blend_row(&LA(0,j-2*y0,p), &LB(0,j-2*y0,p), &gR(0,j), gR.istep(),
+				          &LS(0,j-2*y0,p), ni);
+
+		pyramid::collapse(row_view(*job->gS_up, y0, y1-y0), LS, job->w_hat, g);
+		band = row_view(*job->gS, j0, j1-j0);
+		vil_copy_reformat(row_view(g, j0-2*y0, j1-j0), band);
+	}
+}
+
+// Compute the top level gS of the blended pyramid from the top Gauss 
+// levels of the two sources and of the mask
+static void blend_top(const vil_image_view<vxl_byte>& gA, 
+                      const vil_image_view<vxl_byte>& gB,
+                      const vil_image_view<vxl_byte>& gR,
+                      vil_image_view<vxl_byte>& gS)
+{
+	gS.set_size(gA.ni(), gA.nj(), gA.nplanes());
+	for (int p=0; p<(int) gA.nplanes(); p++)
+		for (int j=0; j<(int) gA.nj(); j++)
+			for (int i=0; i<(int) gA.ni(); i++) {
+				int w = gR(i,j);
+				gS(i,j,p) = ((255-w)*gA(i,j,p) + w*gB(i,j,p) + 127)/255;
+			}
+}
+
+// The number of bands of blend_band_rows rows of a level
+static int blend_band_count(const vil_image_view<vxl_byte>& g)
+{
+	return (g.nj() + blend_band_rows - 1)/blend_band_rows;
+}
+
+// Blend level l of a pyramid into gS, from the level above gS_up of
+// the result. The levels of the sources are either the Laplacian 
+// levels LA[l] and LB[l] or, if these are 0, computed from the Gauss
+// levels gA and gB; gS must have the dimensions of gR[l]. Only bands
+// b0,...,b1-1 of the level are blended, or all of them if b1 is -1
+static void blend_level(int l, const double* w_hat,
+                        const laplacian_image* LA, const laplacian_image* LB,
+                        const vil_image_view<vxl_byte>* gA, 
+                        const vil_image_view<vxl_byte>* gB,
+                        const vil_image_view<vxl_byte>* gR,
+                        const vil_image_view<vxl_byte>& gS_up,
+                        vil_image_view<vxl_byte>& gS,
+                        int b0 = 0, int b1 = -1)
+{
+	if (b1 < 0)
+		b1 = blend_band_count(gS);
+	blend_band_job job = {w_hat, 
+	                      LA ? &LA[l] : 0, LB ? &LB[l] : 0,
+	                      gA ? &gA[l] : 0, gB ? &gB[l] : 0,
+	                      gA ? &gA[l+1] : 0, gB ? &gB[l+1] : 0,
+	                      &gR[l], &gS_up, &gS, b0};
+	parallel_for(b1 - b0, blend_bands, &job);
+}
+
+// Blend levels N-1,...,0 of a pyramid whose top level gS has already
+// been blended, reconstructing each level of the result from the one
+// above it and writing level 0 to result. The levels of the sources
+// are computed from the Gauss levels gA and gB (see blend_level()).
+// The Gauss levels above the current level are released as soon as
+// they have been used
+static void blend_collapse(int N, const double* w_hat,
+                           vil_image_view<vxl_byte>* gA, vil_image_view<vxl_byte>* gB,
+                           vil_image_view<vxl_byte>* gR,
+                           vil_image_view<vxl_byte> gS,
+                           vil_image_view<vxl_byte>& result)
+{
+	vil_image_view<vxl_byte> gS_up;
+	int np = gS.nplanes();
+
+	for (int l=N-1; l>=0; l--) {
+		gS_up = gS;
+		if (l == 0) {
+			result.set_size(gR[0].ni(), gR[0].nj(), np);
+			gS = result;
+		} else
+			gS = vil_image_view<vxl_byte>(gR[l].ni(), gR[l].nj(), np);
+
+		blend_level(l, w_hat, 0, 0, gA, gB, gR, gS_up, gS);
+
+		// the levels above are no longer needed
+		gR[l+1] = gS_up = vil_image_view<vxl_byte>();
+		gA[l+1] = gB[l+1] = vil_image_view<vxl_byte>();
+	}
+
+	if (N == 0)
+		result = gS;
+}
+
+
+// The levels of the blended pyramid are computed from the coarsest
+// down and folded into the collapse as soon as they are available,
+// so the Laplacian pyramids are never stored: each band of a level
+// computes its own part of the Laplacian levels of the sources. Apart
+// from the input images and the result, the routine only keeps the
+// Gauss levels 1,...,N of the sources and of the mask (a third of the
+// size of the images) and one level of the blended pyramid
 bool blend(
 		const vil_image_view<vxl_byte>& source0, 
 		const vil_image_view<vxl_byte>& source1,
@@ -20,30 +262,833 @@ bool blend(
 		(source0.ni() != mask.ni()) ||
 		(source0.nj() != mask.nj()))
 		return false;
-		
-	// Build Pyramids
-    pyramid* PA = new pyramid(source0);
-    pyramid* PB = new pyramid(source1);
-    pyramid* PR = new pyramid(mask);
-       
-    // Build Laplacian Pyramids
-    vil_image_view<int>* LA = PA->L();
-    vil_image_view<int>* LB = PB->L();
-    // Build Gaussian Pyramid
-    vil_image_view<vxl_byte>* GR = PR->g();
-    
-    // Define result size
-	result.set_size(source0.ni(), source0.nj(), source0.nplanes());
-	// For each pixel in each plane
-	for (int p=0; p<source0.nplanes(); p++) {
-		for (int i=0; i<source0.ni(); i++) {
-			for (int j=0; j<source0.nj(); j++) {
-				// combine LA and LB using GR as weights
-				result(i,j,p) = (*GR)(i, j, p)*(*LA)(i,j,p) + (1-(*GR)(i, j, p))*(*LB)(i, j, p);
+
+	int nj = source0.nj();
+	int N = pyramid::levels(source0.ni(), nj);
+
+	// the kernel of a pyramid built with the default a parameter
+	double w_hat_data[5];
+	double* w_hat = w_hat_data + 2;
+	pyramid::kernel(0.4, w_hat);
+
+	// Build the Gauss pyramids of the two sources and of the mask in
+	// parallel; the weights only use the first plane of the mask
+	vcl_vector<vil_image_view<vxl_byte> > gA(N+1), gB(N+1), gR(N+1);
+	gA[0] = row_view(source0, 0, nj);
+	gB[0] = row_view(source1, 0, nj);
+	gR[0] = row_view(vil_plane(mask, 0), 0, nj);
+	blend_gauss_job gauss = {w_hat, N, {&gA, &gB, &gR}};
+	parallel_for(3, blend_gauss, &gauss);
+
+	// Combine the top levels of the two Gauss pyramids, and then 
+	// the other levels from the coarsest down
+	vil_image_view<vxl_byte> gS;
+	blend_top(gA[N], gB[N], gR[N], gS);
+	blend_collapse(N, w_hat, &gA[0], &gB[0], &gR[0], gS, result);
+
+	return true;
+}
+
+// Compute level l of the result of blend_levels() from level l+1, or
+// only bands b0,...,b1-1 of the level if b1 is not -1. The level is
+// allocated when its first band is computed
+static void blend_next_level(int l, double a,
+                             const laplacian_image* LA, const laplacian_image* LB,
+                             const vcl_vector<vil_image_view<vxl_byte> >& gR,
+                             vcl_vector<vil_image_view<vxl_byte> >& gS,
+                             int b0 = 0, int b1 = -1)
+{
+	double w_hat_data[5];
+	double* w_hat = w_hat_data + 2;
+	pyramid::kernel(a, w_hat);
+
+	if (b0 == 0)
+		gS[l] = vil_image_view<vxl_byte>(gR[l].ni(), gR[l].nj(), gS[l+1].nplanes());
+	blend_level(l, w_hat, LA, LB, 0, 0, &gR[0], gS[l+1], gS[l], b0, b1);
+}
+
+// Blend with the pyramids of the two sources already built, so that
+// only the Gauss pyramid of the mask has to be computed (see 
+// blending::compute()). LA and LB are the N Laplacian levels of the 
+// pyramids and gA_N and gB_N their top Gauss levels; the pyramids 
+// must have been built with parameter a from images of the 
+// dimensions of the mask. The N+1 levels of the Gauss pyramids of 
+// the mask and of the result are stored in gR and gS, so that the
+// result can be updated by reblend_region() when the mask changes;
+// gS[0] is the blended image. The result is only collapsed down to
+// level l0: levels 0,...,l0-1 are left empty, to be computed by
+// blend_next_level()
+static bool blend_levels(int N, double a,
+                         const laplacian_image* LA, const laplacian_image* LB,
+                         const vil_image_view<vxl_byte>& gA_N,
+                         const vil_image_view<vxl_byte>& gB_N,
+                         const vil_image_view<vxl_byte>& mask,
+                         vcl_vector<vil_image_view<vxl_byte> >& gR,
+                         vcl_vector<vil_image_view<vxl_byte> >& gS,
+                         int l0 = 0)
+{
+	if ((N != pyramid::levels(mask.ni(), mask.nj())) ||
+		((N > 0) && ((LA[0].ni() != mask.ni()) || (LA[0].nj() != mask.nj()) ||
+		             (LB[0].ni() != mask.ni()) || (LB[0].nj() != mask.nj()))) ||
+		(gA_N.nplanes() != gB_N.nplanes()) || (l0 < 0) || (l0 > N))
+		return false;
+
+	double w_hat_data[5];
+	double* w_hat = w_hat_data + 2;
+	pyramid::kernel(a, w_hat);
+
+	gR.resize(N+1);
+	gS.assign(N+1, vil_image_view<vxl_byte>());
+	gR[0] = vil_plane(mask, 0);
+	blend_gauss_job gauss = {w_hat, N, {&gR, 0, 0}};
+	blend_gauss(0, 1, &gauss);
+
+	blend_top(gA_N, gB_N, gR[N], gS[N]);
+	for (int l=N-1; l>=l0; l--)
+		blend_next_level(l, a, LA, LB, gR, gS);
+
+	return true;
+}
+
+// Replicate each pixel of level l of a pyramid over the 2^l x 2^l
+// pixels of level 0 (of dimensions ni x nj) it stands for; this is
+// how a progressive blend previews the levels it has computed
+static void replicate_level(const vil_image_view<vxl_byte>& g, int l, int ni, int nj,
+                            vil_image_view<vxl_byte>& im)
+{
+	im = vil_image_view<vxl_byte>(ni, nj, g.nplanes());
+	for (int p=0; p<(int) g.nplanes(); p++)
+		for (int j=0; j<nj; j++) {
+			vxl_byte* dest = &im(0,j,p);
+			// the rows that stand for the same row of level l are
+			// copies of each other
+			if ((j & ((1 << l) - 1)) != 0) {
+				vcl_memcpy(dest, dest - im.jstep(), ni);
+				continue;
 			}
+			const vxl_byte* src = &g(0,j >> l,p);
+			for (int i=0; i<ni; i++)
+				dest[i] = src[(i >> l)*g.istep()];
 		}
+}
+
+// The region of the level above a region r of a level whose pixels
+// are computed from r by reduce(), ie. whose kernel overlaps r; ni 
+// and nj are the dimensions of the level above
+static blend_region reduce_region(const blend_region& r, int ni, int nj)
+{
+	blend_region u;
+
+	u.i0 = vcl_max(0, (r.i0-1)/2);
+	u.j0 = vcl_max(0, (r.j0-1)/2);
+	u.i1 = vcl_min(ni, (r.i1+1)/2 + 1);
+	u.j1 = vcl_min(nj, (r.j1+1)/2 + 1);
+
+	return u;
+}
+
+// The region of the level below a region r of a level whose pixels
+// are computed from r by expand(); ni and nj are the dimensions of 
+// the level below
+static blend_region expand_region(const blend_region& r, int ni, int nj)
+{
+	blend_region d;
+
+	d.i0 = vcl_max(0, 2*r.i0 - 2);
+	d.j0 = vcl_max(0, 2*r.j0 - 2);
+	d.i1 = vcl_min(ni, 2*r.i1 + 1);
+	d.j1 = vcl_min(nj, 2*r.j1 + 1);
+
+	return d;
+}
+
+// Add region s to region r; empty regions have i0 >= i1 or j0 >= j1
+static void add_region(blend_region& r, const blend_region& s)
+{
+	if ((s.i0 >= s.i1) || (s.j0 >= s.j1))
+		return;
+	if ((r.i0 >= r.i1) || (r.j0 >= r.j1)) {
+		r = s;
+		return;
 	}
-    
+	r.i0 = vcl_min(r.i0, s.i0);
+	r.j0 = vcl_min(r.j0, s.j0);
+	r.i1 = vcl_max(r.i1, s.i1);
+	r.j1 = vcl_max(r.j1, s.j1);
+}
+
+// Copy the pixels of src into region r of dest, and return the 
+// bounding box of the pixels of dest that have changed (which is 
+// empty if none has)
+static blend_region copy_region(const vil_image_view<vxl_byte>& src, 
+                                vil_image_view<vxl_byte>& dest, 
+                                const blend_region& r)
+{
+	blend_region changed = {0, 0, 0, 0};
+
+	for (unsigned int p=0; p<dest.nplanes(); p++)
+		for (int j=r.j0; j<r.j1; j++) {
+			const vxl_byte* s = &src(0, j-r.j0, p);
+			vxl_byte* d = &dest(r.i0, j, p);
+			int i0 = -1, i1 = -1;
+
+			for (int i=0; i<r.i1-r.i0; i++, s+=src.istep(), d+=dest.istep())
+				if (*d != *s) {
+					*d = *s;
+					if (i0 < 0)
+						i0 = i;
+					i1 = i;
+				}
+			if (i0 >= 0) {
+				blend_region row = {r.i0+i0, j, r.i0+i1+1, j+1};
+				add_region(changed, row);
+			}
+		}
+
+	return changed;
+}
+
+// Recompute region r of the Gauss level g_up from the level g below
+// it. The region is reduced from the window of g under its kernel;
+// the window starts at even coordinates, so pixel (i,j) of the 
+// reduced window is pixel (x0/2+i,y0/2+j) of g_up. The routine 
+// returns the bounding box of the pixels that have changed
+static blend_region reduce_rect(const vil_image_view<vxl_byte>& g, 
+                                const blend_region& r, const double* w_hat, 
+                                vil_image_view<vxl_byte>& g_up)
+{
+	int x0 = vcl_max(0, 2*r.i0 - 2), x1 = vcl_min((int) g.ni(), 2*r.i1 + 1);
+	int y0 = vcl_max(0, 2*r.j0 - 2), y1 = vcl_min((int) g.nj(), 2*r.j1 + 1);
+	vil_image_view<vxl_byte> red;
+
+	pyramid::reduce_level(vil_crop(g, x0, x1-x0, y0, y1-y0), w_hat, red);
+	return copy_region(vil_crop(red, r.i0-x0/2, r.i1-r.i0, r.j0-y0/2, r.j1-r.j0), 
+	                   g_up, r);
+}
+
+// The windows over which a region r of a level of dimensions ni x nj
+// is collapsed: up is the window of the level above (of dimensions 
+// ni_up x nj_up) under the kernel of r, and down the window of the 
+// level that it expands to, whose top-left pixel is (2*up.i0,2*up.j0).
+// The expanded window has an odd width (or height) only if it 
+// reaches the last column (or row) of an odd-sized level
+struct collapse_window {
+	blend_region up;
+	blend_region down;
+};
+
+static collapse_window window_of(const blend_region& r, int ni, int nj, int ni_up, int nj_up)
+{
+	collapse_window w;
+
+	w.up.i0 = vcl_max(0, r.i0/2 - 1);
+	w.up.j0 = vcl_max(0, r.j0/2 - 1);
+	w.up.i1 = vcl_min(ni_up, r.i1/2 + 2);
+	w.up.j1 = vcl_min(nj_up, r.j1/2 + 2);
+	w.down.i0 = 2*w.up.i0;
+	w.down.j0 = 2*w.up.j0;
+	w.down.i1 = (w.up.i1 == ni_up) ? ni : 2*w.up.i1;
+	w.down.j1 = (w.up.j1 == nj_up) ? nj : 2*w.up.j1;
+
+	return w;
+}
+
+// Recompute region r of level l of the result gS from the level gS_up
+// above it, the Laplacian levels LA and LB of the sources and the 
+// Gauss level gR of the mask. The level above is expanded over the 
+// window of level l whose top-left pixel is (2*x0,2*y0), as in 
+// blend_bands(), and only region r of the window is kept. The 
+// routine returns the bounding box of the pixels that have changed
+static blend_region collapse_rect(const laplacian_image& LA, 
+                                  const laplacian_image& LB,
+                                  const vil_image_view<vxl_byte>& gR,
+                                  const vil_image_view<vxl_byte>& gS_up,
+                                  const blend_region& r, const double* w_hat,
+                                  vil_image_view<vxl_byte>& gS)
+{
+	collapse_window w = window_of(r, gS.ni(), gS.nj(), gS_up.ni(), gS_up.nj());
+	int x0 = w.up.i0, x1 = w.up.i1, y0 = w.up.j0, y1 = w.up.j1;
+	int ei = w.down.i1 - w.down.i0, ej = w.down.j1 - w.down.j0;
+	int np = gS.nplanes();
+
+	laplacian_image la = vil_crop(LA, 2*x0, ei, 2*y0, ej);
+	laplacian_image lb = vil_crop(LB, 2*x0, ei, 2*y0, ej);
+	vil_image_view<vxl_byte> gr = vil_crop(gR, 2*x0, ei, 2*y0, ej);
+	laplacian_image LS(ei, ej, np);
+	vil_image_view<vxl_byte> g;
+
+	for (int p=0; p<np; p++)
+		for (int j=0; j<ej; j++)
+			blend_row(&la(0,j,p), &lb(0,j,p), &gr(0,j), gr.istep(), &LS(0,j,p), ei);
+
+	pyramid::collapse(vil_crop(gS_up, x0, x1-x0, y0, y1-y0), LS, w_hat, g);
+	return copy_region(vil_crop(g, r.i0-2*x0, r.i1-r.i0, r.j0-2*y0, r.j1-r.j0), 
+	                   gS, r);
+}
+
+// Update the pyramids gR and gS computed by blend_levels() after the
+// mask has changed inside region r of level 0. 
+//
+// Only the pixels whose inputs have changed are recomputed. At every
+// level, the region recomputed is grown from the pixels that have
+// actually changed in the levels it depends on by the footprint of 
+// the kernel: level l of the mask is reduced over the region whose 
+// kernel overlaps the changes of level l-1, and level l of the result
+// is collapsed over the changes of mask level l and the region 
+// expanded from the changes of result level l+1. Since the changes 
+// of a small edit are averaged out after a few levels, the coarse 
+// levels (which affect the whole image) usually do not change at all
+static void reblend_region(int N, double a,
+                           const laplacian_image* LA, const laplacian_image* LB,
+                           const vil_image_view<vxl_byte>& gA_N,
+                           const vil_image_view<vxl_byte>& gB_N,
+                           const vil_image_view<vxl_byte>& mask,
+                           const blend_region& r,
+                           vcl_vector<vil_image_view<vxl_byte> >& gR,
+                           vcl_vector<vil_image_view<vxl_byte> >& gS)
+{
+	double w_hat_data[5];
+	double* w_hat = w_hat_data + 2;
+	pyramid::kernel(a, w_hat);
+
+	// the mask may have been replaced by a copy since the pyramids
+	// were computed
+	gR[0] = vil_plane(mask, 0);
+
+	// the changes of the Gauss pyramid of the mask
+	blend_region empty = {0, 0, 0, 0};
+	vcl_vector<blend_region> D(N+1, empty);
+	D[0] = r;
+	for (int l=1; (l<=N) && (D[l-1].i0 < D[l-1].i1) && (D[l-1].j0 < D[l-1].j1); l++)
+		D[l] = reduce_rect(gR[l-1], reduce_region(D[l-1], gR[l].ni(), gR[l].nj()),
+		                   w_hat, gR[l]);
+
+	// the changes of the top level of the result
+	blend_region t = D[N], c = empty;
+	if ((t.i0 < t.i1) && (t.j0 < t.j1)) {
+		vil_image_view<vxl_byte> top;
+		blend_top(vil_crop(gA_N, t.i0, t.i1-t.i0, t.j0, t.j1-t.j0),
+		          vil_crop(gB_N, t.i0, t.i1-t.i0, t.j0, t.j1-t.j0),
+		          vil_crop(gR[N], t.i0, t.i1-t.i0, t.j0, t.j1-t.j0), top);
+		c = copy_region(top, gS[N], t);
+	}
+
+	// the other levels, from the coarsest down
+	for (int l=N-1; l>=0; l--) {
+		blend_region u = D[l];
+		if ((c.i0 < c.i1) && (c.j0 < c.j1))
+			add_region(u, expand_region(c, gS[l].ni(), gS[l].nj()));
+		if ((u.i0 < u.i1) && (u.j0 < u.j1))
+			c = collapse_rect(LA[l], LB[l], gR[l], gS[l+1], u, w_hat, gS[l]);
+		else
+			c = empty;
+	}
+}
+
+//
+// Sparse blending
+//
+// When the mask is 0 or 255 over most of the image, the blended 
+// pyramid only differs from the pyramids of the sources near the 
+// seam, provided the number of levels is limited: the Laplacian 
+// levels combined with a mask value of 0 (or 255) are those of 
+// source0 (or source1), so a pixel of a level of the result is equal
+// to the same pixel of a source if the mask is constant at that pixel
+// and the level above is equal to the same source under the kernel
+// of the pixel. blend_sparse() labels the pixels of every level 
+// (from the top down) with the source they are equal to, computes
+// the Gauss levels of the sources and blends the levels only in the
+// tiles that hold pixels that may differ from both sources, and 
+// copies the other pixels of level 0 from the sources, as blend2() 
+// does. The result is identical to that of a full blend with the 
+// same number of levels, and the cost of the pyramids depends on the
+// length of the seam rather than on the area of the image; only the 
+// Gauss pyramid of the mask, the labeling and the copies process the
+// entire images.
+//
+// The pixels of the result differ from the sources in a band around
+// the seam whose width grows as 2^N, so the number of levels sets the 
+// width of the transition between the two images (blend() uses all 
+// the levels, and the top levels of its pyramids are averages over
+// the entire images)
+//
+
+// The size of the tiles in which blend_sparse() processes level l. 
+// The tiles of levels 0 to 3 cover 32 pixels of level 0, and the 
+// tiles of the levels above are smaller than that, so that the Gauss
+// levels they need do not extend too far from the seam
+static int sparse_tile(int l)
+{
+	return vcl_max(4, 32 >> l);
+}
+
+// The flags of the tiles of a level
+enum {
+	// the tile holds pixels that may differ from both sources, 
+	// which are blended
+	tile_seam = 1,
+	// the blended level is needed over the tile
+	tile_active = 2,
+	// the Gauss levels of the sources are needed over the tile
+	tile_gauss = 4,
+	// the pixels of a tile without seam pixels are those of source1
+	// (otherwise those of source0)
+	tile_source1 = 8
+};
+
+// The label of the pixels of the blended pyramid that may differ from
+// both sources; the other pixels are labeled with the mask value (0 
+// or 255) that selects the source they are equal to
+static const vxl_byte seam_label = 1;
+
+// The region of the tiles ti0,...,ti1-1 of row tj of a level of 
+// dimensions ni x nj, whose tiles have size t
+static blend_region tile_region(int ti0, int ti1, int tj, int t, int ni, int nj)
+{
+	blend_region r = {ti0*t, tj*t, vcl_min(ni, ti1*t), vcl_min(nj, (tj+1)*t)};
+	return r;
+}
+
+// Set flag in all the tiles (of size t) that overlap region r
+static void mark_tiles(vil_image_view<vxl_byte>& flags, const blend_region& r, int t, 
+                       vxl_byte flag)
+{
+	for (int tj=r.j0/t; tj<=(r.j1-1)/t; tj++)
+		for (int ti=r.i0/t; ti<=(r.i1-1)/t; ti++)
+			flags(ti,tj) |= flag;
+}
+
+// Find the next run of consecutive tiles of row tj, starting at tile 
+// ti, whose flags f satisfy (f & mask) == value. The run is stored in
+// [ti,ti_end); the routine returns false if there is none
+static bool next_run(const vil_image_view<vxl_byte>& flags, int tj, 
+                     vxl_byte mask, vxl_byte value, int& ti, int& ti_end)
+{
+	int nt = flags.ni();
+
+	while ((ti < nt) && ((flags(ti,tj) & mask) != value))
+		ti++;
+	for (ti_end=ti; (ti_end < nt) && ((flags(ti_end,tj) & mask) == value); ti_end++)
+		;
+	return (ti < nt);
+}
+
+// Copy region r of src to the same region of dest, a row at a time
+static void copy_tiles(const vil_image_view<vxl_byte>& src, vil_image_view<vxl_byte>& dest, 
+                       const blend_region& r)
+{
+	vcl_ptrdiff_t sstep = src.istep(), dstep = dest.istep();
+	int n = r.i1 - r.i0;
+
+	for (unsigned int p=0; p<dest.nplanes(); p++)
+		for (int j=r.j0; j<r.j1; j++) {
+			const vxl_byte* s = &src(r.i0,j,p);
+			vxl_byte* d = &dest(r.i0,j,p);
+			if ((sstep == 1) && (dstep == 1))
+				vcl_memcpy(d, s, n);
+			else
+				for (int i=0; i<n; i++)
+					d[i*dstep] = s[i*sstep];
+		}
+}
+
+// The labels of two pixels whose values must both be equal to the
+// same source
+static inline vxl_byte merge_labels(vxl_byte a, vxl_byte b)
+{
+	return (a == b) ? a : seam_label;
+}
+
+// The arguments of the routines that process the rows of tiles of 
+// level l of blend_sparse(). The arrays hold levels 0,...,N
+struct sparse_job {
+	int l;
+	int N;
+	const double* w_hat;
+	vil_image_view<vxl_byte>* flags;
+	vil_image_view<vxl_byte>* labels;
+	vil_image_view<vxl_byte>* gA;
+	vil_image_view<vxl_byte>* gB;
+	vil_image_view<vxl_byte>* gR;
+	vil_image_view<vxl_byte>* gS;
+};
+
+// Label the pixels of rows of tiles tj0,...,tj1-1 of level l from the
+// mask and the labels of level l+1, and flag the tiles that hold 
+// seam pixels. 
+//
+// Below the top level, pixels labeled 0 and 255 cannot be adjacent,
+// since the kernels of adjacent pixels overlap, so the pixels of a 
+// tile without seam pixels all have the same label. A tile whose 
+// mask is constant and whose kernel only covers tiles of the level 
+// above with that label is labeled as a whole; the pixels of the 
+// other tiles are labeled one at a time, merging the labels of the
+// level above under the kernel of a row first (in up) and then under
+// the kernel of every pixel: the kernel of an even pixel 2k covers 
+// columns k-1,...,k+1 of the level above, and that of an odd pixel 
+// 2k+1 columns k-1,...,k+2
+static void sparse_label(int tj0, int tj1, void* arg)
+{
+	sparse_job* job = (sparse_job*) arg;
+	int l = job->l, t = sparse_tile(l);
+	const vil_image_view<vxl_byte>& gR = job->gR[l];
+	vil_image_view<vxl_byte>& lab = job->labels[l];
+	vil_image_view<vxl_byte>& flags = job->flags[l];
+	int ni = gR.ni(), nj = gR.nj();
+	vcl_ptrdiff_t wstep = gR.istep();
+	vcl_vector<vxl_byte> up, h;
+
+	for (int tj=tj0; tj<tj1; tj++)
+		for (int ti=0; ti<(int) flags.ni(); ti++) {
+			blend_region r = tile_region(ti, ti+1, tj, t, ni, nj);
+			int n = r.i1 - r.i0;
+			vxl_byte c = gR(r.i0,r.j0);
+			bool uniform = (c == 0) || (c == 255);
+
+			// the labels of the tiles of the level above under the
+			// kernel of the tile
+			if (uniform && (l < job->N)) {
+				const vil_image_view<vxl_byte>& flags_up = job->flags[l+1];
+				int t_up = sparse_tile(l+1);
+				blend_region u = window_of(r, ni, nj, job->gR[l+1].ni(), job->gR[l+1].nj()).up;
+				vxl_byte f = (c == 255) ? tile_source1 : 0;
+				for (int y=u.j0/t_up; uniform && (y<=(u.j1-1)/t_up); y++)
+					for (int x=u.i0/t_up; uniform && (x<=(u.i1-1)/t_up); x++)
+						uniform = ((flags_up(x,y) & (tile_seam | tile_source1)) == f);
+			}
+			// the mask of the tile
+			for (int j=r.j0; uniform && (j<r.j1); j++) {
+				const vxl_byte* w = &gR(r.i0,j);
+				int diff = 0;
+				for (int i=0; i<n; i++)
+					diff |= w[i*wstep] ^ c;
+				uniform = (diff == 0);
+			}
+
+			if (uniform) {
+				// the labels of level 0 are not used by other tiles
+				for (int j=r.j0; (l > 0) && (j<r.j1); j++)
+					vcl_memset(&lab(r.i0,j), c, n);
+				if (c == 255)
+					flags(ti,tj) |= tile_source1;
+				continue;
+			}
+
+			int seam = 0, mixed = 0;
+			for (int j=r.j0; j<r.j1; j++) {
+				const vxl_byte* w = &gR(0,j);
+				vxl_byte* v = &lab(0,j);
+
+				for (int i=r.i0; i<r.i1; i++) {
+					vxl_byte x = w[i*wstep];
+					v[i] = ((x == 0) || (x == 255)) ? x : seam_label;
+				}
+
+				if (l < job->N) {
+					// the columns k0,...,k1-1 of the level above are
+					// under the kernel of the pixels of the tile, and
+					// h[k-k0] merges columns k-1,...,k+1
+					const vil_image_view<vxl_byte>& lab_up = job->labels[l+1];
+					int y0 = vcl_max(0, j/2 - 1), y1 = vcl_min((int) lab_up.nj(), (j+1)/2 + 2);
+					int k0 = vcl_max(0, r.i0/2 - 1), k1 = vcl_min((int) lab_up.ni(), (r.i1+1)/2 + 2);
+					int k;
+
+					up.assign(&lab_up(k0,y0), &lab_up(k0,y0) + (k1-k0));
+					for (int y=y0+1; y<y1; y++) {
+						const vxl_byte* u = &lab_up(k0,y);
+						for (k=0; k<k1-k0; k++)
+							up[k] = merge_labels(up[k], u[k]);
+					}
+					h.resize(k1-k0);
+					for (k=0; k<k1-k0; k++)
+						h[k] = merge_labels(up[vcl_max(0, k-1)], 
+						                    merge_labels(up[k], up[vcl_min(k1-k0-1, k+1)]));
+					for (int i=r.i0; i<r.i1; i++) {
+						k = i/2 - k0;
+						if ((i & 1) && (k+1 < k1-k0))
+							v[i] = merge_labels(v[i], merge_labels(h[k], h[k+1]));
+						else
+							v[i] = merge_labels(v[i], h[k]);
+					}
+				}
+
+				for (int i=r.i0; i<r.i1; i++) {
+					seam |= (v[i] == seam_label);
+					mixed |= (v[i] != lab(r.i0,r.j0));
+				}
+			}
+
+			// a tile with pixels of both sources (which is only 
+			// possible at the top level) is blended as well
+			if (seam || mixed)
+				flags(ti,tj) |= tile_seam;
+			else if (lab(r.i0,r.j0) == 255)
+				flags(ti,tj) |= tile_source1;
+		}
+}
+
+// Reduce the Gauss levels of the sources over the tiles of rows 
+// tj0,...,tj1-1 of level l that are flagged with tile_gauss, from the
+// windows of level l-1 under their kernel (as in reduce_rect())
+static void sparse_gauss(int tj0, int tj1, void* arg)
+{
+	sparse_job* job = (sparse_job*) arg;
+	int l = job->l, t = sparse_tile(l);
+	const vil_image_view<vxl_byte>& flags = job->flags[l];
+	int ni = job->gR[l].ni(), nj = job->gR[l].nj();
+	vil_image_view<vxl_byte> red, dest;
+
+	for (int tj=tj0; tj<tj1; tj++)
+		for (int ti=0, ti_end=0; next_run(flags, tj, tile_gauss, tile_gauss, ti, ti_end); ti=ti_end) {
+			blend_region r = tile_region(ti, ti_end, tj, t, ni, nj);
+			blend_region d = expand_region(r, job->gR[l-1].ni(), job->gR[l-1].nj());
+			blend_region s = {r.i0 - d.i0/2, r.j0 - d.j0/2, r.i1 - d.i0/2, r.j1 - d.j0/2};
+
+			for (int k=0; k<2; k++) {
+				vil_image_view<vxl_byte>* g = (k == 0) ? job->gA : job->gB;
+				pyramid::reduce_level(window_view(g[l-1], d), job->w_hat, red);
+				dest = window_view(g[l], r);
+				vil_copy_reformat(window_view(red, s), dest);
+			}
+		}
+}
+
+// Compute level l of the blended pyramid over the tiles of rows 
+// tj0,...,tj1-1 that are flagged with tile_active. The seam tiles are
+// blended as in collapse_rect(), computing the Laplacian levels of the
+// sources over the windows of the tiles from their Gauss levels (the 
+// top level is blended as in blend()); the pixels of the other tiles
+// are copied from the source given by their labels
+static void sparse_blend(int tj0, int tj1, void* arg)
+{
+	sparse_job* job = (sparse_job*) arg;
+	int l = job->l, t = sparse_tile(l);
+	const vil_image_view<vxl_byte>& flags = job->flags[l];
+	const vil_image_view<vxl_byte>& gA = job->gA[l];
+	const vil_image_view<vxl_byte>& gB = job->gB[l];
+	const vil_image_view<vxl_byte>& gR = job->gR[l];
+	vil_image_view<vxl_byte>& gS = job->gS[l];
+	int ni = gS.ni(), nj = gS.nj(), np = gS.nplanes();
+	laplacian_image LA, LB, LS;
+	vil_image_view<vxl_byte> g, dest;
+
+	for (int tj=tj0; tj<tj1; tj++) {
+		// the tiles copied from the sources
+		for (int k=0; k<2; k++) {
+			vxl_byte mask = tile_active | tile_seam | tile_source1;
+			vxl_byte value = (k == 0) ? tile_active : (tile_active | tile_source1);
+			for (int ti=0, ti_end=0; next_run(flags, tj, mask, value, ti, ti_end); ti=ti_end) {
+				copy_tiles((k == 0) ? gA : gB, gS, tile_region(ti, ti_end, tj, t, ni, nj));
+			}
+		}
+
+		// the seam tiles
+		for (int ti=0, ti_end=0; 
+		     next_run(flags, tj, tile_seam, tile_seam, ti, ti_end); ti=ti_end) {
+			blend_region r = tile_region(ti, ti_end, tj, t, ni, nj);
+
+			if (l == job->N) {
+				blend_top(window_view(gA, r), window_view(gB, r), window_view(gR, r), g);
+				dest = window_view(gS, r);
+				vil_copy_reformat(g, dest);
+				continue;
+			}
+
+			const vil_image_view<vxl_byte>& gS_up = job->gS[l+1];
+			collapse_window w = window_of(r, ni, nj, gS_up.ni(), gS_up.nj());
+			int ei = w.down.i1 - w.down.i0, ej = w.down.j1 - w.down.j0;
+
+			LA.set_size(ei, ej, np);
+			LB.set_size(ei, ej, np);
+			pyramid::laplacian(window_view(gA, w.down), window_view(job->gA[l+1], w.up), 
+			                   job->w_hat, LA);
+			pyramid::laplacian(window_view(gB, w.down), window_view(job->gB[l+1], w.up), 
+			                   job->w_hat, LB);
+
+			// only the pixels of the tiles are combined and kept
+			int x0 = r.i0 - w.down.i0, y0 = r.j0 - w.down.j0;
+			LS.set_size(ei, ej, np);
+			for (int p=0; p<np; p++)
+				for (int j=r.j0; j<r.j1; j++)
+					blend_row(&LA(x0,j-w.down.j0,p), &LB(x0,j-w.down.j0,p), 
+					          &gR(r.i0,j), gR.istep(), &LS(x0,j-w.down.j0,p), r.i1-r.i0);
+
+			pyramid::collapse(window_view(gS_up, w.up), LS, job->w_hat, g);
+			blend_region s = {x0, y0, x0 + r.i1-r.i0, y0 + r.j1-r.j0};
+			dest = window_view(gS, r);
+			vil_copy_reformat(window_view(g, s), dest);
+		}
+	}
+}
+
+// Blend two images with N levels, only computing the pyramids near
+// the seam (see above). N is reduced to the number of levels of the
+// pyramids of the images if it exceeds it
+static bool blend_sparse(int N, double a,
+                         const vil_image_view<vxl_byte>& source0, 
+                         const vil_image_view<vxl_byte>& source1,
+                         const vil_image_view<vxl_byte>& mask,
+                         vil_image_view<vxl_byte>& result)
+{
+	if ((source0.ni() != source1.ni()) ||
+		(source0.nj() != source1.nj()) ||
+		(source0.nplanes() != source1.nplanes()) ||
+		(source0.ni() != mask.ni()) ||
+		(source0.nj() != mask.nj()) || (N < 0))
+		return false;
+
+	int ni = source0.ni(), nj = source0.nj(), np = source0.nplanes();
+	N = vcl_min(N, pyramid::levels(ni, nj));
+
+	double w_hat_data[5];
+	double* w_hat = w_hat_data + 2;
+	pyramid::kernel(a, w_hat);
+
+	// the Gauss pyramid of the mask
+	vcl_vector<vil_image_view<vxl_byte> > gR(N+1);
+	gR[0] = row_view(vil_plane(mask, 0), 0, nj);
+	blend_gauss_job gauss = {w_hat, N, {&gR, 0, 0}};
+	blend_gauss(0, 1, &gauss);
+
+	// the levels of the sources and of the result are allocated in
+	// full, but only the pixels of the tiles that need them are 
+	// computed
+	vcl_vector<vil_image_view<vxl_byte> > gA(N+1), gB(N+1), gS(N+1);
+	vcl_vector<vil_image_view<vxl_byte> > labels(N+1), flags(N+1);
+	gA[0] = row_view(source0, 0, nj);
+	gB[0] = row_view(source1, 0, nj);
+	result.set_size(ni, nj, np);
+	gS[0] = result;
+	for (int l=0; l<=N; l++) {
+		if (l > 0) {
+			gA[l].set_size(gR[l].ni(), gR[l].nj(), np);
+			gB[l].set_size(gR[l].ni(), gR[l].nj(), np);
+			gS[l].set_size(gR[l].ni(), gR[l].nj(), np);
+		}
+		labels[l].set_size(gR[l].ni(), gR[l].nj());
+		int t = sparse_tile(l);
+		flags[l].set_size((gR[l].ni() + t - 1)/t, (gR[l].nj() + t - 1)/t);
+		flags[l].fill(0);
+	}
+
+	sparse_job job = {N, N, w_hat, &flags[0], &labels[0], &gA[0], &gB[0], &gR[0], &gS[0]};
+
+	// label the pixels from the top level down
+	for (job.l=N; job.l>=0; job.l--)
+		parallel_for(flags[job.l].nj(), sparse_label, &job);
+
+	// The blending of a seam tile needs the level above (and the 
+	// Gauss levels of the sources) over the window under its kernel,
+	// and the Gauss levels of the sources over the window it expands
+	// to; every pixel of level 0 is needed. The Gauss levels of the 
+	// sources are reduced from the windows of the level below under
+	// the kernel of the tiles that need them
+	blend_region all = {0, 0, ni, nj};
+	mark_tiles(flags[0], all, sparse_tile(0), tile_active);
+	for (int l=0; l<=N; l++)
+		for (int tj=0; tj<(int) flags[l].nj(); tj++)
+			for (int ti=0; ti<(int) flags[l].ni(); ti++) {
+				if ((flags[l](ti,tj) & tile_seam) == 0)
+					continue;
+				flags[l](ti,tj) |= tile_active;
+				if (l < N) {
+					blend_region r = tile_region(ti, ti+1, tj, sparse_tile(l), 
+					                             gR[l].ni(), gR[l].nj());
+					collapse_window w = window_of(r, gR[l].ni(), gR[l].nj(), 
+					                              gR[l+1].ni(), gR[l+1].nj());
+					mark_tiles(flags[l+1], w.up, sparse_tile(l+1), tile_active);
+					mark_tiles(flags[l], w.down, sparse_tile(l), tile_gauss);
+				}
+			}
+	for (int l=N; l>0; l--)
+		for (int tj=0; tj<(int) flags[l].nj(); tj++)
+			for (int ti=0; ti<(int) flags[l].ni(); ti++) {
+				if (flags[l](ti,tj) & tile_active)
+					flags[l](ti,tj) |= tile_gauss;
+				if ((l > 1) && (flags[l](ti,tj) & tile_gauss)) {
+					blend_region r = tile_region(ti, ti+1, tj, sparse_tile(l), 
+					                             gR[l].ni(), gR[l].nj());
+					mark_tiles(flags[l-1], expand_region(r, gR[l-1].ni(), gR[l-1].nj()), 
+					           sparse_tile(l-1), tile_gauss);
+				}
+			}
+
+	// the Gauss levels of the sources, from the bottom up, and the
+	// levels of the result, from the top down
+	for (job.l=1; job.l<=N; job.l++)
+		parallel_for(flags[job.l].nj(), sparse_gauss, &job);
+	for (job.l=N; job.l>=0; job.l--)
+		parallel_for(flags[job.l].nj(), sparse_blend, &job);
+
+	return true;
+}
+
+// The frame_blender class runs the steps of blend() on pyramids that
+// are kept from one frame to the next: the Gauss pyramid of the mask
+// is built once, and the levels of the sources and of the result are
+// reduced and collapsed into the images of the previous frame
+frame_blender::frame_blender()
+{
+	N_ = -1;
+	w_hat_ = w_hat_data_ + 2;
+}
+
+bool frame_blender::set_mask(const vil_image_view<vxl_byte>& mask, double a)
+{
+	if ((mask.ni() == 0) || (mask.nj() == 0) || (mask.nplanes() == 0))
+		return false;
+
+	N_ = pyramid::levels(mask.ni(), mask.nj());
+	pyramid::kernel(a, w_hat_);
+
+	gR_.assign(N_+1, vil_image_view<vxl_byte>());
+	gR_[0].deep_copy(vil_plane(mask, 0));
+	blend_gauss_job gauss = {w_hat_, N_, {&gR_, 0, 0}};
+	blend_gauss(0, 1, &gauss);
+
+	// the levels of the sources and of the result are allocated by
+	// the first frame
+	gA_.assign(N_+1, vil_image_view<vxl_byte>());
+	gB_.assign(N_+1, vil_image_view<vxl_byte>());
+	gS_.assign(N_+1, vil_image_view<vxl_byte>());
+
+	return true;
+}
+
+bool frame_blender::blend(const vil_image_view<vxl_byte>& source0,
+                          const vil_image_view<vxl_byte>& source1,
+                          vil_image_view<vxl_byte>& result)
+{
+	if ((N_ < 0) ||
+		(source0.ni() != gR_[0].ni()) || (source0.nj() != gR_[0].nj()) ||
+		(source1.ni() != gR_[0].ni()) || (source1.nj() != gR_[0].nj()) ||
+		(source0.nplanes() != source1.nplanes()))
+		return false;
+
+	int ni = source0.ni(), nj = source0.nj(), np = source0.nplanes();
+
+	// reduce_level() keeps the memory of the levels when their
+	// dimensions do not change
+	gA_[0] = row_view(source0, 0, nj);
+	gB_[0] = row_view(source1, 0, nj);
+	blend_gauss_job gauss = {w_hat_, N_, {&gA_, &gB_, 0}};
+	parallel_for(2, blend_gauss, &gauss);
+
+	result.set_size(ni, nj, np);
+	if (N_ == 0)
+		blend_top(gA_[0], gB_[0], gR_[0], result);
+	else
+		blend_top(gA_[N_], gB_[N_], gR_[N_], gS_[N_]);
+	for (int l=N_-1; l>=0; l--) {
+		vil_image_view<vxl_byte>& gS = (l == 0) ? result : gS_[l];
+		gS.set_size(gR_[l].ni(), gR_[l].nj(), np);
+
+		blend_level(l, w_hat_, 0, 0, &gA_[0], &gB_[0], &gR_[0], gS_[l+1], gS);
+	}
+
+	// the frames may be released (or reused) by the caller
+	gA_[0] = gB_[0] = vil_image_view<vxl_byte>();
+
 	return true;
 }
 
@@ -103,6 +1148,23 @@ blending::blending(void)
 	blend_pyr_ = 0;
 	mask_pyr_ = 0;
 	N_ = 0;
+	a_ = 0.4;
+	sparse_levels_ = 0;
+	progressive_levels_ = 0;
+	refine_level_ = 0;
+	refine_band_ = 0;
+	blend_pyr_valid_ = false;
+	mask_pyr_valid_ = false;
+	partial_ = false;
+	mask_owned_ = false;
+}
+
+blending::~blending()
+{
+	delete source0_pyr_;
+	delete source1_pyr_;
+	delete blend_pyr_;
+	delete mask_pyr_;
 }
 
 // Top-level computation routine
@@ -124,45 +1186,371 @@ bool blending::compute()
 		return false;
 
 	// Ok, we have enough information to proceed
+
+	if (sparse_levels_ > 0) {
+		// the sparse blend does not use the pyramids of the sources,
+		// and is fast enough to be run again when the mask is edited
+		vil_image_view<vxl_byte> result;
+		if (blend_sparse(sparse_levels_, a_, vil_view_as_planes(source0_), 
+		                 vil_view_as_planes(source1_), mask_, result) == false)
+			return false;
+		dirty_.clear();
+		partial_ = false;
+		refine_level_ = 0;
+		refine_band_ = 0;
+		blended_ = result;
+		blend_ = blended_;
+		blend_pyr_valid_ = false;
+		blending_computed_ = true;
+		outdated_ = false;
+		return true;
+	}
 	
-	// run the blending algorithm
-	// since the algorithm operates on vxl_byte rather than
-	// vil_rgb<vxl_byte> pixels, we first cast to the appropriate
-	// format 
-	vil_image_view<vxl_byte> result;
-    blend(vil_view_as_planes(source0_), 
-		  vil_view_as_planes(source1_), 
-		  mask_, result);
-	blend_ = result;
-
-	// compute the pyramid of the result, for display 
-	// purposes
-	if (blend_pyr_)
-		delete blend_pyr_;
-	blend_pyr_ = new pyramid(result);
+	// run the blending algorithm on the pyramids of the sources,
+	// which are only rebuilt if the source images have changed
+	// since they were built; a new mask only requires its own
+	// Gauss pyramid
+	bool rebuilt0 = update_source_pyramid(source0_pyr_, source0_key_, source0_, source0_seeds_);
+	bool rebuilt1 = update_source_pyramid(source1_pyr_, source1_key_, source1_, source1_seeds_);
+	int N = source0_pyr_->N();
+	const laplacian_image* LA = (N > 0) ? &source0_pyr_->L_[0] : 0;
+	const laplacian_image* LB = (N > 0) ? &source1_pyr_->L_[0] : 0;
+
+	if (partial_ && blending_computed_ && (!rebuilt0) && (!rebuilt1)) {
+		// only the mask has been edited since the last blend, so 
+		// only the regions that depend on the edits are recomputed
+		for (unsigned int k=0; k<dirty_.size(); k++)
+			reblend_region(N, a_, LA, LB, source0_pyr_->g_N_, source1_pyr_->g_N_,
+			               mask_, dirty_[k], mask_gauss_, blend_gauss_);
+	} else {
+		// a progressive blend stops at the preview level; the levels
+		// below are computed by refine()
+		int l0 = vcl_min(progressive_levels_, N);
+		if (blend_levels(N, a_, LA, LB, 
+		                 source0_pyr_->g_N_, source1_pyr_->g_N_, 
+		                 mask_, mask_gauss_, blend_gauss_, l0) == false)
+			return false;
+		refine_level_ = l0;
+		refine_band_ = 0;
+	}
+	dirty_.clear();
+	// the edited regions of the mask can only be reblended once the
+	// pyramid of the result is complete
+	partial_ = (refine_level_ == 0);
+	update_blended();
+
+	// the pyramid of the result is only computed when it is 
+	// displayed or saved
+	blend_pyr_valid_ = false;
 
 
 	blending_computed_ = true;
 	outdated_ = false;
 
+	// show the preview right away
+	if (refine_level_ > 0)
+		display_blend();
+
+	return true;
+}
+
+pyramid* blending::source_pyramid(im_type imt)
+{
+	if (imt == Source0) {
+		update_source_pyramid(source0_pyr_, source0_key_, source0_, source0_seeds_);
+		return source0_pyr_;
+	} else {
+		update_source_pyramid(source1_pyr_, source1_key_, source1_, source1_seeds_);
+		return source1_pyr_;
+	}
+}
+
+// Build the pyramid of the blended image, reusing the memory of
+// an existing pyramid built with the same kernel
+pyramid* blending::blend_pyramid()
+{
+	// a progressive blend is completed first
+	while (refine_step() == true)
+		;
+	if (blend_pyr_valid_ == false) {
+		if (blend_pyr_ && (blend_pyr_->a() == a_))
+			blend_pyr_->rebuild(blended_);
+		else {
+			delete blend_pyr_;
+			blend_pyr_ = new pyramid(blended_, a_);
+			// the displayed levels are cached, so that stepping
+			// through the levels does not collapse the pyramid 
+			// every time
+			blend_pyr_->cache_gauss(true);
+		}
+		blend_pyr_valid_ = true;
+	}
+	return blend_pyr_;
+}
+
+// Build the pyramid of the mask, reusing the memory of an existing
+// pyramid built with the same kernel
+pyramid* blending::mask_pyramid()
+{
+	if (mask_pyr_valid_ == false) {
+		if (mask_pyr_ && (mask_pyr_->a() == a_))
+			mask_pyr_->rebuild(mask_);
+		else {
+			delete mask_pyr_;
+			mask_pyr_ = new pyramid(mask_, a_);
+			mask_pyr_->cache_gauss(true);
+		}
+		mask_pyr_valid_ = true;
+	}
+	return mask_pyr_;
+}
+
+void blending::own_mask()
+{
+	if (mask_owned_ == false) {
+		vil_image_view<vxl_byte> copy;
+		copy.deep_copy(mask_);
+		mask_ = copy;
+		mask_owned_ = true;
+	}
+}
+
+void blending::add_dirty(const blend_region& r)
+{
+	blend_region b = r;
+
+	// merged regions may overlap other regions, so the search
+	// restarts after every merge
+	for (unsigned int k=0; k<dirty_.size(); )
+		if ((b.i0 < dirty_[k].i1) && (dirty_[k].i0 < b.i1) &&
+			(b.j0 < dirty_[k].j1) && (dirty_[k].j0 < b.j1)) {
+			b.i0 = vcl_min(b.i0, dirty_[k].i0);
+			b.j0 = vcl_min(b.j0, dirty_[k].j0);
+			b.i1 = vcl_max(b.i1, dirty_[k].i1);
+			b.j1 = vcl_max(b.j1, dirty_[k].j1);
+			dirty_.erase(dirty_.begin() + k);
+			k = 0;
+		} else
+			k++;
+	dirty_.push_back(b);
+
+	mask_pyr_valid_ = false;
+	outdated_ = true;
+}
+
+bool blending::update_mask(const vil_image_view<vxl_byte>& im, int i0, int j0)
+{
+	if (((bool) mask_ == false) || ((bool) im == false) ||
+		(i0 < 0) || (j0 < 0) || 
+		(i0 + (int) im.ni() > (int) mask_.ni()) || 
+		(j0 + (int) im.nj() > (int) mask_.nj()) ||
+		(im.nplanes() != mask_.nplanes()))
+		return false;
+
+	own_mask();
+	vil_image_view<vxl_byte> window = vil_crop(mask_, i0, im.ni(), j0, im.nj());
+	vil_copy_reformat(im, window);
+
+	blend_region r = {i0, j0, i0 + (int) im.ni(), j0 + (int) im.nj()};
+	add_dirty(r);
+
+	return true;
+}
+
+bool blending::draw_mask(const vil_image_view<bool>& strokes, vxl_byte value)
+{
+	if (((bool) mask_ == false) || ((bool) strokes == false) ||
+		(strokes.ni() != mask_.ni()) || (strokes.nj() != mask_.nj()))
+		return false;
+
+	own_mask();
+
+	// the bounding box of the pixels that change
+	blend_region r = {(int) mask_.ni(), (int) mask_.nj(), 0, 0};
+	for (unsigned int j=0; j<mask_.nj(); j++)
+		for (unsigned int i=0; i<mask_.ni(); i++)
+			if (strokes(i,j))
+				for (unsigned int p=0; p<mask_.nplanes(); p++)
+					if (mask_(i,j,p) != value) {
+						mask_(i,j,p) = value;
+						r.i0 = vcl_min(r.i0, (int) i);
+						r.j0 = vcl_min(r.j0, (int) j);
+						r.i1 = vcl_max(r.i1, (int) i+1);
+						r.j1 = vcl_max(r.j1, (int) j+1);
+					}
+
+	if (r.i0 < r.i1)
+		add_dirty(r);
+
+	return true;
+}
+
+// Rebuild the pyramid of a source image if needed
+bool blending::update_source_pyramid(pyramid*& pyr, 
+                                     vil_image_view<vil_rgb<vxl_byte> >& key,
+                                     const vil_image_view<vil_rgb<vxl_byte> >& im,
+                                     const vcl_vector<vil_image_view<vxl_byte> >& seeds)
+{
+	// key shares the pixels of the image it refers to, so as long 
+	// as it is held they cannot be reused by another image
+	if (pyr && (pyr->a() == a_) && 
+		(key.top_left_ptr() == im.top_left_ptr()) &&
+		(key.ni() == im.ni()) && (key.nj() == im.nj()) &&
+		(key.istep() == im.istep()) && (key.jstep() == im.jstep()))
+		return false;
+
+	const vil_image_view<vxl_byte>* coarse = seeds.empty() ? 0 : &seeds[0];
+	if (pyr && (pyr->a() == a_))
+		pyr->rebuild(vil_view_as_planes(im), coarse, seeds.size());
+	else {
+		delete pyr;
+		pyr = new pyramid(vil_view_as_planes(im), coarse, seeds.size(), a_);
+		pyr->cache_gauss(true);
+	}
+	key = im;
+
 	return true;
 }
 
+void blending::set_a(double a)
+{
+	a_ = a;
+	partial_ = false;
+	mask_pyr_valid_ = false;
+	blend_pyr_valid_ = false;
+	outdated_ = true;
+}
+
+void blending::set_sparse(int levels)
+{
+	sparse_levels_ = vcl_max(0, levels);
+	partial_ = false;
+	outdated_ = true;
+}
+
+// the number of levels of the preview of a progressive blend that
+// toggle_progressive() selects: an eighth of the resolution, which 
+// takes about 1/64 of the time of the last level to compute
+static const int default_progressive_levels = 3;
+
+// the number of pixels of a level that refine_step() blends per
+// thread, which bounds the time a step keeps the interface waiting
+static const int refine_step_pixels = 1 << 19;
+
+void blending::set_progressive(int levels)
+{
+	progressive_levels_ = vcl_max(0, levels);
+}
+
+void blending::toggle_progressive()
+{
+	set_progressive((progressive_levels_ > 0) ? 0 : default_progressive_levels);
+}
+
+bool blending::refine_step()
+{
+	if ((refine_level_ == 0) || (blending_computed_ == false) || outdated_)
+		return false;
+
+	// the next level down is computed a few bands at a time
+	int l = refine_level_ - 1;
+	const vil_image_view<vxl_byte>& gR = mask_gauss_[l];
+	int bands = blend_band_count(gR);
+	int step = vcl_max(1, refine_step_pixels/(int) (gR.ni()*blend_band_rows))*parallel_threads();
+	int b1 = vcl_min(bands, refine_band_ + step);
+	const laplacian_image* LA = &source0_pyr_->L_[0];
+	const laplacian_image* LB = &source1_pyr_->L_[0];
+	blend_next_level(l, a_, LA, LB, mask_gauss_, blend_gauss_, refine_band_, b1);
+	refine_band_ = b1;
+	if (refine_band_ < bands)
+		return true;
+
+	refine_level_ = l;
+	refine_band_ = 0;
+	partial_ = (refine_level_ == 0);
+	update_blended();
+
+	return true;
+}
+
+bool blending::refine()
+{
+	int l = refine_level_;
+	if (refine_step() == false)
+		return false;
+	// the display only changes once a level is complete
+	if (refine_level_ != l)
+		display_blend();
+	return true;
+}
+
+void blending::update_blended()
+{
+	if (refine_level_ == 0)
+		blended_ = blend_gauss_[0];
+	else
+		replicate_level(blend_gauss_[refine_level_], refine_level_, ni_, nj_, blended_);
+	blend_ = blended_;
+	blend_pyr_valid_ = false;
+}
+
+void blending::display_blend()
+{
+	if (draw_enabled_ && (right_image_ == Blend))
+		display_images(right_panel_, Blend);
+}
+
 bool blending::save_blended(const char* basename) 
 { 
+     // a progressive blend is completed first
+     while (refine_step() == true)
+           ;
      if ((blending_computed_) && (!outdated_)) { 
-           vil_image_view<vxl_byte> im; 
-           blend_pyr_->g(0, im); 
            char fname[256]; 
            strcpy(fname, basename); 
            strcat(fname, ".jpg"); 
            //vcl_ostringstream fname_str(fname); 
            //fname_str << basename << ".jpg"; 
-           return vil_save(im, fname /*(fname_str.str()).c_str()*/); 
+           return vil_save(blended_, fname /*(fname_str.str()).c_str()*/); 
      } else  
            return false; 
 } 
 
+// save a pyramid in binary form
+bool blending::save_pyramid_file(im_type imt, const char* basename)
+{
+	pyramid* pyr = 0;
+	const char* ext = "";
+
+	switch (imt) {
+	case Source0:
+		if ((bool) source0_)
+			pyr = source_pyramid(Source0);
+		ext = ".s0.pyr";
+		break;
+	case Source1:
+		if ((bool) source1_)
+			pyr = source_pyramid(Source1);
+		ext = ".s1.pyr";
+		break;
+	case Blend:
+		if ((blending_computed_) && (!outdated_))
+			pyr = blend_pyramid();
+		ext = ".b.pyr";
+		break;
+	case Mask:
+		if ((bool) mask_)
+			pyr = mask_pyramid();
+		ext = ".m.pyr";
+		break;
+	}
+	if (pyr == 0)
+		return false;
+
+	vcl_string fname = vcl_string(basename) + ext;
+	return pyr->save(fname.c_str());
+}
+
 // save the results
 bool blending::save_pyramid(im_type imt, bool gauss, const char* basename)
 {
@@ -175,29 +1563,29 @@ bool blending::save_pyramid(im_type imt, bool gauss, const char* basename)
 
 	switch (imt) {
 	case Source0:
-		if (source0_pyr_) {
-			pyr = source0_pyr_;
+		if ((bool) source0_) {
+			pyr = source_pyramid(Source0);
 			fname_str << ".s0" << vcl_ends;
 			ok = true;
 		}
 		break;
 	case Source1:
-		if (source1_pyr_) {
-			pyr = source1_pyr_;
+		if ((bool) source1_) {
+			pyr = source_pyramid(Source1);
 			fname_str << ".s1" << vcl_ends;
 			ok = true;
 		}
 		break;
 	case Blend:
 		if ((blending_computed_) && (!outdated_)) {
-			pyr = blend_pyr_; 
+			pyr = blend_pyramid(); 
 			fname_str << ".b" << vcl_ends;
 			ok = true;
 		}
 		break;
 	case Mask:
-		if (mask_pyr_) {
-			pyr = mask_pyr_;
+		if ((bool) mask_) {
+			pyr = mask_pyramid();
 			fname_str << ".m" << vcl_ends;
 			ok = true;
 		}
@@ -286,8 +1674,10 @@ bool blending::display_images(ImDraw* panel, im_type imt)
 {
 	char fname[256];
 	vcl_ostringstream label(fname);
-	pyramid* pyr;
+	pyramid* pyr = 0;
 	bool ok = false;
+	bool level0 = view_gauss_ && (view_packed_ == false) && (view_level_ == 0);
+	vil_image_view<vxl_byte> im0;
 
 	label << get_title(imt);
 	if (view_packed_ == false) {
@@ -304,25 +1694,41 @@ bool blending::display_images(ImDraw* panel, im_type imt)
 	switch (imt) {
 		case Source0:
 			if ((bool) source0_) {
-				pyr = source0_pyr_;
+				// the pyramids of the sources are only built when
+				// a level above 0 is displayed
+				if (level0)
+					im0 = vil_view_as_planes(source0_);
+				else
+					pyr = source_pyramid(Source0);
 				ok = true;
 			}
 			break;
 		case Source1:
 			if ((bool) source1_) {
-				pyr = source1_pyr_;
+				if (level0)
+					im0 = vil_view_as_planes(source1_);
+				else
+					pyr = source_pyramid(Source1);
 				ok = true;
 			}
 			break;
 		case Blend:
 			if (blending_computed_ && (!outdated_)) {
-				pyr = blend_pyr_;
+				// level 0 is the result itself, so the pyramid is 
+				// not needed to display it
+				if (level0)
+					im0 = blended_;
+				else
+					pyr = blend_pyramid();
 				ok = true;
 			}
 			break;
 		case Mask:
 			if ((bool) mask_) {
-				pyr = mask_pyr_;
+				if (level0)
+					im0 = mask_;
+				else
+					pyr = mask_pyramid();
 				ok = true;
 			}
 			break;
@@ -333,10 +1739,15 @@ bool blending::display_images(ImDraw* panel, im_type imt)
 	if (ok) {
 		if (view_gauss_) {
 			vil_image_view<vxl_byte> im2;
-			if (view_packed_ == false) {
-				// display a level of the Gauss pyramid
-				pyr->g(view_level_, 0, im2);
-				im2 = vil_crop(im2, 0, ni_, 0, nj_);
+			if (pyr == 0)
+				im2 = im0;
+			else if (view_packed_ == false) {
+				// display a level of the Gauss pyramid; level 0 is 
+				// converted below, so it does not have to be copied
+				if (view_level_ == 0)
+					im2 = pyr->g_view(0);
+				else
+					pyr->g(view_level_, 0, im2);
 			} else 
 				// display the entire pyramid
 				pyr->pack_gauss(im2);
@@ -356,9 +1767,11 @@ bool blending::display_images(ImDraw* panel, im_type imt)
 			vil_image_view<vxl_byte> imb;
 			if (view_packed_ == false) {
 				// display a level of the Laplacian pyramid
-				vil_image_view<int> im2;
-				pyr->L(view_level_, 0, im2);
-				im2 = vil_crop(im2, 0, ni_, 0, nj_);
+				laplacian_image im2;
+				if (view_level_ == 0)
+					im2 = pyr->L_view(0);
+				else
+					pyr->L(view_level_, 0, im2);
 				pyramid::int_to_ubyte(im2, imb);
 			} else 
 				pyr->pack_laplacian(imb);
@@ -462,10 +1875,10 @@ bool blending::set(im_type imt, vil_image_view<vil_rgb<vxl_byte> > im)
 	switch (imt) {
 	case Source0:
 		if (check_and_set_input(im, source0_)) {
-			if (source0_pyr_)
-				delete source0_pyr_;
-			source0_pyr_ = new pyramid(vil_view_as_planes(im));
-			N_ = source0_pyr_ -> N();
+			source0_seeds_.clear();
+			// the pyramid is only built when it is needed
+			partial_ = false;
+			N_ = pyramid::levels(ni_, nj_);
 			set_view_mode(Source0);
 			view_level_ = 0;
 			view_gauss_ = true;
@@ -475,10 +1888,9 @@ bool blending::set(im_type imt, vil_image_view<vil_rgb<vxl_byte> > im)
 		break;
 	case Source1:
 		if (check_and_set_input(im, source1_)) {
-			if (source1_pyr_)
-				delete source1_pyr_;
-			source1_pyr_ = new pyramid(vil_view_as_planes(im));
-			N_ = source1_pyr_ -> N();
+			source1_seeds_.clear();
+			partial_ = false;
+			N_ = pyramid::levels(ni_, nj_);
 			set_view_mode(Source0);
 			view_level_ = 0;
 			view_gauss_ = true;
@@ -493,14 +1905,88 @@ bool blending::set(im_type imt, vil_image_view<vil_rgb<vxl_byte> > im)
 }
 
 
+bool blending::load_pyramid_file(im_type imt, const char* fname)
+{
+	if ((imt != Source0) && (imt != Source1))
+		return false;
+
+	pyramid* pyr = new pyramid(fname);
+	if ((pyr->ok() == false) || (pyr->g_N_.nplanes() != 3)) {
+		delete pyr;
+		return false;
+	}
+
+	// the source image is level 0 of the Gauss pyramid, which is
+	// stored in the file
+	vil_image_view<vil_rgb<vxl_byte> > im(pyr->ni(0), pyr->nj(0));
+	vil_image_view<vxl_byte> planes = vil_view_as_planes(im);
+	vil_copy_reformat(pyr->g_[0], planes);
+
+	pyramid*& source_pyr = (imt == Source0) ? source0_pyr_ : source1_pyr_;
+	vil_image_view<vil_rgb<vxl_byte> >& source = (imt == Source0) ? source0_ : source1_;
+	vil_image_view<vil_rgb<vxl_byte> >& key = (imt == Source0) ? source0_key_ : source1_key_;
+
+	if (check_and_set_input(im, source) == false) {
+		delete pyr;
+		return false;
+	}
+	// the loaded pyramid is used as if it had been built from the
+	// source image
+	((imt == Source0) ? source0_seeds_ : source1_seeds_).clear();
+	delete source_pyr;
+	source_pyr = pyr;
+	source_pyr->cache_gauss(true);
+	key = source;
+	partial_ = false;
+
+	N_ = source_pyr->N();
+	set_view_mode(Source0);
+	view_level_ = 0;
+	view_gauss_ = true;
+	display_images();
+	return true;
+}
+
+bool blending::set_seeds(im_type imt, const vcl_vector<vil_image_view<vil_rgb<vxl_byte> > >& coarse)
+{
+	if ((imt != Source0) && (imt != Source1))
+		return false;
+
+	const vil_image_view<vil_rgb<vxl_byte> >& source = (imt == Source0) ? source0_ : source1_;
+	int ni = source.ni();
+	int nj = source.nj();
+	for (unsigned int k=0; k<coarse.size(); k++) {
+		ni = (ni + 1)/2;
+		nj = (nj + 1)/2;
+		if ((coarse[k].ni() != (unsigned) ni) || (coarse[k].nj() != (unsigned) nj))
+			return false;
+	}
+
+	vcl_vector<vil_image_view<vxl_byte> >& seeds = (imt == Source0) ? source0_seeds_ : source1_seeds_;
+	seeds.clear();
+	for (unsigned int k=0; k<coarse.size(); k++)
+		seeds.push_back(vil_view_as_planes(coarse[k]));
+
+	// forget the image the pyramid was built from, so that it is 
+	// rebuilt with the seeds
+	((imt == Source0) ? source0_key_ : source1_key_) = vil_image_view<vil_rgb<vxl_byte> >();
+	partial_ = false;
+	outdated_ = true;
+	display_images();
+	return true;
+}
+
 bool blending::set(im_type imt, vil_image_view<vxl_byte> im)
 {
 	if (imt == Mask)
 		if (check_and_set_input(im, mask_)) {
-			if (mask_pyr_)
-				delete mask_pyr_;
-			mask_pyr_ = new pyramid(im);
-			N_ = mask_pyr_ -> N();
+			// the pyramid of the mask is only built when it is 
+			// displayed at a level above 0 or saved
+			partial_ = false;
+			mask_owned_ = false;
+			mask_pyr_valid_ = false;
+			dirty_.clear();
+			N_ = pyramid::levels(ni_, nj_);
 			set_view_mode(Mask);
 			view_level_ = 0;
 			view_gauss_ = true;
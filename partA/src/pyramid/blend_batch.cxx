@@ -0,0 +1,217 @@
+#include "blend_batch.h"
+
+#include "pyramid.h"
+#include "../file/load_image.h"
+#include "../thread/parallel.h"
+#include "../thread/thread.h"
+
+#include <vcl_deque.h>
+#include <vcl_algorithm.h>
+
+bool read_manifest(const char* fname, int n, const char* usage,
+                   vcl_vector<vcl_vector<vcl_string> >& lines)
+{
+	vcl_ifstream in(fname);
+	vcl_string line;
+	int count = 0;
+
+	if (!in)
+		return false;
+
+	lines.clear();
+	while (vcl_getline(in, line)) {
+		count++;
+		vcl_istringstream fields(line);
+		vcl_vector<vcl_string> values(n);
+		vcl_string extra;
+
+		// skip empty lines and comments
+		if (!(fields >> values[0]) || (values[0][0] == '#'))
+			continue;
+		int k = 1;
+		while ((k < n) && (fields >> values[k]))
+			k++;
+		if ((k < n) || (fields >> extra)) {
+			vcl_cerr << fname << ":" << count << ": expected " << usage << vcl_endl;
+			return false;
+		}
+		lines.push_back(values);
+	}
+
+	return true;
+}
+
+bool read_blend_manifest(const char* fname, vcl_vector<blend_job>& jobs)
+{
+	vcl_vector<vcl_vector<vcl_string> > lines;
+
+	if (read_manifest(fname, 4, "source0 source1 mask result", lines) == false)
+		return false;
+
+	jobs.resize(lines.size());
+	for (unsigned int k=0; k<lines.size(); k++) {
+		jobs[k].source0 = lines[k][0];
+		jobs[k].source1 = lines[k][1];
+		jobs[k].mask = lines[k][2];
+		jobs[k].result = lines[k][3];
+	}
+
+	return true;
+}
+
+// A job whose input images have been decoded
+struct decoded_job {
+	int index;
+	vil_image_view<vil_rgb<vxl_byte> > source0;
+	vil_image_view<vil_rgb<vxl_byte> > source1;
+	vil_image_view<vxl_byte> mask;
+	// the wall time of the decoding, in milliseconds
+	long decode_ms;
+};
+
+// The state shared by the decoding thread and the workers
+struct batch_state {
+	const vcl_vector<blend_job>* jobs;
+	vcl_ostream* log;
+
+	// the decoded jobs waiting for a worker, and the largest number
+	// of such jobs. The jobs are handed over by pointer, so the 
+	// (unsynchronized) reference counts of their images are only 
+	// ever updated by one thread
+	vcl_deque<decoded_job*> queue;
+	unsigned int capacity;
+	// true when all the jobs have been decoded
+	bool decoded;
+	int failed;
+
+	// the mutex protects all the fields above except jobs; it also
+	// serializes the writes to log
+	thread_mutex mutex;
+	thread_cond not_empty;
+	thread_cond not_full;
+};
+
+// Decode the input images of all the jobs in order
+static void* decode_jobs(void* arg)
+{
+	batch_state* s = (batch_state*) arg;
+
+	for (unsigned int k=0; k<s->jobs->size(); k++) {
+		const blend_job& job = (*s->jobs)[k];
+		decoded_job* d = new decoded_job;
+		vul_timer timer;
+
+		d->index = k;
+		d->source0 = load_image(job.source0);
+		d->source1 = load_image(job.source1);
+		d->mask = load_image1(job.mask);
+		d->decode_ms = timer.real();
+
+		thread_mutex_lock(&s->mutex);
+		while (s->queue.size() >= s->capacity)
+			thread_cond_wait(&s->not_full, &s->mutex);
+		s->queue.push_back(d);
+		thread_cond_signal(&s->not_empty);
+		thread_mutex_unlock(&s->mutex);
+	}
+
+	thread_mutex_lock(&s->mutex);
+	s->decoded = true;
+	thread_cond_broadcast(&s->not_empty);
+	thread_mutex_unlock(&s->mutex);
+
+	return 0;
+}
+
+// Blend the images of a job and save the result. Every job has its
+// own instance of the blending class, exactly as a process started
+// with -bsource0, -bsource1, -bmask and -bblend would
+static bool run_job(const blend_job& job, const decoded_job& d)
+{
+	blending B;
+
+	return (B.set(B.Source0, d.source0) &&
+	        B.set(B.Source1, d.source1) &&
+	        B.set(B.Mask, d.mask) &&
+	        B.compute() &&
+	        B.save_blended(job.result.c_str()));
+}
+
+// The body of a worker: blend decoded jobs until there are none left
+static void run_jobs(void* arg)
+{
+	batch_state* s = (batch_state*) arg;
+
+	for (;;) {
+		thread_mutex_lock(&s->mutex);
+		while (s->queue.empty() && (!s->decoded))
+			thread_cond_wait(&s->not_empty, &s->mutex);
+		if (s->queue.empty()) {
+			thread_mutex_unlock(&s->mutex);
+			return;
+		}
+		decoded_job* d = s->queue.front();
+		s->queue.pop_front();
+		thread_cond_signal(&s->not_full);
+		thread_mutex_unlock(&s->mutex);
+
+		const blend_job& job = (*s->jobs)[d->index];
+		vul_timer timer;
+		bool ok = run_job(job, *d);
+		long blend_ms = timer.real();
+		int index = d->index;
+		long decode_ms = d->decode_ms;
+		delete d;
+
+		thread_mutex_lock(&s->mutex);
+		*s->log << "blend_batch(): job " << index+1 << "/" << s->jobs->size()
+		        << " (" << job.result << "): decode " << decode_ms
+		        << " ms, blend " << blend_ms << " ms";
+		if (!ok) {
+			*s->log << " -- failed";
+			s->failed++;
+		}
+		*s->log << vcl_endl;
+		thread_mutex_unlock(&s->mutex);
+	}
+}
+
+int blend_batch(const vcl_vector<blend_job>& jobs, int workers, vcl_ostream& log)
+{
+	batch_state s;
+	thread_id decoder;
+	vul_timer timer;
+
+	workers = vcl_max(1, vcl_min(workers, parallel_threads()));
+
+	s.jobs = &jobs;
+	s.log = &log;
+	s.capacity = workers;
+	s.decoded = false;
+	s.failed = 0;
+	thread_mutex_init(&s.mutex);
+	thread_cond_init(&s.not_empty);
+	thread_cond_init(&s.not_full);
+
+	bool started = thread_create(&decoder, decode_jobs, &s);
+	if (!started) {
+		// without a decoding thread, all the jobs are decoded first
+		s.capacity = jobs.size() + 1;
+		decode_jobs(&s);
+	}
+
+	// each worker has its share of the thread budget for the pyramid
+	// routines
+	parallel_run(workers, run_jobs, &s);
+
+	if (started)
+		thread_join(decoder);
+	thread_cond_destroy(&s.not_full);
+	thread_cond_destroy(&s.not_empty);
+	thread_mutex_destroy(&s.mutex);
+
+	log << "blend_batch(): " << jobs.size() << " jobs (" << s.failed << " failed) in "
+	    << timer.real() << " ms" << vcl_endl;
+
+	return s.failed;
+}
@@ -0,0 +1,54 @@
+#ifndef _blend_batch_h
+#define _blend_batch_h
+
+#include "../vxl_includes.h"
+
+#include <vcl_vector.h>
+
+//
+// Blending many image sets in a single process
+//
+// A manifest lists one blending job per line, as the filenames of
+// Source0, Source1 and the Mask followed by the base filename of the
+// blended image, which is saved as <base>.jpg (as with -bblend):
+//
+//     beach0.jpg beach1.jpg beach_mask.pgm beach_blended
+//
+// Empty lines and lines starting with '#' are ignored.
+//
+// blend_batch() runs the jobs on a pool of worker threads that share
+// the thread budget set by set_parallel_threads() (see
+// thread/parallel.h), so there are at most as many workers as
+// threads. The input images are decoded in order by a separate
+// thread, which stays at most one job ahead of each worker: the
+// decoding of the next jobs overlaps with the blending of the
+// current ones, and the number of decoded images held in memory
+// is bounded by the number of workers
+//
+
+struct blend_job {
+	vcl_string source0;
+	vcl_string source1;
+	vcl_string mask;
+	// the base filename of the result
+	vcl_string result;
+};
+
+// Read a manifest file holding n blank-separated fields per line
+// into lines, ignoring empty lines and lines starting with '#' (as
+// all the manifests of the blending code do). The routine returns
+// false if the file cannot be read or if a line does not hold n
+// fields, reporting the line and the expected fields (usage)
+bool read_manifest(const char* fname, int n, const char* usage,
+                   vcl_vector<vcl_vector<vcl_string> >& lines);
+
+// Read the jobs listed in a manifest file. The routine returns false
+// if the file cannot be read or if a line does not hold 4 filenames
+bool read_blend_manifest(const char* fname, vcl_vector<blend_job>& jobs);
+
+// Run the jobs on the given number of workers. The decode and blend
+// wall times of every job are written to log as the jobs complete.
+// The routine returns the number of jobs that failed
+int blend_batch(const vcl_vector<blend_job>& jobs, int workers, vcl_ostream& log);
+
+#endif
@@ -0,0 +1,498 @@
+#include "blend_video.h"
+
+#include "pyramid.h"
+#include "../file/load_image.h"
+#include "../thread/thread.h"
+
+#include <core/vil/vil_plane.h>
+#include <vcl_deque.h>
+#include <vcl_cstdio.h>
+#include <vcl_cstring.h>
+
+//
+// Frame sequences
+//
+
+// A sequence of numbered image files or a Y4M stream
+struct frame_sequence {
+	// the printf pattern of the filenames, or the name of the stream
+	vcl_string name;
+	bool y4m;
+	// the stream, for Y4M sequences
+	vcl_FILE* file;
+	// the header line of the stream (without the newline)
+	vcl_string header;
+	// the dimensions of the luma plane and of the chroma planes of
+	// Y4M frames; cni and cnj are 0 if the frames are monochrome
+	int ni, nj, cni, cnj;
+	// the number of the next frame, for numbered files
+	int next;
+};
+
+static bool is_y4m(const char* name)
+{
+	int n = vcl_strlen(name);
+
+	return (n > 4) && (vcl_strcmp(name + n-4, ".y4m") == 0);
+}
+
+// Read a line of a Y4M stream, without the newline. The routine
+// returns false at the end of the stream
+static bool read_line(vcl_FILE* f, vcl_string& line)
+{
+	int c;
+
+	line.clear();
+	while (((c = vcl_fgetc(f)) != EOF) && (c != '\n'))
+		line += (char) c;
+	return (c != EOF) || (!line.empty());
+}
+
+// Parse the header of a Y4M stream: the dimensions of the frames
+// and their colour space, which determines the dimensions of the
+// chroma planes
+static bool parse_y4m_header(frame_sequence& s)
+{
+	vcl_istringstream fields(s.header);
+	vcl_string field, colour = "420jpeg";
+
+	s.ni = s.nj = 0;
+	if (!(fields >> field) || (field != "YUV4MPEG2"))
+		return false;
+	while (fields >> field)
+		switch (field[0]) {
+		case 'W':
+			s.ni = vcl_atoi(field.c_str() + 1);
+			break;
+		case 'H':
+			s.nj = vcl_atoi(field.c_str() + 1);
+			break;
+		case 'C':
+			colour = field.substr(1);
+			break;
+		}
+
+	if ((s.ni <= 0) || (s.nj <= 0))
+		return false;
+	if (colour.compare(0, 3, "420") == 0 &&
+		((colour == "420") || (colour == "420jpeg") ||
+		 (colour == "420paldv") || (colour == "420mpeg2"))) {
+		s.cni = (s.ni + 1)/2;
+		s.cnj = (s.nj + 1)/2;
+	} else if (colour == "444") {
+		s.cni = s.ni;
+		s.cnj = s.nj;
+	} else if (colour == "mono")
+		s.cni = s.cnj = 0;
+	else {
+		vcl_cerr << s.name << ": unsupported Y4M colour space " << colour << vcl_endl;
+		return false;
+	}
+
+	return true;
+}
+
+static bool open_sequence(const char* name, int first, frame_sequence& s)
+{
+	s.name = name;
+	s.y4m = is_y4m(name);
+	s.file = 0;
+	s.next = first;
+	if (!s.y4m)
+		return true;
+
+	s.file = vcl_fopen(name, "rb");
+	if (s.file == 0)
+		return false;
+	return read_line(s.file, s.header) && parse_y4m_header(s);
+}
+
+// Create a sequence of the type of sequence like; Y4M streams are
+// given the header of like
+static bool create_sequence(const char* name, const frame_sequence& like, frame_sequence& s)
+{
+	s = like;
+	s.name = name;
+	s.file = 0;
+	if (!s.y4m)
+		return true;
+
+	s.file = vcl_fopen(name, "wb");
+	return (s.file != 0) && (vcl_fprintf(s.file, "%s\n", s.header.c_str()) > 0);
+}
+
+static void close_sequence(frame_sequence& s)
+{
+	if (s.file)
+		vcl_fclose(s.file);
+	s.file = 0;
+}
+
+static vcl_string frame_name(const frame_sequence& s)
+{
+	char name[1024];
+
+	snprintf(name, sizeof(name), s.name.c_str(), s.next);
+	return name;
+}
+
+// Read the next frame of a sequence: the image of a numbered file in
+// planes[0], or the luma and chroma planes of a Y4M frame in planes[0]
+// and planes[1]. The planes of Y4M frames are read into the images
+// if they already have the dimensions of the frames. The routine
+// returns 1 if a frame was read, 0 at the end of the sequence and
+// -1 if the frame cannot be read
+static int read_frame(frame_sequence& s, vil_image_view<vxl_byte>* planes)
+{
+	if (!s.y4m) {
+		vcl_string name = frame_name(s);
+		vcl_FILE* f = vcl_fopen(name.c_str(), "rb");
+		if (f == 0)
+			return 0;
+		vcl_fclose(f);
+		planes[0] = vil_view_as_planes(load_image(name));
+		s.next++;
+		return ((planes[0].ni() > 0) && (planes[0].nj() > 0)) ? 1 : -1;
+	}
+
+	vcl_string line;
+	if (read_line(s.file, line) == false)
+		return 0;
+	if (line.compare(0, 5, "FRAME") != 0)
+		return -1;
+
+	// set_size() keeps the buffers of the previous frames
+	planes[0].set_size(s.ni, s.nj, 1);
+	if (vcl_fread(planes[0].top_left_ptr(), (vcl_size_t) s.ni*s.nj, 1, s.file) != 1)
+		return -1;
+	if (s.cni > 0) {
+		planes[1].set_size(s.cni, s.cnj, 2);
+		if (vcl_fread(planes[1].top_left_ptr(), (vcl_size_t) 2*s.cni*s.cnj, 1, s.file) != 1)
+			return -1;
+	}
+	s.next++;
+
+	return 1;
+}
+
+// Write the next frame of a sequence. The planes of Y4M frames must
+// be contiguous (as the images allocated by read_frame() and
+// frame_blender::blend() are)
+static bool write_frame(frame_sequence& s, const vil_image_view<vxl_byte>* planes)
+{
+	if (!s.y4m) {
+		vcl_string name = frame_name(s);
+		s.next++;
+		return vil_save(planes[0], name.c_str());
+	}
+
+	s.next++;
+	if ((vcl_fprintf(s.file, "FRAME\n") < 0) ||
+		(vcl_fwrite(planes[0].top_left_ptr(), (vcl_size_t) s.ni*s.nj, 1, s.file) != 1))
+		return false;
+	return (s.cni == 0) ||
+		(vcl_fwrite(planes[1].top_left_ptr(), (vcl_size_t) 2*s.cni*s.cnj, 1, s.file) == 1);
+}
+
+//
+// The pipeline
+//
+
+// A frame going through the pipeline: the planes of the two sources
+// and of the result (see read_frame())
+struct video_frame {
+	vil_image_view<vxl_byte> source0[2];
+	vil_image_view<vxl_byte> source1[2];
+	vil_image_view<vxl_byte> result[2];
+};
+
+// The number of frames in the pipeline: one being decoded, one being
+// blended and one being encoded, and one more so that the decoding
+// can run ahead when the encoding of a frame is slower than usual
+static const int video_frames = 4;
+
+// A queue of frames between two stages of the pipeline
+struct frame_queue {
+	vcl_deque<video_frame*> frames;
+	// true when no more frames will be added
+	bool closed;
+	thread_cond ready;
+};
+
+// The state shared by the three stages
+struct video_state {
+	frame_sequence source0, source1, result;
+
+	// the free frames, the decoded frames and the blended frames
+	frame_queue free, decoded, blended;
+	// true if a stage has failed, in which case the frames still go
+	// through the pipeline but are neither blended nor encoded
+	bool failed;
+
+	// the number of frames, the total time of each stage, and the
+	// times at which the first and the last frames were encoded, in
+	// milliseconds since the pipeline was started
+	int frames;
+	long decode_ms, blend_ms, encode_ms;
+	long first_ms, last_ms;
+	vul_timer timer;
+
+	// the mutex protects the queues, failed and the statistics above
+	thread_mutex mutex;
+};
+
+static void push_frame(video_state* s, frame_queue& q, video_frame* f)
+{
+	thread_mutex_lock(&s->mutex);
+	q.frames.push_back(f);
+	thread_cond_signal(&q.ready);
+	thread_mutex_unlock(&s->mutex);
+}
+
+// Remove the next frame of a queue, waiting for one if necessary. The
+// routine returns 0 if the queue is closed and empty
+static video_frame* pop_frame(video_state* s, frame_queue& q)
+{
+	video_frame* f = 0;
+
+	thread_mutex_lock(&s->mutex);
+	while (q.frames.empty() && (!q.closed))
+		thread_cond_wait(&q.ready, &s->mutex);
+	if (!q.frames.empty()) {
+		f = q.frames.front();
+		q.frames.pop_front();
+	}
+	thread_mutex_unlock(&s->mutex);
+
+	return f;
+}
+
+static void close_queue(video_state* s, frame_queue& q)
+{
+	thread_mutex_lock(&s->mutex);
+	q.closed = true;
+	thread_cond_broadcast(&q.ready);
+	thread_mutex_unlock(&s->mutex);
+}
+
+static void fail(video_state* s, const char* msg)
+{
+	thread_mutex_lock(&s->mutex);
+	if (!s->failed)
+		vcl_cerr << "blend_video(): " << msg << vcl_endl;
+	s->failed = true;
+	thread_mutex_unlock(&s->mutex);
+}
+
+static bool has_failed(video_state* s)
+{
+	thread_mutex_lock(&s->mutex);
+	bool failed = s->failed;
+	thread_mutex_unlock(&s->mutex);
+
+	return failed;
+}
+
+// Decode the next frame of the two sequences into f. The routine
+// returns false at the end of either sequence or if a frame cannot
+// be read
+static bool decode_frame(video_state* s, video_frame* f)
+{
+	vul_timer timer;
+	int read0 = read_frame(s->source0, f->source0);
+	int read1 = (read0 > 0) ? read_frame(s->source1, f->source1) : 0;
+	long ms = timer.real();
+
+	if ((read0 < 0) || (read1 < 0))
+		fail(s, "error reading a frame");
+	if ((read0 <= 0) || (read1 <= 0) || has_failed(s))
+		return false;
+
+	thread_mutex_lock(&s->mutex);
+	s->decode_ms += ms;
+	thread_mutex_unlock(&s->mutex);
+
+	return true;
+}
+
+static void blend_frame(video_state* s, frame_blender& luma, frame_blender& chroma,
+                        video_frame* f)
+{
+	if (has_failed(s))
+		return;
+
+	vul_timer timer;
+	bool ok = luma.blend(f->source0[0], f->source1[0], f->result[0]) &&
+		((s->source0.cni == 0) || chroma.blend(f->source0[1], f->source1[1], f->result[1]));
+	long ms = timer.real();
+
+	if (!ok)
+		fail(s, "the frames do not have the dimensions of the mask");
+	thread_mutex_lock(&s->mutex);
+	s->blend_ms += ms;
+	thread_mutex_unlock(&s->mutex);
+}
+
+static void encode_frame(video_state* s, video_frame* f)
+{
+	if (has_failed(s))
+		return;
+
+	vul_timer timer;
+	if (write_frame(s->result, f->result) == false)
+		fail(s, "error writing a frame");
+	long ms = timer.real();
+
+	thread_mutex_lock(&s->mutex);
+	s->encode_ms += ms;
+	if (s->frames == 0)
+		s->first_ms = s->timer.real();
+	s->last_ms = s->timer.real();
+	s->frames++;
+	thread_mutex_unlock(&s->mutex);
+}
+
+// The decoding thread: decode frames into the free frames until the
+// end of the sequences
+static void* decode_frames(void* arg)
+{
+	video_state* s = (video_state*) arg;
+	video_frame* f;
+
+	while (((f = pop_frame(s, s->free)) != 0) && decode_frame(s, f))
+		push_frame(s, s->decoded, f);
+	close_queue(s, s->decoded);
+
+	return 0;
+}
+
+// The encoding thread: encode the blended frames and return them to
+// the free frames
+static void* encode_frames(void* arg)
+{
+	video_state* s = (video_state*) arg;
+	video_frame* f;
+
+	while ((f = pop_frame(s, s->blended)) != 0) {
+		encode_frame(s, f);
+		push_frame(s, s->free, f);
+	}
+
+	return 0;
+}
+
+bool blend_video(const char* source0, const char* source1,
+                 const vil_image_view<vxl_byte>& mask,
+                 const char* result, int first, vcl_ostream& log)
+{
+	video_state s;
+	frame_blender luma, chroma;
+	video_frame frames[video_frames];
+
+	s.source0.file = s.source1.file = s.result.file = 0;
+	if ((open_sequence(source0, first, s.source0) == false) ||
+		(open_sequence(source1, first, s.source1) == false)) {
+		vcl_cerr << "blend_video(): error opening the sequences" << vcl_endl;
+		close_sequence(s.source0);
+		close_sequence(s.source1);
+		return false;
+	}
+	if ((s.source0.y4m != s.source1.y4m) ||
+		(s.source0.y4m && ((s.source0.ni != s.source1.ni) || (s.source0.nj != s.source1.nj) ||
+		                   (s.source0.cni != s.source1.cni) || (s.source0.cnj != s.source1.cnj))) ||
+		(create_sequence(result, s.source0, s.result) == false)) {
+		vcl_cerr << "blend_video(): the sequences do not match, or the result "
+		         << "cannot be written" << vcl_endl;
+		close_sequence(s.source0);
+		close_sequence(s.source1);
+		return false;
+	}
+
+	// the pyramids of the mask; the chroma planes of 4:2:0 frames are
+	// blended with the mask reduced to their dimensions, ie. with
+	// level 1 of the Gauss pyramid of the mask
+	bool ok = luma.set_mask(mask);
+	if (ok && (s.source0.cni > 0)) {
+		vil_image_view<vxl_byte> mask_c = vil_plane(mask, 0);
+		if (s.source0.cni < s.source0.ni) {
+			double w_hat_data[5];
+			double* w_hat = w_hat_data + 2;
+			pyramid::kernel(0.4, w_hat);
+			vil_image_view<vxl_byte> mask_up;
+			pyramid::reduce_level(mask_c, w_hat, mask_up);
+			mask_c = mask_up;
+		}
+		ok = chroma.set_mask(mask_c);
+	}
+
+	s.failed = !ok;
+	s.frames = 0;
+	s.decode_ms = s.blend_ms = s.encode_ms = 0;
+	s.first_ms = s.last_ms = 0;
+	s.free.closed = s.decoded.closed = s.blended.closed = false;
+	thread_mutex_init(&s.mutex);
+	thread_cond_init(&s.free.ready);
+	thread_cond_init(&s.decoded.ready);
+	thread_cond_init(&s.blended.ready);
+	for (int k=0; k<video_frames; k++)
+		s.free.frames.push_back(&frames[k]);
+	s.timer.mark();
+
+	// the frames are decoded and encoded by two threads while the
+	// calling thread blends them (with the thread budget of the 
+	// pyramid routines). Without these threads, the stages run one
+	// after the other, for one frame at a time
+	thread_id decoder, encoder;
+	bool encoding = thread_create(&encoder, encode_frames, &s);
+	bool decoding = encoding && thread_create(&decoder, decode_frames, &s);
+
+	for (;;) {
+		video_frame* f;
+		if (decoding)
+			f = pop_frame(&s, s.decoded);
+		else if (decode_frame(&s, f = pop_frame(&s, s.free)) == false) {
+			push_frame(&s, s.free, f);
+			f = 0;
+		}
+		if (f == 0)
+			break;
+
+		blend_frame(&s, luma, chroma, f);
+		if (encoding)
+			push_frame(&s, s.blended, f);
+		else {
+			encode_frame(&s, f);
+			push_frame(&s, s.free, f);
+		}
+	}
+
+	// the decoder has closed the queue of decoded frames, so it has
+	// finished
+	if (decoding)
+		thread_join(decoder);
+	if (encoding) {
+		close_queue(&s, s.blended);
+		thread_join(encoder);
+	}
+	thread_cond_destroy(&s.blended.ready);
+	thread_cond_destroy(&s.decoded.ready);
+	thread_cond_destroy(&s.free.ready);
+	thread_mutex_destroy(&s.mutex);
+	close_sequence(s.source0);
+	close_sequence(s.source1);
+	close_sequence(s.result);
+
+	long total_ms = s.timer.real();
+	log << "blend_video(): " << s.frames << " frames in " << total_ms << " ms";
+	if (s.frames > 0)
+		log << " (decode " << s.decode_ms/s.frames << " ms, blend "
+		    << s.blend_ms/s.frames << " ms, encode " << s.encode_ms/s.frames
+		    << " ms per frame)";
+	log << vcl_endl;
+	if (s.frames > 1)
+		log << "blend_video(): "
+		    << 1000.0*(s.frames-1)/vcl_max(1L, s.last_ms - s.first_ms)
+		    << " frames/s in the steady state" << vcl_endl;
+
+	return (!s.failed);
+}
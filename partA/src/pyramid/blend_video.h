@@ -0,0 +1,87 @@
+#ifndef _blend_video_h
+#define _blend_video_h
+
+#include "../vxl_includes.h"
+
+#include <vcl_vector.h>
+
+//
+// Blending two frame sequences with a fixed mask
+//
+// The frame_blender class blends pairs of frames of identical
+// dimensions exactly like blend(), but the Gauss pyramid of the mask
+// is built once, when the mask is set, and the Gauss levels of the
+// sources and of the result are kept from one frame to the next, so
+// that no level is reallocated as long as the dimensions and the
+// number of planes of the frames do not change
+//
+// blend_video() blends two sequences of frames, which are either
+// numbered image files, given as a printf pattern such as
+// frame%04d.png, or YUV4MPEG2 (.y4m) streams with 8-bit 4:2:0, 4:4:4
+// or monochrome samples. The luma and chroma planes of Y4M frames are
+// blended without being converted to RGB; the chroma planes of 4:2:0
+// frames are blended with the mask reduced to their dimensions (ie.
+// with levels 1,...,N of the Gauss pyramid of the mask). The result
+// is written in the format of the first sequence: numbered files
+// (in the format given by the extension of the pattern) or a Y4M
+// stream with the header of source0. The sequences end with the first
+// frame missing from either of them
+//
+// The decoding, blending and encoding of the frames are pipelined:
+// a thread decodes the next frames while the current frame is blended
+// and another thread encodes the previous ones. The frames go through
+// a fixed set of buffers, which Y4M frames are read into and the
+// results are written to, so the pipeline does not allocate memory
+// in the steady state
+//
+
+class frame_blender {
+	// the number of levels of the pyramids
+	int N_;
+	// the kernel of the pyramids; w_hat_ points to the center of
+	// w_hat_data_
+	double* w_hat_;
+	double w_hat_data_[5];
+	// the N+1 levels of the Gauss pyramid of the mask
+	vcl_vector<vil_image_view<vxl_byte> > gR_;
+	// levels 1,...,N of the Gauss pyramids of the two sources and of
+	// the result (level 0 only holds views of the frames while they
+	// are blended)
+	vcl_vector<vil_image_view<vxl_byte> > gA_;
+	vcl_vector<vil_image_view<vxl_byte> > gB_;
+	vcl_vector<vil_image_view<vxl_byte> > gS_;
+
+	// the levels refer to each other, so blenders cannot be copied
+	frame_blender(const frame_blender&);
+	frame_blender& operator=(const frame_blender&);
+public:
+	frame_blender();
+
+	// Build the Gauss pyramid of the mask (only its first plane is
+	// used) with the kernel's a-parameter. The mask is copied, so the
+	// image can be modified afterwards. The routine returns false if
+	// the mask is empty
+	bool set_mask(const vil_image_view<vxl_byte>& mask, double a = 0.4);
+
+	// Blend two frames with the dimensions of the mask. result is
+	// only reallocated if it does not already have the dimensions
+	// and the number of planes of the frames, so it can be a buffer
+	// reused from one frame to the next. The routine returns false if
+	// no mask has been set or if the dimensions do not agree
+	bool blend(const vil_image_view<vxl_byte>& source0,
+	           const vil_image_view<vxl_byte>& source1,
+	           vil_image_view<vxl_byte>& result);
+};
+
+// Blend the frames first, first+1,... of the sequences source0 and
+// source1 (the first frame of a Y4M stream is always its frame 0) with
+// the mask and write them to the sequence result. The frame rate of
+// each stage of the pipeline, and that of the whole pipeline in the
+// steady state (ie. after the first frame), are written to log. The
+// routine returns false if the sequences cannot be read or written,
+// or if their frames do not have the dimensions of the mask
+bool blend_video(const char* source0, const char* source1,
+                 const vil_image_view<vxl_byte>& mask,
+                 const char* result, int first, vcl_ostream& log);
+
+#endif
@@ -0,0 +1,247 @@
+#include "fuse.h"
+
+#include "pyramid.h"
+#include "blend_batch.h"
+#include "../file/load_image.h"
+#include "../thread/parallel.h"
+
+#include <core/vil/vil_plane.h>
+#include <vcl_algorithm.h>
+
+bool read_fuse_manifest(const char* fname, vcl_vector<fuse_input>& inputs)
+{
+	vcl_vector<vcl_vector<vcl_string> > lines;
+
+	if (read_manifest(fname, 2, "image weight", lines) == false)
+		return false;
+
+	inputs.resize(lines.size());
+	for (unsigned int k=0; k<lines.size(); k++) {
+		inputs[k].image = lines[k][0];
+		inputs[k].weight = lines[k][1];
+	}
+
+	return true;
+}
+
+// Store source k (image=true) or its weight map (image=false) in im.
+// The routine returns false if the image cannot be loaded
+typedef bool (*fuse_loader)(int k, bool image, vil_image_view<vxl_byte>& im, void* arg);
+
+// Add level l of a source, weighted by level l of its weight map w,
+// to level l of the fused pyramid F. r holds the reciprocals of the
+// sums of the weights at level l, or 0 where all the weights are 0
+template <class T>
+struct fuse_job {
+	const vil_image_view<T>* L;
+	const vil_image_view<vxl_byte>* w;
+	const vil_image_view<float>* r;
+	vil_image_view<float>* F;
+	// the weight of every source where all the weights are 0
+	float uniform;
+};
+
+template <class T>
+static void fuse_band(int j0, int j1, void* arg)
+{
+	fuse_job<T>* job = (fuse_job<T>*) arg;
+	const vil_image_view<T>& L = *job->L;
+	const vil_image_view<vxl_byte>& w = *job->w;
+	const vil_image_view<float>& r = *job->r;
+	vil_image_view<float>& F = *job->F;
+	int ni = L.ni();
+	// the normalized weights of a row
+	vcl_vector<float> weight(ni);
+
+	for (int j=j0; j<j1; j++) {
+		const vxl_byte* wrow = w.top_left_ptr() + j*w.jstep();
+		const float* rrow = r.top_left_ptr() + j*r.jstep();
+		for (int i=0; i<ni; i++) {
+			float ri = rrow[i*r.istep()];
+			weight[i] = (ri > 0) ? wrow[i*w.istep()]*ri : job->uniform;
+		}
+
+		for (unsigned p=0; p<L.nplanes(); p++) {
+			const T* in = L.top_left_ptr() + p*L.planestep() + j*L.jstep();
+			float* out = F.top_left_ptr() + p*F.planestep() + j*F.jstep();
+			for (int i=0; i<ni; i++)
+				out[i*F.istep()] += weight[i]*in[i*L.istep()];
+		}
+	}
+}
+
+template <class T>
+static void fuse_add(const vil_image_view<T>& L, const vil_image_view<vxl_byte>& w,
+                     const vil_image_view<float>& r, float uniform,
+                     vil_image_view<float>& F)
+{
+	fuse_job<T> job = {&L, &w, &r, &F, uniform};
+	parallel_for(L.nj(), fuse_band<T>, &job);
+}
+
+// Replace level g of a Gauss pyramid by the level above it
+static void fuse_reduce(vil_image_view<vxl_byte>& g, const double* w_hat)
+{
+	vil_image_view<vxl_byte> g_up;
+
+	pyramid::reduce_level(g, w_hat, g_up);
+	g = g_up;
+}
+
+// Fuse n sources supplied by load(). The sums of the weights are
+// computed first, with one weight map in memory at a time, and the
+// sources are then added to the fused pyramid one at a time
+static bool fuse(int n, fuse_loader load, void* arg, double a,
+                 vil_image_view<vxl_byte>& result)
+{
+	vil_image_view<vxl_byte> im, w, g, gw;
+	int ni, nj, np = 0, N, l, k;
+
+	if ((n <= 0) || (load(0, false, w, arg) == false))
+		return false;
+	ni = w.ni();
+	nj = w.nj();
+
+	// the number of levels is that of a pyramid built from the
+	// sources
+	N = pyramid::levels(ni, nj);
+
+	double w_hat_data[5];
+	double* w_hat = w_hat_data + 2;
+	pyramid::kernel(a, w_hat);
+
+	// the sums of the Gauss levels of the weight maps, replaced by
+	// their reciprocals once all the weight maps have been added
+	vcl_vector<vil_image_view<float> > r(N+1);
+	for (k=0; k<n; k++) {
+		if ((k > 0) && (load(k, false, w, arg) == false))
+			return false;
+		if ((w.ni() != ni) || (w.nj() != nj) || (w.nplanes() == 0))
+			return false;
+
+		gw = vil_plane(w, 0);
+		for (l=0; l<=N; l++) {
+			if (k == 0) {
+				r[l].set_size(gw.ni(), gw.nj());
+				r[l].fill(0);
+			}
+			for (int j=0; j<gw.nj(); j++)
+				for (int i=0; i<gw.ni(); i++)
+					r[l](i,j) += gw(i,j);
+			if (l < N)
+				fuse_reduce(gw, w_hat);
+		}
+	}
+	for (l=0; l<=N; l++)
+		for (int j=0; j<r[l].nj(); j++)
+			for (int i=0; i<r[l].ni(); i++)
+				if (r[l](i,j) > 0)
+					r[l](i,j) = 1/r[l](i,j);
+
+	// add the Laplacian levels of the sources, and their top Gauss
+	// levels, to the fused pyramid
+	vcl_vector<vil_image_view<float> > F(N+1);
+	vil_image_view<vxl_int_16> L;
+	float uniform = 1.0f/n;
+	for (k=0; k<n; k++) {
+		if ((load(k, true, im, arg) == false) || (load(k, false, w, arg) == false))
+			return false;
+		if (k == 0)
+			np = im.nplanes();
+		if ((im.ni() != ni) || (im.nj() != nj) || (im.nplanes() != np) ||
+			(np == 0) || (w.ni() != ni) || (w.nj() != nj) || (w.nplanes() == 0))
+			return false;
+
+		g = im;
+		gw = vil_plane(w, 0);
+		// the source is no longer needed once level 0 is reduced
+		im = vil_image_view<vxl_byte>();
+		w = vil_image_view<vxl_byte>();
+		for (l=0; l<=N; l++) {
+			if (k == 0) {
+				F[l].set_size(g.ni(), g.nj(), np);
+				F[l].fill(0);
+			}
+			if (l == N) {
+				fuse_add(g, gw, r[l], uniform, F[l]);
+				break;
+			}
+			vil_image_view<vxl_byte> g_up;
+			pyramid::reduce_level(g, w_hat, g_up);
+			L.set_size(g.ni(), g.nj(), np);
+			pyramid::laplacian(g, g_up, w_hat, L);
+			fuse_add(L, gw, r[l], uniform, F[l]);
+			g = g_up;
+			fuse_reduce(gw, w_hat);
+		}
+	}
+	L = vil_image_view<vxl_int_16>();
+	r.clear();
+
+	// collapse the fused pyramid, releasing each level once it has
+	// been used. g may still be a view of the last source, so the top
+	// level is rounded into a new image
+	g = vil_image_view<vxl_byte>(F[N].ni(), F[N].nj(), np);
+	for (unsigned p=0; p<(unsigned) np; p++)
+		for (int j=0; j<g.nj(); j++)
+			for (int i=0; i<g.ni(); i++) {
+				int value = (int) vcl_floor(F[N](i,j,p) + 0.5f);
+				g(i,j,p) = (vxl_byte) vcl_min(vcl_max(value, 0), 255);
+			}
+	for (l=N-1; l>=0; l--) {
+		vil_image_view<vxl_byte> g_down;
+		basic_pyramid<float>::collapse(g, F[l], w_hat, g_down);
+		g = g_down;
+		F[l+1] = vil_image_view<float>();
+	}
+	result = g;
+
+	return true;
+}
+
+struct fuse_images {
+	const vcl_vector<vil_image_view<vxl_byte> >* images;
+	const vcl_vector<vil_image_view<vxl_byte> >* weights;
+};
+
+static bool load_fuse_image(int k, bool image, vil_image_view<vxl_byte>& im, void* arg)
+{
+	fuse_images* s = (fuse_images*) arg;
+
+	im = image ? (*s->images)[k] : (*s->weights)[k];
+	return true;
+}
+
+bool fuse(const vcl_vector<vil_image_view<vxl_byte> >& images,
+          const vcl_vector<vil_image_view<vxl_byte> >& weights,
+          vil_image_view<vxl_byte>& result, double a)
+{
+	fuse_images s = {&images, &weights};
+
+	if (images.size() != weights.size())
+		return false;
+
+	return fuse(images.size(), load_fuse_image, &s, a, result);
+}
+
+static bool load_fuse_file(int k, bool image, vil_image_view<vxl_byte>& im, void* arg)
+{
+	const vcl_vector<fuse_input>& inputs = *(const vcl_vector<fuse_input>*) arg;
+
+	if (image)
+		im = vil_view_as_planes(load_image(inputs[k].image));
+	else
+		im = load_image1(inputs[k].weight);
+	if ((im.ni() == 0) || (im.nj() == 0)) {
+		vcl_cerr << "fuse(): error reading "
+		         << (image ? inputs[k].image : inputs[k].weight) << vcl_endl;
+		return false;
+	}
+	return true;
+}
+
+bool fuse(const vcl_vector<fuse_input>& inputs,
+          vil_image_view<vxl_byte>& result, double a)
+{
+	return fuse(inputs.size(), load_fuse_file, (void*) &inputs, a, result);
+}
@@ -0,0 +1,66 @@
+#ifndef _fuse_h
+#define _fuse_h
+
+#include "../vxl_includes.h"
+
+#include <vcl_vector.h>
+
+//
+// N-way weighted fusion of images (eg. exposure or focus stacks)
+//
+// fuse() generalizes pyramid blending to N sources: every source k
+// comes with a weight map W_k, and level l of the fused Laplacian
+// pyramid is
+//
+//     L_l = sum_k g_l(W_k) L_l(I_k) / sum_k g_l(W_k)
+//
+// where g_l(W_k) is level l of the Gauss pyramid of W_k and L_l(I_k)
+// level l of the Laplacian pyramid of source k (the top level of the
+// pyramid averages the top Gauss levels of the sources the same way).
+// Pixels where all the weights are 0 average the sources equally.
+// The fused pyramid is then collapsed once. With two sources and the
+// weight maps 255-M and M, this is the blend of the two sources with
+// the mask M (up to rounding)
+//
+// The sources are streamed: the weighted Laplacian levels of each
+// source are added to the fused pyramid level by level as they are
+// computed, so only two Gauss levels and a Laplacian level of one
+// source are in memory at any time. Apart from the inputs, the
+// routines keep the fused pyramid (N+1 float levels) and the sums of
+// the weights (N+1 single-plane float levels), ie. about 5 floats per
+// pixel of an RGB image, however many sources are fused
+//
+
+// the filenames of a source and of its weight map
+struct fuse_input {
+	vcl_string image;
+	vcl_string weight;
+};
+
+// Read the sources listed in a manifest file, one per line as the
+// filenames of the image and of its weight map:
+//
+//     exposure0.jpg exposure0_weight.pgm
+//
+// Empty lines and lines starting with '#' are ignored. The routine
+// returns false if the file cannot be read or if a line does not hold
+// 2 filenames
+bool read_fuse_manifest(const char* fname, vcl_vector<fuse_input>& inputs);
+
+// Fuse images of identical dimensions and number of planes with
+// single-plane weight maps of the same dimensions (only the first
+// plane of a weight map is used). The routine returns false if there
+// are no images or if their dimensions do not agree
+bool fuse(const vcl_vector<vil_image_view<vxl_byte> >& images,
+          const vcl_vector<vil_image_view<vxl_byte> >& weights,
+          vil_image_view<vxl_byte>& result, double a = 0.4);
+
+// The same routine for images stored in files: every image is decoded
+// once and every weight map twice (the sums of the weights are needed
+// before the first source is added), so at most one source is in
+// memory at any time. The routine also returns false if a file cannot
+// be read
+bool fuse(const vcl_vector<fuse_input>& inputs,
+          vil_image_view<vxl_byte>& result, double a = 0.4);
+
+#endif
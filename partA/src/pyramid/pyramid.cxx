@@ -1,75 +1,316 @@
 // DO NOT MODIFY THIS FILE EXCEPT WHERE EXPLICITLY NOTED!!!
 
 #include "pyramid.h"
+#include "pyramid_kernels.h"
+
+#include <vcl_cstring.h>
+#include <vcl_cstdio.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 ////////////////////////////////////////////////////////////////
 //          The pyramid class constructor routines            //
 ////////////////////////////////////////////////////////////////
 
 
-pyramid::pyramid(const vil_image_view<vxl_byte>& im)
+template <class T>
+basic_pyramid<T>::basic_pyramid(const vil_image_view<vxl_byte>& im)
 {
 	// set the default value for the alpha parameter to 0.4
 	a_ = 0.4;
+	arena_ = 0;
+	arena_size_ = 0;
+	mapped_size_ = 0;
+	cache_gauss_ = false;
+	thread_mutex_init(&gauss_mutex_);
 
 	build(im);
 }
 
-pyramid::pyramid(const vil_image_view<vxl_byte>& im, double a)
+template <class T>
+basic_pyramid<T>::basic_pyramid(const vil_image_view<vxl_byte>& im, double a)
 {
 	a_ = a;
+	arena_ = 0;
+	arena_size_ = 0;
+	mapped_size_ = 0;
+	cache_gauss_ = false;
+	thread_mutex_init(&gauss_mutex_);
 
 	build(im);
 }
 
+template <class T>
+basic_pyramid<T>::basic_pyramid(const vil_image_view<vxl_byte>& im, 
+                                const vil_image_view<vxl_byte>* coarse, 
+                                int n, double a)
+{
+	a_ = a;
+	arena_ = 0;
+	arena_size_ = 0;
+	mapped_size_ = 0;
+	cache_gauss_ = false;
+	thread_mutex_init(&gauss_mutex_);
+
+	build(im, coarse, n);
+}
+
+template <class T>
+basic_pyramid<T>::basic_pyramid(const char* fname)
+{
+	a_ = 0.4;
+	arena_ = 0;
+	arena_size_ = 0;
+	mapped_size_ = 0;
+	cache_gauss_ = false;
+	thread_mutex_init(&gauss_mutex_);
+
+	if (map_file(fname) == false) {
+		// an empty pyramid
+		init_kernel();
+		N_ = 0;
+		L_.clear();
+		g_.assign(1, vil_image_view<vxl_byte>());
+		g_N_ = g_[0];
+		invalidate_gauss();
+	}
+}
+
+template <class T>
+basic_pyramid<T>::~basic_pyramid()
+{
+	release_arena();
+	thread_mutex_destroy(&gauss_mutex_);
+}
+
+// Map the file fname copy-on-write (writes to the mapping are private
+// to the process); returns 0 if the file cannot be mapped or is
+// smaller than min_size. The mapping remains valid after the file
+// is closed, until unmap_private() is called
+static void* map_private(const char* fname, vcl_size_t min_size, vcl_size_t& size)
+{
+#ifdef _WIN32
+	LARGE_INTEGER file_size;
+	HANDLE mapping = 0;
+	void* data = 0;
+
+	HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, 0, 
+	                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+	if (GetFileSizeEx(file, &file_size) && 
+		(file_size.QuadPart >= (LONGLONG) min_size))
+		mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+	if (mapping != 0) {
+		data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+
+	size = (vcl_size_t) file_size.QuadPart;
+	return data;
+#else
+	struct stat st;
+	void* data = MAP_FAILED;
+
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if ((fstat(fd, &st) == 0) && (st.st_size >= (off_t) min_size))
+		data = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	size = st.st_size;
+	return (data == MAP_FAILED) ? 0 : data;
+#endif
+}
+
+static void unmap_private(void* data, vcl_size_t size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+}
+
+template <class T>
+void basic_pyramid<T>::release_arena()
+{
+	if (mapped_size_ > 0)
+		unmap_private(arena_, mapped_size_);
+	else
+		delete [] arena_;
+	arena_ = 0;
+	arena_size_ = 0;
+	mapped_size_ = 0;
+}
+
+template <class T>
+bool basic_pyramid<T>::ok() const
+{
+	return (bool) g_N_;
+}
+
+template <class T>
+void basic_pyramid<T>::rebuild(const vil_image_view<vxl_byte>& im)
+{
+	build(im);
+}
+
+template <class T>
+void basic_pyramid<T>::rebuild(const vil_image_view<vxl_byte>& im, 
+                               const vil_image_view<vxl_byte>* coarse, int n)
+{
+	build(im, coarse, n);
+}
+
+// Initialize the smoothing kernel from the a_ parameter
+template <class T>
+void basic_pyramid<T>::init_kernel()
+{
+	// the kernel always has length 5 pixels; shift the pointer 
+	// by two so that kernel indices are in the range [-2,2]
+	w_hat_ = w_hat_data_ + 2;
+	kernel(a_, w_hat_);
+}
+
+template <class T>
+void basic_pyramid<T>::kernel(double a, double* w_hat)
+{
+	w_hat[2] = w_hat[-2] = 0.25 - a/2;
+	w_hat[1] = w_hat[-1] = 0.25;
+	w_hat[0] = a;
+}
+
+template <class T>
+int basic_pyramid<T>::levels(int ni, int nj)
+{
+	int N = 0;
+	for (int n=vcl_max(ni, nj); n > 2; n=(n+1)/2)
+		N++;
+	return N;
+}
+
+// The alignment (in bytes) of each level in the arena
+static const vcl_size_t arena_align = 64;
+
+static vcl_size_t align_up(vcl_size_t n)
+{
+	return (n + arena_align - 1) & ~(arena_align - 1);
+}
+
+// Compute the dimensions of the N+1 levels of an image of dimensions
+// ni x nj x nplanes and the position of every level in the arena,
+// for Laplacian pixels of pixel_size bytes. Each level starts on a 
+// 64-byte boundary and stores its planes one after the other, so 
+// that every level is a contiguous image. The routine returns the 
+// size of the arena
+static vcl_size_t arena_layout(int ni, int nj, int nplanes, int N, 
+                               vcl_size_t pixel_size,
+                               vcl_vector<int>& lni, vcl_vector<int>& lnj,
+                               vcl_vector<vcl_size_t>& L_offset,
+                               vcl_vector<vcl_size_t>& g_offset)
+{
+	int l;
+	vcl_size_t size = 0;
+
+	lni.resize(N+1);
+	lnj.resize(N+1);
+	L_offset.resize(N);
+	g_offset.resize(N+1);
+
+	// the level dimensions
+	lni[0] = ni;
+	lnj[0] = nj;
+	for (l=1; l<=N; l++) {
+		lni[l] = (lni[l-1]+1)/2;
+		lnj[l] = (lnj[l-1]+1)/2;
+	}
+
+	// the Laplacian levels come first, followed by the Gauss levels
+	for (l=0; l<N; l++) {
+		L_offset[l] = size;
+		size = align_up(size + pixel_size*lni[l]*lnj[l]*nplanes);
+	}
+	for (l=0; l<=N; l++) {
+		g_offset[l] = size;
+		size = align_up(size + (vcl_size_t) lni[l]*lnj[l]*nplanes);
+	}
+
+	return size;
+}
+
+template <class T>
+void basic_pyramid<T>::allocate(int ni, int nj, int nplanes, int N)
+{
+	int l;
+	vcl_vector<int> lni, lnj;
+	vcl_vector<vcl_size_t> L_offset, g_offset;
+	vcl_size_t size = arena_layout(ni, nj, nplanes, N, sizeof(T), 
+	                               lni, lnj, L_offset, g_offset);
+
+	N_ = N;
+
+	// get a new block only if the current one is too small; a 
+	// mapped file is never reused
+	if ((size > arena_size_) || (mapped_size_ > 0)) {
+		release_arena();
+		arena_ = new char[size + arena_align - 1];
+		arena_size_ = size;
+	}
+	char* base = (char*) align_up((vcl_size_t) arena_);
+
+	// point the level images to their place in the arena
+	L_.resize(N_);
+	g_.resize(N_+1);
+	for (l=0; l<N_; l++)
+		L_[l] = vil_image_view<T>((T*) (base + L_offset[l]), 
+			                      lni[l], lnj[l], nplanes,
+		                          1, lni[l], lni[l]*lnj[l]);
+	for (l=0; l<=N_; l++)
+		g_[l] = vil_image_view<vxl_byte>((vxl_byte*) (base + g_offset[l]), 
+			                             lni[l], lnj[l], nplanes,
+		                                 1, lni[l], lni[l]*lnj[l]);
+	g_N_ = g_[N_];
+}
+
 //
 // This is the main routine for building the Gauss and the
 // Laplacian pyramid
 //
 // It takes as input an image (of arbitrary dimensions MxP)
-// and builds a pyramid whose 0 level is of size (2^N+1)x(2^N+1)
-// and N is the smallest power of 2 such that 2^N+1 > max(M,P)
+// and builds a pyramid whose 0 level is of size MxP. Each
+// level l has dimensions ceil(M_l/2)xceil(P_l/2) where M_l x P_l
+// are the dimensions of level l-1, and the top level N is 
+// the first one whose dimensions do not exceed 2x2
 //
-void pyramid::build(const vil_image_view<vxl_byte>& im)
+template <class T>
+void basic_pyramid<T>::build(const vil_image_view<vxl_byte>& im, 
+                             const vil_image_view<vxl_byte>* coarse, int n_seeds)
 {
-	int ni, nj;
 	int l;
-	int n;
-	int i,j, plane;
+	int N;
 
-	//
 	// initialize the smoothing kernel
-    //
-
-	// the kernel always has length 5 pixels
-	w_hat_ = new double[5];
-	// shift pointer by two so that kernel indices are in
-	// the range [-2,2]
-	w_hat_ += 2;
-	// set the values of the kernel
-	w_hat_[2] = w_hat_[-2] = 0.25 - a_/2;
-	w_hat_[1] = w_hat_[-1] = 0.25;
-	w_hat_[0] = a_;
-
-	// 
-	// Allocate the arrays holding the Gauss and Laplacian pyramid images
-	// 
+	init_kernel();
 
-	// compute the number of levels, N_
-	ni = (int)ceil(log((double)im.ni()-1)/log(2));
-	nj = (int)ceil(log((double)im.nj()-1)/log(2));
-	N_ = vcl_max(ni,nj);
+	// compute the number of levels, N; for an image of size
+	// (2^N+1)x(2^N+1) this gives N levels as expected
+	N = levels(im.ni(), im.nj());
 
 	// 
-    // a pyramid is represented as an array of N_+1 images, 0,...,N_
-	// where the n-th image is of dimension (2^n+1)x(2^n+1)
+	// Lay out the Gauss and Laplacian pyramid images in the arena.
+	// A pyramid is represented as an array of N_+1 images, 0,...,N_
+	// where the n-th image is half the size of the (n-1)-th one
+	// along each axis
 	// 
-
-	// allocate a temporary array holding the Gaussian pyramid images
-	vil_image_view<vxl_byte>* g_temp = new vil_image_view<vxl_byte>[N_+1];
-
-	// allocate the array holding the Laplacian pyramid images
-	L_ = new vil_image_view<int>[N_];
+	allocate(im.ni(), im.nj(), im.nplanes(), N);
 
 	// 
 	// Build the pyramids
@@ -77,68 +318,263 @@ void pyramid::build(const vil_image_view<vxl_byte>& im)
 
 	// Step 1: Copy the original image into level 0 of the Gauss pyramid
 
-	// allocate space and initialize the level-0 image with zeros, since 
-	// the input image may not occupy all (2^N_+1)x(2^N+1) pixels
-	g_temp[0].set_size((int)pow(2,N_)+1, (int)pow(2,N_)+1, im.nplanes());
-	g_temp[0].fill(0);
-
-	// copy the image so that pixel im(0,0) goes to pixel g_temp[0](0,0)
-	vil_copy_to_window(im, g_temp[0], 0, 0);
-
+	// the copy also makes the planes of interleaved (eg. RGB) images
+	// contiguous, which is the layout the reduce/expand kernels prefer
+	vil_copy_reformat(im, g_[0]);
 
 	// Step 2: Compute levels 1,...,N_ of the Gauss pyramid
 
-	for (l=1; l<=N_; l++) 
-		// each level is a reduced version of the image immediately below it
-		reduce(g_temp[l-1], w_hat_, g_temp[l]);
+	for (l=1; l<=N_; l++) {
+		// the seeds of approximate pyramids replace the reduced levels
+		// as long as they have the dimensions of their level
+		if ((l <= n_seeds) && (coarse[l-1].ni() == g_[l].ni()) && 
+			(coarse[l-1].nj() == g_[l].nj()) && 
+			(coarse[l-1].nplanes() == g_[l].nplanes())) {
+			vil_copy_reformat(coarse[l-1], g_[l]);
+			continue;
+		}
+		n_seeds = 0;
+		// each level is a reduced version of the image immediately below it;
+		// since g_[l] already has the right size, reduce() writes to the 
+		// arena rather than allocating a new image
+		reduce(g_[l-1], w_hat_, g_[l]);
+	}
 
 	// Step 3: Compute levels 0,...,N_-1 of the Laplacian pyramid
 
-	for (l=0; l<N_; l++) {
-		// allocate space for the l-th level of the Laplacian pyramid
-		L_[l] = vil_image_view<int>(g_temp[l].ni(), g_temp[l].nj(), 
-			                              g_temp[l].nplanes());
-		vil_image_view<vxl_byte> gtmp;
-
+	for (l=0; l<N_; l++) 
 		// each level is computed by the difference
 		//   L_[l] = g_[l] - expand(g_[l+1])
 		// i.e., it represents all the "details" in g_[l] that are
 		// "lost" when the image is reduced from g_[l] to g_[l+1]
+		laplacian(g_[l], g_[l+1], w_hat_, L_[l]);
 
-		expand(g_temp[l+1], w_hat_, gtmp);
-		vil_math_image_difference(g_temp[l], gtmp, L_[l]);
-	}
-
-	// Store just the N_ level image of the Gauss pyramid
-	g_N_ = g_temp[N_];
+	// all the levels of the Gauss pyramid are still in the arena, and
+	// they are identical to the levels reconstructed from the Laplacian
+	// pyramid, so they can be used by the Gauss level cache
+	invalidate_gauss();
+	g_valid_.assign(N_+1, true);
 }
 
 // Create a pyramid data structure from a sequence of
 // Laplacian pyramid levels and the N-th level Gauss image
-pyramid::pyramid(const vil_image_view<int>* L, 
-				 vil_image_view<vxl_byte> g_N, 
-				 int N, double a)
+template <class T>
+basic_pyramid<T>::basic_pyramid(const vil_image_view<T>* L, 
+							  vil_image_view<vxl_byte> g_N, 
+							  int N, double a)
 {
 	int l;
 
-	N_ = N;
 	a_ = a;
+	arena_ = 0;
+	arena_size_ = 0;
+	mapped_size_ = 0;
+	cache_gauss_ = false;
+	thread_mutex_init(&gauss_mutex_);
+
+	init_kernel();
+
+	if (N > 0)
+		allocate(L[0].ni(), L[0].nj(), L[0].nplanes(), N);
+	else
+		allocate(g_N.ni(), g_N.nj(), g_N.nplanes(), N);
 
-	// the kernel always has length 5 pixels
-	w_hat_ = new double[5];
-	// shift pointer by two so that kernel indices are in
-	// the range [-2,2]
-	w_hat_ += 2;
-	// set the values of the kernel
-	w_hat_[2] = w_hat_[-2] = 0.25 - a_/2;
-	w_hat_[1] = w_hat_[-1] = 0.25;
-	w_hat_[0] = a_;
-
-	L_ = new vil_image_view<int>[N_];
 	for (l=0; l<N; l++)
-		vil_copy_deep(L[l], L_[l]);
+		vil_copy_reformat(L[l], L_[l]);
+
+	vil_copy_reformat(g_N, g_N_);
 
-	vil_copy_deep(g_N, g_N_);
+	// only the top level of the Gauss pyramid is known
+	invalidate_gauss();
+}
+
+//
+// The .pyr file format
+//
+// A .pyr file starts with a header block of pyr_header_size bytes
+// holding a pyr_header, followed by a pyr_level entry for each of
+// the levels 0,...,N. The arena follows the header block, with the 
+// layout computed by arena_layout(); all values are in the byte 
+// order of the machine that wrote the file, which is checked when 
+// the file is loaded
+//
+
+static const char pyr_magic[8] = {'V', 'C', 'P', 'Y', 'R', 0, 0, 0};
+static const vxl_uint_32 pyr_version = 1;
+static const vxl_uint_32 pyr_byte_order = 0x01020304;
+// the size of the header block, which keeps the arena page-aligned 
+// in the mapping
+static const vcl_size_t pyr_header_size = 4096;
+
+struct pyr_header {
+	char magic[8];
+	vxl_uint_32 version;
+	vxl_uint_32 byte_order;
+	// the type of the Laplacian pixels (see pyr_pixel_type()) and
+	// their size in bytes
+	vxl_uint_32 pixel_type;
+	vxl_uint_32 pixel_size;
+	vxl_int_32 N;
+	vxl_int_32 nplanes;
+	double a;
+	// the size of the arena
+	vxl_uint_64 data_size;
+};
+
+struct pyr_level {
+	vxl_int_32 ni;
+	vxl_int_32 nj;
+	// the positions of the Laplacian (unused for level N) and Gauss
+	// levels in the arena
+	vxl_uint_64 L_offset;
+	vxl_uint_64 g_offset;
+};
+
+// the largest number of levels the header block can describe
+static const int pyr_max_levels = 
+	(int) ((pyr_header_size - sizeof(pyr_header))/sizeof(pyr_level));
+
+static vxl_uint_32 pyr_pixel_type(const vxl_int_16*) { return 1; }
+static vxl_uint_32 pyr_pixel_type(const int*) { return 2; }
+static vxl_uint_32 pyr_pixel_type(const float*) { return 3; }
+
+// Write n bytes of data at position pos of a file, after padding the
+// file with zeros from position at; at is updated to the end of the
+// data
+static bool write_at(vcl_FILE* f, vcl_size_t& at, vcl_size_t pos, 
+                     const void* data, vcl_size_t n)
+{
+	static const char zeros[64] = {0};
+
+	for (; at < pos; at++)
+		if (vcl_fwrite(zeros, 1, 1, f) != 1)
+			return false;
+	at += n;
+	return (n == 0) || (vcl_fwrite(data, 1, n, f) == n);
+}
+
+template <class T>
+bool basic_pyramid<T>::save(const char* fname) const
+{
+	int l;
+	int nplanes = g_N_.nplanes();
+	vcl_vector<int> lni, lnj;
+	vcl_vector<vcl_size_t> L_offset, g_offset;
+	vcl_size_t size = arena_layout(ni(0), nj(0), nplanes, N_, sizeof(T),
+	                               lni, lnj, L_offset, g_offset);
+
+	if ((ok() == false) || (N_ + 1 > pyr_max_levels))
+		return false;
+
+	// all the Gauss levels are saved, so that a loaded pyramid never
+	// has to reconstruct them
+	fill_gauss(0);
+
+	vcl_vector<char> block(pyr_header_size, 0);
+	pyr_header* h = (pyr_header*) &block[0];
+	pyr_level* level = (pyr_level*) (h + 1);
+
+	vcl_memcpy(h->magic, pyr_magic, sizeof(pyr_magic));
+	h->version = pyr_version;
+	h->byte_order = pyr_byte_order;
+	h->pixel_type = pyr_pixel_type((T*) 0);
+	h->pixel_size = sizeof(T);
+	h->N = N_;
+	h->nplanes = nplanes;
+	h->a = a_;
+	h->data_size = size;
+	for (l=0; l<=N_; l++) {
+		level[l].ni = lni[l];
+		level[l].nj = lnj[l];
+		level[l].L_offset = (l < N_) ? L_offset[l] : 0;
+		level[l].g_offset = g_offset[l];
+	}
+
+	vcl_FILE* f = vcl_fopen(fname, "wb");
+	if (f == 0)
+		return false;
+
+	// the levels are contiguous images in the arena
+	vcl_size_t at = 0;
+	bool written = write_at(f, at, 0, &block[0], pyr_header_size);
+	for (l=0; written && (l<N_); l++)
+		written = write_at(f, at, pyr_header_size + L_offset[l], L_[l].top_left_ptr(),
+		                   sizeof(T)*lni[l]*lnj[l]*nplanes);
+	for (l=0; written && (l<=N_); l++)
+		written = write_at(f, at, pyr_header_size + g_offset[l], g_[l].top_left_ptr(),
+		                   (vcl_size_t) lni[l]*lnj[l]*nplanes);
+	written = written && write_at(f, at, pyr_header_size + size, 0, 0);
+
+	return (vcl_fclose(f) == 0) && written;
+}
+
+template <class T>
+bool basic_pyramid<T>::map_file(const char* fname)
+{
+	int l;
+	vcl_size_t file_size;
+
+	void* data = map_private(fname, pyr_header_size, file_size);
+	if (data == 0)
+		return false;
+
+	const pyr_header* h = (const pyr_header*) data;
+	const pyr_level* level = (const pyr_level*) (h + 1);
+	char* base = (char*) data + pyr_header_size;
+	vcl_size_t size = file_size - pyr_header_size;
+	bool valid = 
+		(vcl_memcmp(h->magic, pyr_magic, sizeof(pyr_magic)) == 0) &&
+		(h->version == pyr_version) && (h->byte_order == pyr_byte_order) &&
+		(h->pixel_type == pyr_pixel_type((T*) 0)) && (h->pixel_size == sizeof(T)) &&
+		(h->N >= 0) && (h->N + 1 <= pyr_max_levels) && (h->nplanes > 0) &&
+		(h->data_size <= size);
+
+	// the levels must have the layout of the arena of a pyramid 
+	// built from an image of the dimensions of level 0
+	if (valid) {
+		vcl_vector<int> lni, lnj;
+		vcl_vector<vcl_size_t> L_offset, g_offset;
+		vcl_size_t layout_size = 
+			arena_layout(level[0].ni, level[0].nj, h->nplanes, h->N, sizeof(T),
+			             lni, lnj, L_offset, g_offset);
+
+		valid = (layout_size == h->data_size);
+		for (l=0; valid && (l<=h->N); l++)
+			valid = (level[l].ni == lni[l]) && (level[l].nj == lnj[l]) &&
+			        (level[l].g_offset == g_offset[l]) &&
+			        ((l == h->N) || (level[l].L_offset == L_offset[l]));
+	}
+	if (!valid) {
+		unmap_private(data, file_size);
+		return false;
+	}
+
+	arena_ = (char*) data;
+	arena_size_ = h->data_size;
+	mapped_size_ = file_size;
+	a_ = h->a;
+	N_ = h->N;
+	init_kernel();
+
+	// point the level images to the mapping
+	int nplanes = h->nplanes;
+	L_.resize(N_);
+	g_.resize(N_+1);
+	for (l=0; l<N_; l++)
+		L_[l] = vil_image_view<T>((T*) (base + level[l].L_offset), 
+			                      level[l].ni, level[l].nj, nplanes,
+		                          1, level[l].ni, level[l].ni*level[l].nj);
+	for (l=0; l<=N_; l++)
+		g_[l] = vil_image_view<vxl_byte>((vxl_byte*) (base + level[l].g_offset), 
+			                             level[l].ni, level[l].nj, nplanes,
+		                                 1, level[l].ni, level[l].ni*level[l].nj);
+	g_N_ = g_[N_];
+
+	// all the Gauss levels are stored in the file
+	invalidate_gauss();
+	g_valid_.assign(N_+1, true);
+
+	return true;
 }
 
 //
@@ -147,21 +583,50 @@ pyramid::pyramid(const vil_image_view<int>* L,
 
 
 // Return the total number of levels in the pyramid
-int pyramid::N() const
+template <class T>
+int basic_pyramid<T>::N() const
 {
 	return N_;
 }
 
 // Return the alpha value of the w_hat kernel
-double pyramid::a() const
+template <class T>
+double basic_pyramid<T>::a() const
 {
 	return a_;
 }
 
+// Return the dimensions of level l of the pyramid; they are
+// given by the Laplacian image at that level, or by the stored
+// Gauss image for the top level
+template <class T>
+int basic_pyramid<T>::ni(int l) const
+{
+	return (l < N_) ? L_[l].ni() : g_N_.ni();
+}
+
+template <class T>
+int basic_pyramid<T>::nj(int l) const
+{
+	return (l < N_) ? L_[l].nj() : g_N_.nj();
+}
+
+// The fixed-point kernels are used unless the reference routines
+// have been selected explicitly; the setting is shared by the
+// pyramids of all Laplacian pixel types
+static bool reference_kernels = false;
+
+template <class T>
+void basic_pyramid<T>::use_reference_kernels(bool on)
+{
+	reference_kernels = on;
+}
+
 // Copy level l of the Laplacian pyramid into the supplied
 // image; the routine returns FALSE if (l is not in the 
 // range [0,...,N_-1]
-bool pyramid::L(int l, vil_image_view<int>& L_l) const
+template <class T>
+bool basic_pyramid<T>::L(int l, vil_image_view<T>& L_l) const
 {
 	if ((l >=0) && (l < N_)) {
 		vil_copy_deep(L_[l], L_l);
@@ -174,20 +639,27 @@ bool pyramid::L(int l, vil_image_view<int>& L_l) const
 // image, and expend it to level l2; the routine returns 
 // FALSE if (l1 is not in the  range [0,...,N_-1]) or
 // if (l1 < l2)
-bool pyramid::L(int l1, int l2, vil_image_view<int>& L_l) const
+template <class T>
+bool basic_pyramid<T>::L(int l1, int l2, vil_image_view<T>& L_l) const
 {
 	if ((l1 >=0) && (l1 < N_) && (l1 >= l2)) {
-		vil_image_view<int> temp1, temp2;
+		vil_image_view<T> temp1, temp2;
 
-		// get level l1 of the pyramid
-		L(l1, temp1);
+		// the level is only read, so it is not copied before being
+		// expanded
+		temp1 = L_[l1];
 
 		// expand the level to level l2
 		for (int l=l1; l>l2; l--) {
-			expand(temp1, w_hat_, temp2);
+			expand(temp1, w_hat_, ni(l-1), nj(l-1), temp2);
 			temp1 = temp2;
 		}
-		vil_copy_deep(temp1, L_l);
+		// the expanded level is a new image, but level l1 itself is
+		// a view of the arena
+		if (l1 == l2)
+			vil_copy_deep(temp1, L_l);
+		else
+			L_l = temp1;
 
 		return true;
 	} else
@@ -197,10 +669,11 @@ bool pyramid::L(int l1, int l2, vil_image_view<int>& L_l) const
 // Copy all levels of the Laplacian pyramid into an array of
 // images and return a pointer to that array
 
-vil_image_view<int>* pyramid::L() const
+template <class T>
+vil_image_view<T>* basic_pyramid<T>::L() const
 {
 	// allocate the array holding the images
-	vil_image_view<int>* L_temp = new vil_image_view<int>[N_];
+	vil_image_view<T>* L_temp = new vil_image_view<T>[N_];
 
 	// copy the corresponding levels into the array
 	for (int l=0; l<N_; l++) 
@@ -209,6 +682,29 @@ vil_image_view<int>* pyramid::L() const
 	return L_temp;
 }
 
+template <class T>
+void basic_pyramid<T>::L(vcl_vector<vil_image_view<T> >& L_all) const
+{
+	L_all.resize(N_);
+	for (int l=0; l<N_; l++) {
+		// the levels may be views of another pyramid
+		L_all[l] = vil_image_view<T>();
+		vil_copy_deep(L_[l], L_all[l]);
+	}
+}
+
+// Return a view of level l of the Laplacian pyramid
+template <class T>
+const vil_image_view<T>& basic_pyramid<T>::L_view(int l) const
+{
+	static const vil_image_view<T> empty_im;
+
+	if ((l >= 0) && (l < N_))
+		return L_[l];
+	else
+		return empty_im;
+}
+
 
 ////////////////////////////////////////////////////////////////
 //        Routines for computing the Gauss pyramid            //
@@ -221,53 +717,159 @@ vil_image_view<int>* pyramid::L() const
 
 // a helper function that adds two images and also performs intensity bound
 // checking to avoid overflows when assigning numbers to unsigned byte
-// images
-static vil_image_view<vxl_byte> add_g_and_L(vil_image_view<vxl_byte>& g, 
-						                    vil_image_view<int>& L)
+// images; floating-point Laplacian values are rounded
+template <class T>
+static void add_g_and_L(const vil_image_view<vxl_byte>& g, 
+						const vil_image_view<T>& L,
+						vil_image_view<vxl_byte>& result)
 {
-	vil_image_view<vxl_byte> result(g.ni(), g.nj(), g.nplanes());
+	result.set_size(g.ni(), g.nj(), g.nplanes());
 	
 	for (int p=0; p<g.nplanes(); p++)
-		for (int i=0; i<g.ni(); i++)
-			for (int j=0; j<g.nj(); j++) {
-				int value = g(i,j,p) + L(i,j,p);
+		for (int j=0; j<g.nj(); j++)
+			for (int i=0; i<g.ni(); i++) {
+				int value = (int) vcl_floor(g(i,j,p) + L(i,j,p) + 0.5);
 				result(i,j,p) = vcl_min(vcl_max(value, 0), 255);
 			}
+}
 
-	return result;
+// Copy src into dest, like vil_copy_deep(). Images in the cache are
+// contiguous, so most copies reduce to a single memcpy
+static void copy_level(const vil_image_view<vxl_byte>& src,
+					   vil_image_view<vxl_byte>& dest)
+{
+	dest.set_size(src.ni(), src.nj(), src.nplanes());
+
+	if (src.is_contiguous() && (src.istep() == dest.istep()) &&
+		(src.jstep() == dest.jstep()) && (src.planestep() == dest.planestep()))
+		vcl_memcpy(dest.top_left_ptr(), src.top_left_ptr(), src.size());
+	else
+		vil_copy_reformat(src, dest);
 }
 
+// 
+// The Gauss level cache
+//
+// The Gauss levels reconstructed by the routines below can be kept
+// in the (otherwise unused after construction) Gauss levels of the 
+// arena, with g_valid_[l] recording whether g_[l] holds level l. 
+// The versions of the levels expanded to level 0 are kept in g_exp_. 
+// The cache is only used when enabled with cache_gauss(true)
+//
+
+template <class T>
+void basic_pyramid<T>::cache_gauss(bool on)
+{
+	cache_gauss_ = on;
+
+	// release the expanded levels, which take a lot of memory
+	if (!on) {
+		g_exp_.clear();
+		g_exp_.resize(N_+1);
+	}
+}
+
+// Forget all reconstructed levels; only the top level, which is
+// stored explicitly, remains valid. This must be called whenever 
+// the Laplacian levels change
+template <class T>
+void basic_pyramid<T>::invalidate_gauss()
+{
+	g_valid_.assign(N_+1, false);
+	g_valid_[N_] = true;
+
+	g_exp_.clear();
+	g_exp_.resize(N_+1);
+}
+
+// Make sure that g_[l] holds level l of the Gauss pyramid, 
+// reconstructing it from the closest valid level above it
+// if necessary. All intermediate levels become valid as well.
+// Once valid, a level is not written again until the pyramid
+// changes, so g_[l] can be read without the lock afterwards
+template <class T>
+void basic_pyramid<T>::fill_gauss(int l) const
+{
+	int k;
+
+	thread_mutex_lock(&gauss_mutex_);
+
+	// the top level is always valid
+	for (k=l; !g_valid_[k]; k++)
+		;
+
+	for (; k>l; k--) {
+		// g_(k-1) = expand(g_k) + L_[k-1]
+		collapse(g_[k], L_[k-1], w_hat_, g_[k-1]);
+		g_valid_[k-1] = true;
+	}
+
+	thread_mutex_unlock(&gauss_mutex_);
+}
 
 // Return an array that holds the entire Gauss pyramid
 // The routine reconstructs the Gauss pyramid from the Laplacian
 // pyramid images
 
-vil_image_view<vxl_byte>* pyramid::g() const
+template <class T>
+vil_image_view<vxl_byte>* basic_pyramid<T>::g() const
 {
 	// allocate the array holding the images
 	vil_image_view<vxl_byte>* g_temp = new vil_image_view<vxl_byte>[N_+1];
 
+	if (cache_gauss_) {
+		// reconstruct all missing levels in the cache and copy them
+		fill_gauss(0);
+		for (int l=0; l<=N_; l++)
+			copy_level(g_[l], g_temp[l]);
+
+		return g_temp;
+	}
+
 	// the N_-th level of the Gauss pyramid is only level stored in the
-	// pyramid data structure
-	g_temp[N_] = g_N_;
+	// pyramid data structure; the copy keeps the returned images valid
+	// after the pyramid is destroyed
+	vil_copy_deep(g_N_, g_temp[N_]);
 
 	// the remaining levels have to be computed
-	for (int l=N_; l>0; l--) {
-		vil_image_view<vxl_byte> gtmp;
+	for (int l=N_; l>0; l--) 
 		// compute the l-th level of the Gauss pyramid using the
 		// formula g_(l-1) = expand(g_l) + L_[l-1]
-		expand(g_temp[l], w_hat_, gtmp);
-		g_temp[l-1] = add_g_and_L(gtmp, L_[l-1]);
-	}
+		collapse(g_temp[l], L_[l-1], w_hat_, g_temp[l-1]);
 
 	return g_temp;
 }
 
+template <class T>
+void basic_pyramid<T>::g(vcl_vector<vil_image_view<vxl_byte> >& g_all) const
+{
+	g_all.resize(N_+1);
+	for (int l=0; l<=N_; l++) {
+		g_all[l] = vil_image_view<vxl_byte>();
+		copy_level(g_view(l), g_all[l]);
+	}
+}
+
+// Return a view of level l of the Gauss pyramid, reconstructing it
+// in the arena if necessary
+template <class T>
+const vil_image_view<vxl_byte>& basic_pyramid<T>::g_view(int l) const
+{
+	static const vil_image_view<vxl_byte> empty_im;
+
+	if ((l < 0) || (l > N_))
+		return empty_im;
+
+	fill_gauss(l);
+	return g_[l];
+}
+
 
 // Compute the l-th level of the Gauss pyramid from the 
 // Laplacian pyramid images; the routine
 // returns FALSE if l is not in the range [0,...,N_]
-bool pyramid::g(int l, vil_image_view<vxl_byte>& g_l) const
+template <class T>
+bool basic_pyramid<T>::g(int l, vil_image_view<vxl_byte>& g_l) const
 {
 	return g(l, l, g_l);
 }
@@ -275,7 +877,7 @@ bool pyramid::g(int l, vil_image_view<vxl_byte>& g_l) const
 // Compute the l1-th level of the Gauss pyramid from the 
 // Laplacian pyramid images. The routine then expands 
 // the l1-th level image repeatedly so that its size 
-// becomes (2^l2 + 1)x(2^l2 + 1).
+// becomes that of level l2, ie. ni(l2) x nj(l2).
 //
 // The routine returns FALSE if l1,l2 are outside the 
 // range [0,...,N_] and/or if l2 > l1.
@@ -284,7 +886,8 @@ bool pyramid::g(int l, vil_image_view<vxl_byte>& g_l) const
 // Gauss pyramid
 
 
-bool pyramid::g(int l1, int l2, vil_image_view<vxl_byte>& g_l) const
+template <class T>
+bool basic_pyramid<T>::g(int l1, int l2, vil_image_view<vxl_byte>& g_l) const
 {
 	int l;
 	vil_image_view<vxl_byte> temp;
@@ -293,28 +896,58 @@ bool pyramid::g(int l1, int l2, vil_image_view<vxl_byte>& g_l) const
 		(l2 >= 0) && (l2 <= N_) &&
 		(l2 <= l1)) {
 
-        // the N_-th level of the Gauss pyramid is only level stored in the
-        // pyramid data structure
 		vil_image_view<vxl_byte> g_l1;
-		g_l1 = g_N_;
-
-		// the remaining levels have to be computed
-		for (l=N_; l>l1; l--) {
-			vil_image_view<vxl_byte> gtmp;
-			// compute the l-th level of the Gauss pyramid using the
-			// formula g_(l-1) = expand(g_l) + L_[l-1]
-			expand(g_l1, w_hat_, gtmp);
-			temp = add_g_and_L(gtmp, L_[l-1]);
-			g_l1 = temp;
 
+		if (cache_gauss_) {
+			// level l1 expanded to level 0 may already be available
+			bool cached = false;
+			thread_mutex_lock(&gauss_mutex_);
+			if ((l2 == 0) && ((bool) g_exp_[l1])) {
+				copy_level(g_exp_[l1], g_l);
+				cached = true;
+			}
+			thread_mutex_unlock(&gauss_mutex_);
+			if (cached)
+				return true;
+			fill_gauss(l1);
+			g_l1 = g_[l1];
+		} else {
+			// the N_-th level of the Gauss pyramid is only level stored in the
+			// pyramid data structure
+			g_l1 = g_N_;
+
+			// the remaining levels have to be computed
+			for (l=N_; l>l1; l--) {
+				vil_image_view<vxl_byte> gtmp;
+				// compute the l-th level of the Gauss pyramid using the
+				// formula g_(l-1) = expand(g_l) + L_[l-1]
+				collapse(g_l1, L_[l-1], w_hat_, gtmp);
+				g_l1 = gtmp;
+			}
 		}
 
 		// create gl_2 by expanding until level l2
 		for (l=l1, g_l=g_l1; l>l2; l--) {
 			// implement the formula g_l = expand(g_l)			
-			expand(g_l, w_hat_, temp);
+			expand(g_l, w_hat_, ni(l-1), nj(l-1), temp);
 			g_l = temp;
 		}
+
+		if (l1 == l2) {
+			// if no level had to be expanded, g_l is a view of the arena
+			// and must be replaced by a copy
+			if ((cache_gauss_) || (l1 == N_)) {
+				g_l = vil_image_view<vxl_byte>();
+				copy_level(g_l1, g_l);
+			}
+		} else if ((cache_gauss_) && (l2 == 0)) {
+			// remember the expanded level for the next request
+			thread_mutex_lock(&gauss_mutex_);
+			if (!g_exp_[l1])
+				copy_level(g_l, g_exp_[l1]);
+			thread_mutex_unlock(&gauss_mutex_);
+		}
+
 		return true;
 	} else
 		return false;
@@ -333,9 +966,9 @@ bool pyramid::g(int l1, int l2, vil_image_view<vxl_byte>& g_l) const
 // The REDUCE() routine
 // 
 
-// Given image of dimensions (2^N+1)x(2^N+1), return an image
-// of dimensions (2^(N-1)+1)x(2^(N-1)+1) that is a smoothed and
-// subsampled version of the original
+// Given image of dimensions MxP, return an image of dimensions
+// ceil(M/2)xceil(P/2) that is a smoothed and subsampled version 
+// of the original
 // 
 // Parameters:
 //    im:     the input image
@@ -348,22 +981,34 @@ bool pyramid::g(int l1, int l2, vil_image_view<vxl_byte>& g_l) const
 //                     and (2) by dividing the result by the sum of 
 //                     these kernel elements
 
-void pyramid::reduce(const vil_image_view<vxl_byte> im, 
-			         const double* w_hat,
-			         vil_image_view<vxl_byte>& im_red)
+template <class T>
+void basic_pyramid<T>::reduce(const vil_image_view<vxl_byte> im, 
+			                  const double* w_hat,
+			                  vil_image_view<vxl_byte>& im_red)
+{
+	if (reference_kernels)
+		reduce_reference(im, w_hat, im_red);
+	else
+		pyramid_reduce_fixed(im, pyramid_kernel(w_hat), im_red);
+}
+
+template <class T>
+void basic_pyramid<T>::reduce_reference(const vil_image_view<vxl_byte> im, 
+			                            const double* w_hat,
+			                            vil_image_view<vxl_byte>& im_red)
 {
     
     im_red.set_size((im.ni()-1)/2 + 1, (im.nj()-1)/2 + 1, im.nplanes());
     
     vil_image_view<vxl_byte> temp;
     
-    temp.set_size(im.ni(), (im.nj()-1)/2 + 1, im.nplanes());
+    temp.set_size((im.ni()-1)/2 + 1, im.nj(), im.nplanes());
     
-    // For columns
-    // For all pixels of im_red. For all i, j.
+    // For rows
+    // For all pixels of temp. For all i, j.
     for (int p=0; p<temp.nplanes(); p++) {
-        for (int i=0; i<temp.ni(); i++) {
-            for (int j=0; j<temp.nj(); j++) {
+        for (int j=0; j<temp.nj(); j++) {
+            for (int i=0; i<temp.ni(); i++) {
             
             double sum = 0;
             double div = 0;
@@ -372,19 +1017,19 @@ void pyramid::reduce(const vil_image_view<vxl_byte> im,
             for (int n=-2; n<=2; n++) {
                 
                 // >> Check boudaries;
-                if(2*j+n >= 0 && 2*j+n < im.nj()){
-                    sum += w_hat[n]*im(i, 2*j+n, p);
-                    div = w_hat[n];
+                if(2*i+n >= 0 && 2*i+n < im.ni()){
+                    sum += w_hat[n]*im(2*i+n, j, p);
+                    div += w_hat[n];
                 }
             }
             
             // Compute sum/div if div not zero
-            temp(i,j,p) = (vxl_byte)(div!=0?sum/div:sum);
+            temp(i,j,p) = (vxl_byte)(div!=0?sum/div+0.5:sum);
                 
             }
         }
     }
-    // For rows
+    // For columns
     // For all pixels of im_red. For all i, j.
     for (int p=0; p<im_red.nplanes(); p++) {
         for (int j=0; j<im_red.nj(); j++) {
@@ -393,18 +1038,18 @@ void pyramid::reduce(const vil_image_view<vxl_byte> im,
                 double sum = 0;
                 double div = 0;
                 
-                // For all columns
+                // For all rows
                 for (int m=-2; m<=2; m++) {
                     
                     // >> Check boudaries;
-                    if(2*i+m >= 0 && 2*i+m < temp.ni()){
-                        sum += w_hat[m]*temp(2*i+m, j, p);
-                        div = w_hat[m];
+                    if(2*j+m >= 0 && 2*j+m < temp.nj()){
+                        sum += w_hat[m]*temp(i, 2*j+m, p);
+                        div += w_hat[m];
                     }
                 }
                 
                 // Compute sum/div if div not zero
-                im_red(i,j,p) = (vxl_byte)(div!=0?sum/div:sum);
+                im_red(i,j,p) = (vxl_byte)(div!=0?sum/div+0.5:sum);
                 
             }
         }
@@ -416,13 +1061,16 @@ void pyramid::reduce(const vil_image_view<vxl_byte> im,
 // The EXPAND() routine
 // 
 
-// Given image of dimensions (2^(N-1)+1)x(2^(N-1)+1), return an image
-// of dimensions (2^N+1)x(2^N+1) that is an interpolated version
-// of the original using the w_hat as the interpolating kernel
+// Given image of dimensions MxP, return an image of dimensions
+// ni x nj that is an interpolated version of the original using 
+// the w_hat as the interpolating kernel
 // 
 // Parameters:
 //    im:     the input image
 //    w_hat:  the 5-pixel smoothing kernel (w_hat[-2],...,w_hat[2])
+//    ni,nj:  the dimensions of the output image, ie. those of the
+//            pyramid level that was reduced to MxP (2M-1 or 2M 
+//            columns, 2P-1 or 2P rows)
 //
 //
 // Boundary treatment: When the kernel extends beyond the image 
@@ -432,45 +1080,138 @@ void pyramid::reduce(const vil_image_view<vxl_byte> im,
 //                     and (2) by dividing the result by the sum of 
 //                     these kernel elements
 
-void pyramid::expand(const vil_image_view<vxl_byte> im, 
-		             const double* w_hat, 
-		             vil_image_view<vxl_byte>& im_exp)
+template <class T>
+void basic_pyramid<T>::expand(const vil_image_view<vxl_byte> im, 
+		                      const double* w_hat, int ni, int nj,
+		                      vil_image_view<vxl_byte>& im_exp)
+{
+	if (reference_kernels)
+		expand_reference(im, w_hat, ni, nj, im_exp);
+	else
+		pyramid_expand_fixed(im, pyramid_kernel(w_hat), ni, nj, im_exp);
+}
+
+template <class T>
+void basic_pyramid<T>::expand(const vil_image_view<T> im, 
+		                      const double* w_hat, int ni, int nj,
+		                      vil_image_view<T>& im_exp)
+{
+	if (reference_kernels)
+		expand_reference(im, w_hat, ni, nj, im_exp);
+	else
+		pyramid_expand_fixed(im, pyramid_kernel(w_hat), ni, nj, im_exp);
+}
+
+template <class T>
+void basic_pyramid<T>::reduce_level(const vil_image_view<vxl_byte>& g,
+		                            const double* w_hat,
+		                            vil_image_view<vxl_byte>& g_up)
+{
+	reduce(g, w_hat, g_up);
+}
+
+template <class T>
+void basic_pyramid<T>::expand_level(const vil_image_view<vxl_byte>& g_up,
+		                            const double* w_hat, int ni, int nj,
+		                            vil_image_view<vxl_byte>& g)
+{
+	expand(g_up, w_hat, ni, nj, g);
+}
+
+// The Laplacian level is computed by the fused kernel, which never
+// stores the expanded image, or from the reference routines
+template <class T>
+void basic_pyramid<T>::laplacian(const vil_image_view<vxl_byte>& g,
+		                         const vil_image_view<vxl_byte>& g_up,
+		                         const double* w_hat,
+		                         vil_image_view<T>& L)
+{
+	if (reference_kernels) {
+		vil_image_view<vxl_byte> gtmp;
+
+		expand_reference(g_up, w_hat, g.ni(), g.nj(), gtmp);
+		vil_math_image_difference(g, gtmp, L);
+	} else
+		pyramid_laplacian_fixed(g, g_up, pyramid_kernel(w_hat), L);
+}
+
+// Similarly, the Gauss level g = expand(g_up) + L is computed by the
+// fused kernel or from the reference routines
+template <class T>
+void basic_pyramid<T>::collapse(const vil_image_view<vxl_byte>& g_up,
+		                        const vil_image_view<T>& L,
+		                        const double* w_hat,
+		                        vil_image_view<vxl_byte>& g)
+{
+	if (reference_kernels) {
+		vil_image_view<vxl_byte> gtmp;
+
+		expand_reference(g_up, w_hat, L.ni(), L.nj(), gtmp);
+		add_g_and_L(gtmp, L, g);
+	} else
+		pyramid_collapse_fixed(g_up, L, pyramid_kernel(w_hat), g);
+}
+
+// Store the result of a double-precision computation in a Laplacian
+// pixel: integer types are rounded to the nearest integer, floats 
+// keep the fractional part
+static void round_laplacian(double v, vxl_int_16& pixel)
+{
+	pixel = (vxl_int_16) vcl_floor(v + 0.5);
+}
+
+static void round_laplacian(double v, int& pixel)
+{
+	pixel = (int) vcl_floor(v + 0.5);
+}
+
+static void round_laplacian(double v, float& pixel)
+{
+	pixel = (float) v;
+}
+
+// Since only the kernel elements that fall on pixels of the input 
+// image contribute to an expanded pixel, the sum of these elements 
+// is 1/2 in the interior of the image and the division below
+// takes the place of the usual factor of 2 per axis
+
+template <class T>
+void basic_pyramid<T>::expand_reference(const vil_image_view<vxl_byte> im, 
+		                                const double* w_hat, int ni, int nj,
+		                                vil_image_view<vxl_byte>& im_exp)
 {
     
-    im_exp.set_size((im.ni()-1)*2 + 1, (im.nj()-1)*2 + 1, im.nplanes());
+    im_exp.set_size(ni, nj, im.nplanes());
     
     vil_image_view<vxl_byte> temp;
     
-    temp.set_size(im.ni(), (im.nj()-1)*2 + 1, im.nplanes());
+    temp.set_size(ni, im.nj(), im.nplanes());
    
-	// For columns
-    // For all pixels of im_exp. For all i, j.
+	// For rows
+    // For all pixels of temp. For all i, j.
     for (int p=0; p<temp.nplanes(); p++) {
-        for (int i=0; i<temp.ni(); i++) {
-            for (int j=0; j<temp.nj(); j++) {
+        for (int j=0; j<temp.nj(); j++) {
+            for (int i=0; i<temp.ni(); i++) {
 	   
 			   double sum = 0;
 			   double div = 0;
 	   
 			   for (int n=-2; n<=2; n++) {
 		   
-				   // >> Check boudaries;
-				   if(2*j+n >= 0 && 2*j+n < im.nj()){
-					   // Check if it is integer
-					   if ((j-n)%2 == 0 ) {
-						   sum += w_hat[n]*im(i, (j-n)/2, p);
-						   div = w_hat[n];
-					   }
+				   // >> Check boudaries & check if it is integer
+				   if ((i-n)%2 == 0 && (i-n)/2 >= 0 && (i-n)/2 < im.ni()) {
+					   sum += w_hat[n]*im((i-n)/2, j, p);
+					   div += w_hat[n];
 				   }
 			   }
 	   
-			   // Compute 4*sum/div if div not zero
-			   temp(i,j,p) = (vxl_byte)(div!=0?4*sum/div:4*sum);
+			   // Compute sum/div if div not zero
+			   temp(i,j,p) = (vxl_byte)(div!=0?sum/div+0.5:sum);
 		   }
 	   }
 	}
 	
-	// For rows
+	// For columns
     // For all pixels of im_exp. For all i, j.
     for (int p=0; p<im_exp.nplanes(); p++) {
         for (int j=0; j<im_exp.nj(); j++) {
@@ -481,61 +1222,56 @@ void pyramid::expand(const vil_image_view<vxl_byte> im,
 	   
 			   for (int m=-2; m<=2; m++) {
 		   
-				   // >> Check boudaries;
-				   if(2*i+m >= 0 && 2*i+m < im.ni()){
-					   // Check if it is integer
-					   if ((i-m)%2 == 0 ) {
-						   sum += w_hat[m]*temp((i-m)/2, j, p);
-						   div = w_hat[m];
-					   }
+				   // >> Check boudaries & check if it is integer
+				   if ((j-m)%2 == 0 && (j-m)/2 >= 0 && (j-m)/2 < temp.nj()) {
+					   sum += w_hat[m]*temp(i, (j-m)/2, p);
+					   div += w_hat[m];
 				   }
 			   }
 	   
-			   // Compute 4*sum/div if div not zero
-			   im_exp(i,j,p) = (vxl_byte)(div!=0?4*sum/div:4*sum);
+			   // Compute sum/div if div not zero
+			   im_exp(i,j,p) = (vxl_byte)(div!=0?sum/div+0.5:sum);
 			}
 		}
 	}
 }
 
-void pyramid::expand(const vil_image_view<int> im, 
-		             const double* w_hat, 
-		             vil_image_view<int>& im_exp)
+template <class T>
+void basic_pyramid<T>::expand_reference(const vil_image_view<T> im, 
+		                                const double* w_hat, int ni, int nj,
+		                                vil_image_view<T>& im_exp)
 {
-	im_exp.set_size((im.ni()-1)*2 + 1, (im.nj()-1)*2 + 1, im.nplanes());
+	im_exp.set_size(ni, nj, im.nplanes());
     
-    vil_image_view<int> temp;
+    vil_image_view<T> temp;
     
-    temp.set_size(im.ni(), (im.nj()-1)*2 + 1, im.nplanes());
+    temp.set_size(ni, im.nj(), im.nplanes());
    
-	// For columns
-    // For all pixels of im_exp. For all i, j.
+	// For rows
+    // For all pixels of temp. For all i, j.
     for (int p=0; p<temp.nplanes(); p++) {
-        for (int i=0; i<temp.ni(); i++) {
-            for (int j=0; j<temp.nj(); j++) {
+        for (int j=0; j<temp.nj(); j++) {
+            for (int i=0; i<temp.ni(); i++) {
 	   
 			   double sum = 0;
 			   double div = 0;
 	   
 			   for (int n=-2; n<=2; n++) {
 		   
-				   // >> Check boudaries;
-				   if(2*j+n >= 0 && 2*j+n < im.nj()){
-					   // Check if it is integer
-					   if ((j-n)%2 == 0 ) {
-						   sum += w_hat[n]*im(i, (j-n)/2, p);
-						   div = w_hat[n];
-					   }
+				   // >> Check boudaries & check if it is integer
+				   if ((i-n)%2 == 0 && (i-n)/2 >= 0 && (i-n)/2 < im.ni()) {
+					   sum += w_hat[n]*im((i-n)/2, j, p);
+					   div += w_hat[n];
 				   }
 			   }
 	   
-			   // Compute 4*sum/div if div not zero
-			   temp(i,j,p) = div!=0?4*sum/div:4*sum;
+			   // Compute sum/div if div not zero
+			   round_laplacian(div!=0?sum/div:sum, temp(i,j,p));
 		   }
 	   }
 	}
 	
-	// For rows
+	// For columns
     // For all pixels of im_exp. For all i, j.
     for (int p=0; p<im_exp.nplanes(); p++) {
         for (int j=0; j<im_exp.nj(); j++) {
@@ -546,18 +1282,15 @@ void pyramid::expand(const vil_image_view<int> im,
 	   
 			   for (int m=-2; m<=2; m++) {
 		   
-				   // >> Check boudaries;
-				   if(2*i+m >= 0 && 2*i+m < im.ni()){
-					   // Check if it is integer
-					   if ((i-m)%2 == 0 ) {
-						   sum += w_hat[m]*temp((i-m)/2, j, p);
-						   div = w_hat[m];
-					   }
+				   // >> Check boudaries & check if it is integer
+				   if ((j-m)%2 == 0 && (j-m)/2 >= 0 && (j-m)/2 < temp.nj()) {
+					   sum += w_hat[m]*temp(i, (j-m)/2, p);
+					   div += w_hat[m];
 				   }
 			   }
 	   
-			   // Compute 4*sum/div if div not zero
-			   im_exp(i,j,p) = div!=0?4*sum/div:4*sum;
+			   // Compute sum/div if div not zero
+			   round_laplacian(div!=0?sum/div:sum, im_exp(i,j,p));
 			}
 		}
 	}
@@ -577,7 +1310,8 @@ void pyramid::expand(const vil_image_view<int> im,
 // and closest to the largest dimension of the image
 //
 
-void pyramid::crop_to_power_of_2plus1(
+template <class T>
+void basic_pyramid<T>::crop_to_power_of_2plus1(
 		const vil_image_view<vxl_byte>& im,
 		vil_image_view<vxl_byte>& im_crop)
 {
@@ -598,7 +1332,8 @@ void pyramid::crop_to_power_of_2plus1(
 //
 // The routine also outputs a packed version of the pyramid
 // into a single image
-void pyramid::dump_gauss(int l1, int l2, bool expand_to_l2, const char* basename)
+template <class T>
+void basic_pyramid<T>::dump_gauss(int l1, int l2, bool expand_to_l2, const char* basename)
 {
 	int i;
 
@@ -612,7 +1347,7 @@ void pyramid::dump_gauss(int l1, int l2, bool expand_to_l2, const char* basename
 			g(l, l2, im);
 		} else {
 			pyr_fname << basename << ".g." << l << ".jpg" << vcl_ends;
-			g(l, im);
+			im = g_view(l);
 		}
 
 		 
@@ -637,7 +1372,8 @@ void pyramid::dump_gauss(int l1, int l2, bool expand_to_l2, const char* basename
 	vil_save(im, (pack_fname.str()).c_str());
 }
 
-void pyramid::dump_laplacian(int l1, int l2, bool expand_to_l2, const char* basename)
+template <class T>
+void basic_pyramid<T>::dump_laplacian(int l1, int l2, bool expand_to_l2, const char* basename)
 {
 	int i;
 
@@ -651,7 +1387,7 @@ void pyramid::dump_laplacian(int l1, int l2, bool expand_to_l2, const char* base
 		l2 = 0;
 
 	for (int l=l2; l<=l1; l++) {
-		vil_image_view<int> im;
+		vil_image_view<T> im;
 		vil_image_view<vxl_byte> imb;
 		char fname[256];
 		vcl_ostringstream pyr_fname(fname);
@@ -661,7 +1397,7 @@ void pyramid::dump_laplacian(int l1, int l2, bool expand_to_l2, const char* base
 			L(l, l2, im);
 		} else {
 			pyr_fname << basename << ".L." << l << ".jpg" << vcl_ends;
-			L(l, im);
+			im = L_view(l);
 		}
 
 		 
@@ -692,34 +1428,33 @@ void pyramid::dump_laplacian(int l1, int l2, bool expand_to_l2, const char* base
 // Return an image that contains all levels of the Laplacian pyramid
 // This routine is useful for pyramid visualization purposes
 // 
-void pyramid::pack_laplacian(vil_image_view<vxl_byte>& imb) const
+template <class T>
+void basic_pyramid<T>::pack_laplacian(vil_image_view<vxl_byte>& imb) const
 {
+	int ni, nj;
+
 	// allocate space for the output image; the packed image has
-	// 1/2 more columns and the same number of rows as the original image 
-	vil_image_view<int> im(2*(L_[0].ni()-1), 
-		                   L_[0].nj(), 
-						   L_[0].nplanes());
-	// Note: a more efficient packing is possible:
-	// allocate space for the output image; the packed image has
-	// 1/2 more columns and the same number of rows as the original image 
-	//vil_image_view<int> im(L_[0].ni()+(L_[0].ni()-1)/2+1, 
-	//	                   L_[0].nj(), 
-	//					   L_[0].nplanes());
+	// roughly 1/2 more columns and the same number of rows as the 
+	// original image 
+	pack_size(N_, ni, nj);
+	vil_image_view<T> im(ni, nj, g_N_.nplanes());
 
 	// fill it with zeros
 	im.fill(0);
 
 	// call the recursive packing routine
-	pack(L_, N_, 0, 0, im);
+	if (N_ > 0)
+		pack(&L_[0], N_, 0, 0, im);
 
 	// since the Laplacian images contain signed byte values, we first convert it to an
 	// unsigned byte image by mapping the range [-127..128] to [0..255]
 	int_to_ubyte(im, imb);
 }
 
-// convert an int-type image (used for storing signed Laplacian images)
-// to a ubyte image
-void pyramid::int_to_ubyte(const vil_image_view<int>& imi, vil_image_view<vxl_byte>& imb)
+// convert a Laplacian-type image (used for storing signed Laplacian 
+// images) to a ubyte image
+template <class T>
+void basic_pyramid<T>::int_to_ubyte(const vil_image_view<T>& imi, vil_image_view<vxl_byte>& imb)
 {
 	imb.set_size(imi.ni(), imi.nj(), imi.nplanes());
 	for (int p=0; p<imi.nplanes(); p++)
@@ -733,31 +1468,63 @@ void pyramid::int_to_ubyte(const vil_image_view<int>& imi, vil_image_view<vxl_by
 // Return an image that contains all levels of the Gauss pyramid
 // This routine is useful for pyramid visualization purposes. 
 //
-void pyramid::pack_gauss(vil_image_view<vxl_byte>& im) const
+template <class T>
+void basic_pyramid<T>::pack_gauss(vil_image_view<vxl_byte>& im) const
 {
 	// Since the Gaussian pyramid is not stored explicitly, we first
-	// compute & store the Gaussian pyramid in a temporary array
-	// of images
-	vil_image_view<vxl_byte>* g_temp = g();
+	// reconstruct its levels in the arena; the packing routine only
+	// reads them, so they are not copied
+	vcl_vector<vil_image_view<vxl_byte> > g_temp(N_+1);
+	int ni, nj;
+
+	for (int l=0; l<=N_; l++)
+		g_temp[l] = g_view(l);
 
 	// allocate space for the output image; the packed image has
-	// the same number of rows as the original image and twice the 
-	// columns
-	im.set_size(2*(g_temp[0].ni()-1), g_temp[0].nj(), g_temp[0].nplanes());
-	// note: a tigher packing is also possible
-	//im.set_size(g_temp[0].ni()+(g_temp[0].ni()-1)/2+1, 
-	//	                        g_temp[0].nj(), 
-	//                           g_temp[0].nplanes());
+	// the same number of rows as the original image and roughly 1/2
+	// more columns
+	pack_size(N_, ni, nj);
+	im.set_size(ni, nj, g_temp[0].nplanes());
 
 	// fill it with zeros
 	im.fill(0);
 	// call the recursive pyramid-packing routine
-	pack(g_temp, N_, 0, 0, im);
+	pack(&g_temp[0], N_, 0, 0, im);
+}
+
+// Compute the size of the image holding the packed levels 
+// 0,...,l-1. The levels are visited in the same order as in the
+// pack() routines below: level k is placed at (i,j), level k+1
+// to its right and level k+2 below level k+1, and the levels 
+// above k+2 are placed to the right of level k+2
+template <class T>
+void basic_pyramid<T>::pack_size(int l, int& ni, int& nj) const
+{
+	int i = 0, j = 0;
+
+	ni = nj = 0;
+	for (int k=0; k<l; k+=3) {
+		ni = vcl_max(ni, i + this->ni(k));
+		nj = vcl_max(nj, j + this->nj(k));
+		if (k+1 < l) {
+			ni = vcl_max(ni, i + this->ni(k) + this->ni(k+1));
+			nj = vcl_max(nj, j + this->nj(k+1));
+		}
+		if (k+2 < l) {
+			ni = vcl_max(ni, i + this->ni(k) + this->ni(k+2));
+			nj = vcl_max(nj, j + this->nj(k+1) + this->nj(k+2));
+		}
+		if (k+3 < l) {
+			i += this->ni(k) + this->ni(k+2);
+			j += this->nj(k+1);
+		}
+	}
 }
 
 // Recursive packing routine for unsigned byte images
-void pyramid::pack(vil_image_view<vxl_byte>* pyr, int l, int i, int j, 
-				   vil_image_view<vxl_byte>& im) const
+template <class T>
+void basic_pyramid<T>::pack(const vil_image_view<vxl_byte>* pyr, int l, int i, int j, 
+				            vil_image_view<vxl_byte>& im) const
 {
 	if (l > 0) {
 		vil_copy_to_window(pyr[0], im, i, j);
@@ -774,8 +1541,9 @@ void pyramid::pack(vil_image_view<vxl_byte>* pyr, int l, int i, int j,
 
 // Recursive packing routine for signed byte images (useful for 
 // packing Laplacian images). 
-void pyramid::pack(vil_image_view<int>* pyr, int l, int i, int j, 
-				   vil_image_view<int>& im) const
+template <class T>
+void basic_pyramid<T>::pack(const vil_image_view<T>* pyr, int l, int i, int j, 
+				            vil_image_view<T>& im) const
 {
 	if (l > 0) {
 		vil_copy_to_window(pyr[0], im, i, j);
@@ -790,4 +1558,8 @@ void pyramid::pack(vil_image_view<int>* pyr, int l, int i, int j,
 	}
 }
 
-
+// The pyramid class is instantiated for the supported Laplacian 
+// pixel types
+template class basic_pyramid<vxl_int_16>;
+template class basic_pyramid<int>;
+template class basic_pyramid<float>;
@@ -7,6 +7,7 @@
 
 #include "../gl/glutils.h"
 #include "../imdraw/imdraw.h"
+#include "../thread/thread.h"
 
 
 //
@@ -20,18 +21,61 @@
 // The Laplacian pyramid is represented as an array
 // of vil_image_view<vxl_byte> images, each representing
 // a different level of the pyramid. For an image of
-// size (2^N + 1)*(2^N + 1), the pyramid is represented
-// as an array of N-1 images, each of which is a level
+// size MxP, level 0 has the size of the image and each
+// subsequent level has dimensions ceil(M/2)xceil(P/2) of
+// the level below it (no padding is involved, so the
+// levels need not be square). The pyramid is represented
+// as an array of N images, each of which is a level
 // of the Laplacian pyramid, along with another vil_image_view 
 // image containing the Nth level of the Gauss pyramid
-
-class pyramid {
+//
+// The pixel type T of the Laplacian levels is a template parameter.
+// The pyramid type below stores them as 16-bit integers, which is
+// enough for 8-bit images and takes half the memory and bandwidth of
+// basic_pyramid<int>; basic_pyramid<float> keeps the fractional part
+// of Laplacian levels computed by the user (eg. blended levels)
+//
+// The pixels of all levels live in a single aligned block of
+// memory (the arena) owned by the pyramid, laid out level by level:
+// first the N Laplacian levels and then the N+1 levels of the Gauss
+// pyramid, which serve as scratch space during construction. The
+// level images are non-owning views into the arena. The accessors
+// g(l, g_l), L(l, L_l), g() and L() return deep copies of the levels,
+// which the caller owns; g_view(l) and L_view(l) return the views
+// themselves, which alias the arena and are only valid until the
+// pyramid is rebuilt or destroyed. The arena is reused when the
+// pyramid is rebuilt from an image of the same dimensions
+//
+// A pyramid can be saved in a binary .pyr file, which holds a header
+// (the version of the format, N, a, the pixel type and the dimensions
+// and positions of the levels) followed by the arena itself, with all
+// the Gauss levels filled in. Loading such a file maps it in memory
+// and points the levels to the mapping, so that the pixels are only
+// read from disk (once) when they are accessed. The mapping is 
+// private: the Gauss level cache can still write to it, but the file
+// is never modified
+
+template <class T = vxl_int_16>
+class basic_pyramid {
 	// 
 	// Private variables of the pyramid class
 	// 
 
-	// array of images containing the N-1 levels of the Laplacian pyramid
-	vil_image_view<int>* L_;   
+	// array of images containing the N levels of the Laplacian pyramid
+	vcl_vector<vil_image_view<T> > L_;   
+	// array of images containing the N+1 levels of the Gauss pyramid;
+	// g_[l] is only meaningful while the pyramid is being built or if
+	// g_valid_[l] is true (see the Gauss level cache below)
+	mutable vcl_vector<vil_image_view<vxl_byte> > g_;
+	mutable vcl_vector<bool> g_valid_;
+	// the Gauss levels expanded to level 0, or empty images for the
+	// levels that have not been requested yet
+	mutable vcl_vector<vil_image_view<vxl_byte> > g_exp_;
+	// true if the Gauss level cache is enabled
+	bool cache_gauss_;
+	// serializes the const routines that fill in g_, g_valid_ and
+	// g_exp_, so that several threads can read the same pyramid
+	mutable thread_mutex gauss_mutex_;
 	// image containing the Nth level of the Gauss pyramid
 	vil_image_view<vxl_byte> g_N_;
 	// the total number of levels
@@ -39,8 +83,18 @@ class pyramid {
 	// the "a" parameter defining the width of the 1D kernel used by
 	// the expand/reduce functions
 	double a_;   
-	// the 1D kernel used by the expand/reduce functions
+	// the 1D kernel used by the expand/reduce functions; it points 
+	// to the center of w_hat_data_
 	double* w_hat_;
+	double w_hat_data_[5];
+
+	// the memory block holding the pixels of all levels; arena_ is
+	// the address returned by new[] and arena_size_ the number of
+	// bytes that can be used after aligning it
+	char* arena_;
+	vcl_size_t arena_size_;
+	// the size of the mapping if the arena is a mapped .pyr file, or 0
+	vcl_size_t mapped_size_;
 
 	// 
 	// Private methods of the pyramid class
@@ -49,52 +103,197 @@ class pyramid {
 	// This is the top-level routine for pyramid construction
 	// It initializes the 1D kernel, builds the Gauss pyramid
 	// of the image passed as a parameter, and finally builds
-	// the Laplacian pyramid. 
-	void build(const vil_image_view<vxl_byte>& im);
+	// the Laplacian pyramid. Levels 1,...,n of the Gauss pyramid
+	// are copied from coarse[0],...,coarse[n-1] instead of being 
+	// reduced (see the seeded constructor below)
+	void build(const vil_image_view<vxl_byte>& im, 
+	           const vil_image_view<vxl_byte>* coarse = 0, int n = 0);
+
+	// Set w_hat_ to the kernel defined by a_
+	void init_kernel();
+
+	// Lay out N+1 levels starting from an image of dimensions 
+	// ni x nj x nplanes in the arena, growing the arena if it is 
+	// too small, and point the level views to it
+	void allocate(int ni, int nj, int nplanes, int N);
+	// Release the arena, whether it was allocated or mapped
+	void release_arena();
+	// Map a .pyr file and point the levels to it
+	bool map_file(const char* fname);
+
+	// Gauss level cache routines
+	void invalidate_gauss();
+	void fill_gauss(int l) const;
+
+	// pyramids own their arena, so they cannot be copied
+	basic_pyramid(const basic_pyramid&);
+	basic_pyramid& operator=(const basic_pyramid&);
+
+	// the blending class blends the levels of the source pyramids it
+	// keeps without copying them out of the arena
+	friend class blending;
 
 	// 
 	// The reduce() and expand() functions. You will
 	// have to implement both these functions
 	//
-	// The input in both functions is an image of dimension 
-	// (2^k + 1)x(2^k + 1) with 1<=k<=N as well as the 1D
-	// kernel w_hat to be used for smoothing/interpolation
+	// The input in both functions is an image of arbitrary 
+	// dimensions MxP as well as the 1D kernel w_hat to be used for 
+	// smoothing/interpolation. reduce() returns an image of 
+	// dimensions ceil(M/2)xceil(P/2), and expand() returns an image 
+	// of the dimensions ni x nj of the level below it (ie. 2M-1 or 
+	// 2M columns and 2P-1 or 2P rows)
+	//
+	// The functions run the fixed-point kernels of pyramid_kernels.cxx,
+	// or the double-precision reference routines below if the 
+	// reference kernels have been selected
 	//
 	static void reduce(const vil_image_view<vxl_byte> im,
 		               const double* w_hat,
 		               vil_image_view<vxl_byte>& im_red);
 	static void expand(const vil_image_view<vxl_byte> im, 
-		               const double* w_hat,
+		               const double* w_hat, int ni, int nj,
 					   vil_image_view<vxl_byte>& im_exp);
 	// this is identical to the expand() routine above, but it operates
-	// on images with pixels of type int
-	static void expand(const vil_image_view<int> im, 
-		               const double* w_hat,
-					   vil_image_view<int>& im_exp);
+	// on Laplacian levels
+	static void expand(const vil_image_view<T> im, 
+		               const double* w_hat, int ni, int nj,
+					   vil_image_view<T>& im_exp);
+
+	// The reference implementations of reduce() and expand(), which 
+	// evaluate the kernel in double precision pixel by pixel
+	static void reduce_reference(const vil_image_view<vxl_byte> im,
+		                         const double* w_hat,
+		                         vil_image_view<vxl_byte>& im_red);
+	static void expand_reference(const vil_image_view<vxl_byte> im, 
+		                         const double* w_hat, int ni, int nj,
+					             vil_image_view<vxl_byte>& im_exp);
+	static void expand_reference(const vil_image_view<T> im, 
+		                         const double* w_hat, int ni, int nj,
+					             vil_image_view<T>& im_exp);
 
     // Pyramid-packing functions. These functions take an array of images as
 	// input, each of which is 1/2 the size of the previous one, and 'packs'
 	// them into a single image for visualization purposes
-	void pack(vil_image_view<vxl_byte>* pyr, int l, int i, int j, 
+	void pack(const vil_image_view<vxl_byte>* pyr, int l, int i, int j, 
               vil_image_view<vxl_byte>& im) const;
-	// Same routine but implemented for int-pixel images (used for packing
+	// Same routine but implemented for Laplacian images (used for packing
 	// Laplacian levels, which can have negative values and thereforecannot be
 	// represented as vxl_byte images
-	void pack(vil_image_view<int>* pyr, int l, int i, int j, 
-              vil_image_view<int>& im) const;
+	void pack(const vil_image_view<T>* pyr, int l, int i, int j, 
+              vil_image_view<T>& im) const;
+	// Compute the dimensions of the image needed for packing 
+	// levels 0,...,l-1 of the pyramid
+	void pack_size(int l, int& ni, int& nj) const;
 public:
+	// the pixel type of the Laplacian levels
+	typedef T laplacian_type;
+
 	//
 	// pyramid constructors
 	//
 
 	// constructing the pyramid from a supplied image
-	pyramid(const vil_image_view<vxl_byte>& im);
+	basic_pyramid(const vil_image_view<vxl_byte>& im);
 	// constructor with the kernel's a-parameter specified explicitly
-	pyramid(const vil_image_view<vxl_byte>& im, double a);
+	basic_pyramid(const vil_image_view<vxl_byte>& im, double a);
+	// constructing an approximate pyramid whose Gauss levels 1,...,n
+	// are the images coarse[0],...,coarse[n-1] rather than reductions 
+	// of im, eg. the scaled decodes of load_image_scaled(), which are
+	// much cheaper to get than the exact levels. Seeding stops at the
+	// first image that does not have the dimensions and the number of
+	// planes of its level; the levels above the last seed are reduced
+	// from it. The Laplacian levels are the differences of the seeded
+	// levels, so g() and collapsing the pyramid return the seeds and
+	// im exactly, but the levels in between are not the Burt-Adelson
+	// levels of im: such pyramids are meant for thumbnails, level 
+	// display and previews
+	basic_pyramid(const vil_image_view<vxl_byte>& im, 
+	              const vil_image_view<vxl_byte>* coarse, int n, double a);
+	// loading a pyramid saved by save(); the file is mapped in memory
+	// rather than read. The pyramid is empty (see ok()) if the file 
+	// cannot be mapped or is not a .pyr file with Laplacian levels of
+	// type T
+	basic_pyramid(const char* fname);
+
+	~basic_pyramid();
+
+	// false if the pyramid could not be loaded from a file
+	bool ok() const;
+
+	// Save the pyramid in a binary .pyr file; the routine returns false
+	// if the file could not be written
+	bool save(const char* fname) const;
+
+	// Rebuild the pyramid from a new image (eg. the next frame of a
+	// video). No memory is allocated if the image has the same
+	// dimensions as the one the pyramid was built from
+	void rebuild(const vil_image_view<vxl_byte>& im);
+	// the same routine for approximate pyramids seeded with the
+	// images coarse[0],...,coarse[n-1] (see above)
+	void rebuild(const vil_image_view<vxl_byte>& im, 
+	             const vil_image_view<vxl_byte>* coarse, int n);
 
 	// basic accessor functions
 	int N() const;
 	double a() const;
+	// the dimensions of level l of the pyramid, 0<=l<=N
+	int ni(int l) const;
+	int nj(int l) const;
+
+	// Enable or disable the Gauss level cache. When enabled, the
+	// levels reconstructed by the g() routines, as well as the levels 
+	// expanded to level 0 by g(l1, 0, g_l), are kept in the pyramid 
+	// and returned directly by subsequent calls. Levels are 
+	// reconstructed lazily, and only once per (re)build of the
+	// pyramid. The expanded levels can take up to N+1 times the 
+	// memory of the input image
+	void cache_gauss(bool on);
+
+	// Select the double-precision reference routines (on=true) or the
+	// fixed-point kernels (on=false, the default) for all subsequent
+	// reduce/expand operations. The reference routines are much slower
+	// and are only useful for checking the output of the fixed-point
+	// kernels
+	static void use_reference_kernels(bool on);
+
+	//
+	// Single-level routines, for code that processes the levels of
+	// a pyramid one at a time (or one band of rows at a time) without
+	// building pyramid objects, such as blend(). They are the routines
+	// used to build and collapse pyramids, so they use the kernels 
+	// selected by use_reference_kernels()
+	//
+
+	// Store in w_hat[-2],...,w_hat[2] the kernel defined by a
+	static void kernel(double a, double* w_hat);
+	// The number of levels N of the pyramid of an image of dimensions
+	// ni x nj: level N is the first one whose dimensions do not exceed
+	// 2x2, so an image of size (2^N+1)x(2^N+1) has N levels
+	static int levels(int ni, int nj);
+
+	// Reduce a Gauss level to the level above it
+	static void reduce_level(const vil_image_view<vxl_byte>& g,
+		                     const double* w_hat,
+		                     vil_image_view<vxl_byte>& g_up);
+	// Expand a Gauss level to the dimensions ni x nj of the level
+	// below it
+	static void expand_level(const vil_image_view<vxl_byte>& g_up,
+		                     const double* w_hat, int ni, int nj,
+		                     vil_image_view<vxl_byte>& g);
+	// Compute the Laplacian level L = g - expand(g_up), where g_up 
+	// is the Gauss level above g. L must already have the dimensions
+	// of g
+	static void laplacian(const vil_image_view<vxl_byte>& g,
+		                  const vil_image_view<vxl_byte>& g_up,
+		                  const double* w_hat,
+		                  vil_image_view<T>& L);
+	// Compute the Gauss level g = expand(g_up) + L, where g_up is the
+	// Gauss level above L. The result is clamped to [0,255]
+	static void collapse(const vil_image_view<vxl_byte>& g_up,
+		                 const vil_image_view<T>& L,
+		                 const double* w_hat,
+		                 vil_image_view<vxl_byte>& g);
 
 	//
 	// Construct a pyramid data structure from an array of N-1 Laplacian 
@@ -103,7 +302,7 @@ public:
 	// You will likely use this consructor in your implementation of the
 	// blend() function
 	// 
-	pyramid(const vil_image_view<int>* L, const vil_image_view<vxl_byte> g_N, int N, double a);
+	basic_pyramid(const vil_image_view<T>* L, const vil_image_view<vxl_byte> g_N, int N, double a);
 
 	// 
 	// Methods for accessing levels of the Gauss or the Laplacian pyramid. 
@@ -117,10 +316,11 @@ public:
 
 	// Store level l of the Laplacian pyramid in image L_l
 	// The routine returns fale if l is outside the valid range
-	bool L(int l, vil_image_view<int>& L_l) const;
+	bool L(int l, vil_image_view<T>& L_l) const;
 
 	// Compute level l1 of the Gaussian pyramid and then 
-	// expand it to the size of level l2. 
+	// expand it to the size of level l2 (ie. to dimensions
+	// ni(l2) x nj(l2)). 
 	// The routine returns false if l1,l2 are outside the
 	// valid range, or if l2 > l1.
 	bool g(int l1, int l2, vil_image_view<vxl_byte>& g_l) const; 
@@ -129,15 +329,38 @@ public:
 	// expand it to the size of level l2. 
 	// The routine returns false if l1,l2 are outside the
 	// valid range, or if l2 > l1.
-	bool L(int l1, int l2, vil_image_view<int>& L_l) const; 
+	bool L(int l1, int l2, vil_image_view<T>& L_l) const; 
 
 	// Return an array that holds the entire Gauss pyramid
 	// The routine reconstructs the Gauss pyramid from the Laplacian
-	// pyramid images
+	// pyramid images. The array is allocated with new[] and must be
+	// released by the caller with delete []
 	vil_image_view<vxl_byte>* g() const;
 
-	// Return an array that holds the entire Laplacian pyramid
-	vil_image_view<int>* L() const;
+	// Return an array that holds the entire Laplacian pyramid; the
+	// array must be released by the caller with delete []
+	vil_image_view<T>* L() const;
+
+	// The same routines, storing copies of the levels in a vector
+	// owned by the caller
+	void g(vcl_vector<vil_image_view<vxl_byte> >& g_all) const;
+	void L(vcl_vector<vil_image_view<T> >& L_all) const;
+
+	//
+	// Zero-copy access to the levels. The routines above always
+	// return copies, which the caller owns; the routines below return
+	// level l as a view of the memory of the pyramid, or an empty 
+	// image if l is outside the valid range. A missing Gauss level
+	// is reconstructed in the pyramid, once per (re)build as with the
+	// Gauss level cache; the reconstruction is done under a lock, so
+	// several threads can call the const routines of a pyramid at the
+	// same time (but not while it is rebuilt). The views are read-only
+	// and are only valid until the pyramid is rebuilt or destroyed, so
+	// callers that keep or modify a level must copy it with g(l, g_l)
+	// or L(l, L_l)
+	//
+	const vil_image_view<vxl_byte>& g_view(int l) const;
+	const vil_image_view<T>& L_view(int l) const;
 	                     
 	//
 	// Utility functions 
@@ -151,9 +374,9 @@ public:
 	// version of the Laplacian pyramid
 	void pack_laplacian(vil_image_view<vxl_byte>& im) const;
 
-	// convert an int-type image (used for storing signed Laplacian levels)
-    // to a ubyte image
-	static void int_to_ubyte(const vil_image_view<int>& imi, vil_image_view<vxl_byte>& imb);
+	// convert a Laplacian-type image (used for storing signed Laplacian 
+	// levels) to a ubyte image
+	static void int_to_ubyte(const vil_image_view<T>& imi, vil_image_view<vxl_byte>& imb);
 
 	// Crop and pad an image so that it becomes square and has 
 	// size (2^N+1)x(2^N+1),
@@ -183,6 +406,11 @@ public:
 
 };
 
+// The pyramid used by the blending code: the Laplacian levels of 
+// 8-bit images are in the range [-255,255], so they are stored as
+// 16-bit integers
+typedef basic_pyramid<> pyramid;
+
 
 // 
 // Top-level routine that implements pyramid blending
@@ -192,10 +420,12 @@ public:
 // Input:
 //     source0, source1: the two images to be blended
 //                       they must have identical size
-//                       but do not have be of size 
-//                       (2^N+1)x(2^N+1)
+//                       but can have arbitrary (not
+//                       necessarily square) dimensions
 //     blending mask:    pixel values are typically either
 //                       0 or 255 (ie the mask is usually binary)
+//                       source0 is used where the mask is 0
+//                       and source1 where it is 255
 // Output:
 //     result:           the result of the pyramid
 //                       blending operation
@@ -229,6 +459,11 @@ static bool blend2(const vil_image_view<vxl_byte>& source0,
 // in this class, so you can completely ignore the definitions
 // below
 
+// A rectangular region [i0,i1)x[j0,j1) of an image
+struct blend_region {
+	int i0, j0, i1, j1;
+};
+
 class blending {
 public:
 	// descriptors for all the images/input used in the algorithm
@@ -249,6 +484,49 @@ private:
 	pyramid *blend_pyr_;
 	pyramid *mask_pyr_;
 
+	// the "a" parameter of the pyramids
+	double a_;
+	// the number of levels of sparse blending (see set_sparse()), or
+	// 0 to blend the images in full
+	int sparse_levels_;
+	// the level down to which compute() collapses the blended pyramid
+	// before returning a preview (see set_progressive()), and the
+	// finest level of blend_gauss_ computed so far (0 once the
+	// blend is complete) and the next band of the level below it
+	// to compute
+	int progressive_levels_;
+	int refine_level_;
+	int refine_band_;
+	// the images the source pyramids were built from; the pyramids
+	// are only rebuilt when the source images (or a_) change, so 
+	// blending the same sources with a new mask only computes the
+	// pyramid of the mask
+	vil_image_view<vil_rgb<vxl_byte> > source0_key_;
+	vil_image_view<vil_rgb<vxl_byte> > source1_key_;
+	// approximations of Gauss levels 1,2,... of the sources, which
+	// seed their pyramids instead of the exact levels (see set_seeds())
+	vcl_vector<vil_image_view<vxl_byte> > source0_seeds_;
+	vcl_vector<vil_image_view<vxl_byte> > source1_seeds_;
+	// false if blend_pyr_ has not been built from the current result
+	bool blend_pyr_valid_;
+	// false if mask_pyr_ has not been built from the current mask
+	bool mask_pyr_valid_;
+
+	// the Gauss pyramids of the mask and of the result computed by 
+	// the last call to compute(). When the mask is edited through 
+	// update_mask() or draw_mask(), the bounding boxes of the edits
+	// are recorded in dirty_ and compute() only recomputes the parts
+	// of these pyramids that depend on them
+	vcl_vector<vil_image_view<vxl_byte> > mask_gauss_;
+	vcl_vector<vil_image_view<vxl_byte> > blend_gauss_;
+	vcl_vector<blend_region> dirty_;
+	// true if the pyramids above are up to date except for the 
+	// regions in dirty_
+	bool partial_;
+	// false while mask_ may share its pixels with the image passed
+	// to set(), which must not be modified by the edits
+	bool mask_owned_;
+
 	// display control flags
 	int view_level_;
 	bool view_gauss_;
@@ -270,6 +548,8 @@ private:
 	vil_image_view<vxl_byte> mask_;
 	// the blended image 
 	vil_image_view<vil_rgb<vxl_byte> > blend_;
+	// the blended image, as returned by blend()
+	vil_image_view<vxl_byte> blended_;
 
 public:
 	// routines for saving image pyramids
@@ -281,10 +561,16 @@ public:
 	// save the result of the blending operation
 	// the routine returns false if the save operation failed
 	bool save_blended(const char* basename);
+	// save a pyramid in the binary format of pyramid::save(), in the
+	// file <basename>.s0.pyr, .s1.pyr, .b.pyr or .m.pyr
+	// the routine returns false if the save operation failed
+	bool save_pyramid_file(im_type imt, const char* basename);
 
 	
 	// default constructor
 	blending(void);
+	// the destructor releases the pyramids
+	~blending();
 
 	// run the blending algorithm on a set of
 	// previously-specified input images
@@ -323,6 +609,57 @@ public:
 	// dimensions as the already-specified images)
 	bool set(im_type imt, vil_image_view<vil_rgb<vxl_byte> > im);
 	bool set(im_type imt, vil_image_view<vxl_byte> im);
+	// set Source0 or Source1 from a pyramid saved by save_pyramid_file();
+	// the source image is level 0 of the pyramid, and the pyramid is
+	// not rebuilt unless the "a" parameter is changed
+	bool load_pyramid_file(im_type imt, const char* fname);
+	// seed the pyramid of Source0 or Source1 with approximations of
+	// its Gauss levels 1,...,coarse.size(), eg. the scaled decodes of
+	// load_image_scaled(), which are much cheaper to get than the 
+	// exact levels. The displayed levels and the result of blending 
+	// are then approximate, which is enough for previews. The seeds
+	// are dropped when the source is set again. The method returns
+	// false if imt is not a source or the seeds do not have the 
+	// dimensions of the levels of the source
+	bool set_seeds(im_type imt, const vcl_vector<vil_image_view<vil_rgb<vxl_byte> > >& coarse);
+
+	// set the "a" parameter of the pyramid kernel (0.4 by default);
+	// the source pyramids are rebuilt by the next call to compute()
+	void set_a(double a);
+
+	// blend with pyramids of the given number of levels, only near 
+	// the seam: the pyramids are only computed in the tiles where the
+	// result may differ from both sources, and the other pixels are 
+	// copied from the sources. The width of the transition between the
+	// sources grows as 2^levels. A value of 0 (the default) blends the
+	// images in full, with all the levels
+	void set_sparse(int levels);
+
+	// blend progressively: compute() only collapses the blended
+	// pyramid down to the given level and displays a preview of the
+	// result at that resolution; each call to refine() then computes
+	// a few rows of the next level down, updating the display when
+	// the level is complete, until the result is complete. The result
+	// is completed before it is saved, or before a level of its
+	// pyramid is displayed. A value of 0 (the default) computes the
+	// complete result in compute()
+	void set_progressive(int levels);
+	// switch between progressive blending with the default number of
+	// levels and blending in full
+	void toggle_progressive();
+	// compute the next rows of a progressive blend and display the
+	// result once they complete a level; the routine returns false if
+	// the blend is complete
+	bool refine();
+
+	// edit the mask after it has been set: update_mask() copies im into
+	// the window of the mask whose top-left pixel is (i0,j0), and 
+	// draw_mask() sets the mask to value wherever strokes is true 
+	// (strokes must have the dimensions of the mask). The next call to
+	// compute() only reblends the regions that have changed. The 
+	// methods return false if there is no mask or im does not fit
+	bool update_mask(const vil_image_view<vxl_byte>& im, int i0, int j0);
+	bool draw_mask(const vil_image_view<bool>& strokes, vxl_byte value = 255);
 
 	// get descriptive title of each image
 	const vcl_string& get_title(im_type imt);
@@ -332,6 +669,40 @@ private:
 	bool display_images();
 	bool display_images(ImDraw* panel, im_type imt);
 
+	// Build the pyramid of a source image, seeded with the levels in
+	// seeds, unless it has already been built from the same image with
+	// the current a_ (key holds the image the pyramid was built from).
+	// The routine returns true if the pyramid was rebuilt
+	bool update_source_pyramid(pyramid*& pyr, 
+	                           vil_image_view<vil_rgb<vxl_byte> >& key,
+	                           const vil_image_view<vil_rgb<vxl_byte> >& im,
+	                           const vcl_vector<vil_image_view<vxl_byte> >& seeds);
+	// Return the pyramid of Source0 or Source1, which is only built 
+	// when it is needed by compute() or displayed or saved
+	pyramid* source_pyramid(im_type imt);
+	// Return the pyramid of the blended image, which is only built
+	// when it is displayed or saved
+	pyramid* blend_pyramid();
+	// Return the pyramid of the mask, which is rebuilt when it is 
+	// displayed or saved after the mask has been edited
+	pyramid* mask_pyramid();
+
+	// Compute the next bands of a progressive blend, returning false
+	// if the blend is complete, and update blended_ when they
+	// complete a level
+	bool refine_step();
+	// Set blended_ to the result, or to a preview of the result while
+	// a progressive blend is being refined
+	void update_blended();
+	// Redisplay the result, if it is displayed
+	void display_blend();
+
+	// Make mask_ a private copy of the mask before it is edited
+	void own_mask();
+	// Record a changed region of the mask, merging it with the
+	// recorded regions it overlaps
+	void add_dirty(const blend_region& r);
+
 	// descriptive strings for each of these images
 	vcl_vector<vcl_string> im_labels_;
 
@@ -0,0 +1,790 @@
+#include "pyramid_kernels.h"
+
+#include <vcl_vector.h>
+#include <vcl_algorithm.h>
+#include <vcl_cmath.h>
+
+#include "../thread/parallel.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// number of fractional bits of the fixed-point taps
+static const int tap_bits = 14;
+// number of extra fractional bits kept in the 16-bit row buffers
+static const int row_bits = 6;
+// the shifts that bring the results of the horizontal and the
+// vertical pass back to the precision of their output
+static const int h_shift = tap_bits - row_bits;
+static const int v_shift = tap_bits + row_bits;
+
+pyramid_kernel::pyramid_kernel(const double* w_hat)
+{
+	for (int k=-2; k<=2; k++)
+		w[k+2] = (int) vcl_floor(w_hat[k]*(1<<tap_bits) + 0.5);
+
+	// absorb the rounding error in the center tap so that the
+	// taps sum to exactly 1
+	w[2] += (1<<tap_bits) - (w[0]+w[1]+w[2]+w[3]+w[4]);
+}
+
+////////////////////////////////////////////////////////////////
+//                  Boundary treatment                        //
+////////////////////////////////////////////////////////////////
+
+// Rescale the count taps in wt so that they sum to exactly 1<<14.
+// Any rounding error is absorbed by the largest tap
+static void normalize_taps(int* wt, int count)
+{
+	int c, sum = 0, total = 0, largest = 0;
+
+	for (c=0; c<count; c++)
+		sum += wt[c];
+	if ((sum == (1<<tap_bits)) || (sum <= 0))
+		return;
+
+	for (c=0; c<count; c++) {
+		wt[c] = (wt[c]*(1<<tap_bits) + sum/2)/sum;
+		total += wt[c];
+		if (wt[c] > wt[largest])
+			largest = c;
+	}
+	wt[largest] += (1<<tap_bits) - total;
+}
+
+// Compute the taps contributing to pixel o of a reduced axis
+// whose input has n pixels. The routine stores the index of
+// each input pixel in src[] and its renormalized weight in
+// wt[], and returns the number of taps
+static int reduce_taps(int o, int n, const pyramid_kernel& k, int* src, int* wt)
+{
+	int count = 0;
+
+	for (int m=-2; m<=2; m++)
+		if ((2*o+m >= 0) && (2*o+m < n)) {
+			src[count] = 2*o+m;
+			wt[count] = k.w[m+2];
+			count++;
+		}
+	normalize_taps(wt, count);
+
+	return count;
+}
+
+// Same as above, for pixel o of an expanded axis whose input
+// has n pixels. Only the taps that fall on input pixels
+// (ie. for which o-m is even) contribute
+static int expand_taps(int o, int n, const pyramid_kernel& k, int* src, int* wt)
+{
+	int count = 0;
+
+	for (int m=-2; m<=2; m++)
+		if ((((o-m) & 1) == 0) && ((o-m)/2 >= 0) && ((o-m)/2 < n)) {
+			src[count] = (o-m)/2;
+			wt[count] = k.w[m+2];
+			count++;
+		}
+	normalize_taps(wt, count);
+
+	return count;
+}
+
+#ifdef __SSE2__
+// A register holding the pair of 16-bit taps (lo,hi) four times,
+// for use with _mm_madd_epi16()
+static inline __m128i tap_pair(int lo, int hi)
+{
+	return _mm_set_epi16(hi, lo, hi, lo, hi, lo, hi, lo);
+}
+
+// load 8 unsigned bytes and widen them to 16 bits
+static inline __m128i load_u8x8(const vxl_byte* p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) p),
+		                     _mm_setzero_si128());
+}
+
+// load 8 pixels as 16-bit values
+static inline __m128i load_x8(const vxl_byte* p)
+{
+	return load_u8x8(p);
+}
+
+static inline __m128i load_x8(const vxl_int_16* p)
+{
+	return _mm_loadu_si128((const __m128i*) p);
+}
+#endif
+
+// Saturate a value to the range of a 16-bit integer
+static inline vxl_int_16 saturate_16(int v)
+{
+	return (vxl_int_16) vcl_min(vcl_max(v, -32768), 32767);
+}
+
+////////////////////////////////////////////////////////////////
+//                  The horizontal pass                       //
+////////////////////////////////////////////////////////////////
+
+// Reduce one row of n bytes to n_out 16-bit values
+static void hreduce_u8(const vxl_byte* in, vcl_ptrdiff_t istep, int n,
+                       const pyramid_kernel& k,
+                       vxl_int_16* out, int n_out)
+{
+	int src[5], wt[5];
+	int o = 0, c, count;
+	// outputs o with 2o-2 >= 0 and 2o+2 < n only use pixels
+	// inside the row
+	int last = (n-3)/2;
+	const int round = 1<<(h_shift-1);
+
+	for (; (o < n_out) && (o < 1); o++) {
+		int sum = 0;
+		count = reduce_taps(o, n, k, src, wt);
+		for (c=0; c<count; c++)
+			sum += wt[c]*in[src[c]*istep];
+		out[o] = (sum + round)>>h_shift;
+	}
+
+#ifdef __SSE2__
+	if (istep == 1) {
+		const __m128i w01 = tap_pair(k.w[0], k.w[1]);
+		const __m128i w23 = tap_pair(k.w[2], k.w[3]);
+		const __m128i w4 = tap_pair(k.w[4], 0);
+		const __m128i r = _mm_set1_epi32(round);
+
+		// 8 outputs at a time; the loads extend up to pixel 2o+17
+		for (; 2*o+17 < n; o += 8) {
+			const vxl_byte* p = in + 2*o - 2;
+			__m128i lo = _mm_add_epi32(
+				_mm_add_epi32(_mm_madd_epi16(load_u8x8(p), w01),
+				              _mm_madd_epi16(load_u8x8(p+2), w23)),
+				_mm_madd_epi16(load_u8x8(p+4), w4));
+			__m128i hi = _mm_add_epi32(
+				_mm_add_epi32(_mm_madd_epi16(load_u8x8(p+8), w01),
+				              _mm_madd_epi16(load_u8x8(p+10), w23)),
+				_mm_madd_epi16(load_u8x8(p+12), w4));
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, r), h_shift);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, r), h_shift);
+			_mm_storeu_si128((__m128i*) (out+o), _mm_packs_epi32(lo, hi));
+		}
+	}
+#endif
+
+	for (; (o < n_out) && (o <= last); o++) {
+		const vxl_byte* p = in + (2*o-2)*istep;
+		int sum = k.w[0]*p[0] + k.w[1]*p[istep] + k.w[2]*p[2*istep]
+			+ k.w[3]*p[3*istep] + k.w[4]*p[4*istep];
+		out[o] = (sum + round)>>h_shift;
+	}
+
+	for (; o < n_out; o++) {
+		int sum = 0;
+		count = reduce_taps(o, n, k, src, wt);
+		for (c=0; c<count; c++)
+			sum += wt[c]*in[src[c]*istep];
+		out[o] = (sum + round)>>h_shift;
+	}
+}
+
+// Expand one row of n bytes or 16-bit values (T) to n_out 16-bit
+// values. The Laplacian levels of 8-bit images are in the range 
+// [-255,255], so their expanded rows with 6 extra fractional bits
+// fit in 16 bits as well; larger values are saturated
+template <class T>
+static void hexpand(const T* in, vcl_ptrdiff_t istep, int n,
+                    const pyramid_kernel& k,
+                    vxl_int_16* out, int n_out)
+{
+	int src[5], wt[5];
+	int o = 0, c, count;
+	const int round = 1<<(h_shift-1);
+	// interior weights of the even outputs 2m (applied to pixels
+	// m-1, m, m+1) and of the odd outputs 2m+1 (pixels m, m+1)
+	const int e0 = 2*k.w[4], e1 = 2*k.w[2], e2 = 2*k.w[0];
+	const int o0 = 2*k.w[3], o1 = 2*k.w[1];
+
+	for (; (o < n_out) && (o < 2); o++) {
+		int sum = 0;
+		count = expand_taps(o, n, k, src, wt);
+		for (c=0; c<count; c++)
+			sum += wt[c]*in[src[c]*istep];
+		out[o] = saturate_16((sum + round)>>h_shift);
+	}
+
+#ifdef __SSE2__
+	if (istep == 1) {
+		const __m128i we01 = tap_pair(e0, e1);
+		const __m128i we2 = tap_pair(0, e2);
+		const __m128i wo = tap_pair(o0, o1);
+		const __m128i r = _mm_set1_epi32(round);
+
+		// outputs 2m,...,2m+15 at a time; the loads extend up to
+		// pixel m+8
+		for (; (o/2+8 < n) && (o+15 < n_out); o += 16) {
+			const T* p = in + o/2 - 1;
+			__m128i x = load_x8(p);
+			__m128i y = load_x8(p+1);
+			__m128i z = load_x8(p+2);
+
+			// even and odd outputs for pixels m,...,m+3
+			__m128i yz = _mm_unpacklo_epi16(y, z);
+			__m128i e = _mm_add_epi32(
+				_mm_madd_epi16(_mm_unpacklo_epi16(x, y), we01),
+				_mm_madd_epi16(yz, we2));
+			__m128i od = _mm_madd_epi16(yz, wo);
+			__m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi32(e, od), r), h_shift);
+			__m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi32(e, od), r), h_shift);
+			_mm_storeu_si128((__m128i*) (out+o), _mm_packs_epi32(lo, hi));
+
+			// even and odd outputs for pixels m+4,...,m+7
+			yz = _mm_unpackhi_epi16(y, z);
+			e = _mm_add_epi32(
+				_mm_madd_epi16(_mm_unpackhi_epi16(x, y), we01),
+				_mm_madd_epi16(yz, we2));
+			od = _mm_madd_epi16(yz, wo);
+			lo = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi32(e, od), r), h_shift);
+			hi = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi32(e, od), r), h_shift);
+			_mm_storeu_si128((__m128i*) (out+o+8), _mm_packs_epi32(lo, hi));
+		}
+	}
+#endif
+
+	// interior outputs: both 2m and 2m+1 need pixel m+1
+	for (; (o < n_out) && (o/2+1 < n); o++) {
+		const T* p = in + (o/2)*istep;
+		int sum;
+		if ((o & 1) == 0)
+			sum = e0*p[-istep] + e1*p[0] + e2*p[istep];
+		else
+			sum = o0*p[0] + o1*p[istep];
+		out[o] = saturate_16((sum + round)>>h_shift);
+	}
+
+	for (; o < n_out; o++) {
+		int sum = 0;
+		count = expand_taps(o, n, k, src, wt);
+		for (c=0; c<count; c++)
+			sum += wt[c]*in[src[c]*istep];
+		out[o] = saturate_16((sum + round)>>h_shift);
+	}
+}
+
+// Expand one row of n ints to n_out ints with 6 extra
+// fractional bits
+static void hexpand(const int* in, vcl_ptrdiff_t istep, int n,
+                        const pyramid_kernel& k,
+                        int* out, int n_out)
+{
+	int src[5], wt[5];
+	int o = 0, c, count;
+	const int round = 1<<(h_shift-1);
+	const int e0 = 2*k.w[4], e1 = 2*k.w[2], e2 = 2*k.w[0];
+	const int o0 = 2*k.w[3], o1 = 2*k.w[1];
+
+	for (; (o < n_out) && (o < 2); o++) {
+		int sum = 0;
+		count = expand_taps(o, n, k, src, wt);
+		for (c=0; c<count; c++)
+			sum += wt[c]*in[src[c]*istep];
+		out[o] = (sum + round)>>h_shift;
+	}
+
+	for (; (o < n_out) && (o/2+1 < n); o++) {
+		const int* p = in + (o/2)*istep;
+		int sum;
+		if ((o & 1) == 0)
+			sum = e0*p[-istep] + e1*p[0] + e2*p[istep];
+		else
+			sum = o0*p[0] + o1*p[istep];
+		out[o] = (sum + round)>>h_shift;
+	}
+
+	for (; o < n_out; o++) {
+		int sum = 0;
+		count = expand_taps(o, n, k, src, wt);
+		for (c=0; c<count; c++)
+			sum += wt[c]*in[src[c]*istep];
+		out[o] = (sum + round)>>h_shift;
+	}
+}
+
+// Expand one row of n floats to n_out floats
+static void hexpand(const float* in, vcl_ptrdiff_t istep, int n,
+                    const pyramid_kernel& k,
+                    float* out, int n_out)
+{
+	int src[5], wt[5];
+	const float scale = 1.0f/(1<<tap_bits);
+
+	for (int o=0; o<n_out; o++) {
+		float sum = 0;
+		int count = expand_taps(o, n, k, src, wt);
+		for (int c=0; c<count; c++)
+			sum += wt[c]*in[src[c]*istep];
+		out[o] = sum*scale;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+//                   The vertical pass                        //
+////////////////////////////////////////////////////////////////
+
+// Combine count buffered rows of n 16-bit values with the weights
+// wt[] into a row of n bytes
+static void vfilter(const vxl_int_16* const* rows, const int* wt, int count,
+                       int n, vxl_byte* out, vcl_ptrdiff_t ostep)
+{
+	int i = 0, c;
+	const int round = 1<<(v_shift-1);
+
+#ifdef __AVX2__
+	if (ostep == 1) {
+		const __m256i r = _mm256_set1_epi32(round);
+
+		for (; i+16 <= n; i += 16) {
+			__m256i lo = _mm256_setzero_si256();
+			__m256i hi = _mm256_setzero_si256();
+			// process the rows in pairs
+			for (c=0; c<count; c+=2) {
+				__m256i a = _mm256_loadu_si256((const __m256i*) (rows[c]+i));
+				__m256i b = (c+1 < count) ?
+					_mm256_loadu_si256((const __m256i*) (rows[c+1]+i)) :
+					_mm256_setzero_si256();
+				int hi_tap = (c+1 < count) ? wt[c+1] : 0;
+				__m256i w = _mm256_set_m128i(tap_pair(wt[c], hi_tap),
+					                         tap_pair(wt[c], hi_tap));
+				lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+				hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+			}
+			lo = _mm256_srai_epi32(_mm256_add_epi32(lo, r), v_shift);
+			hi = _mm256_srai_epi32(_mm256_add_epi32(hi, r), v_shift);
+			// the unpack/pack instructions operate within 128-bit lanes,
+			// so the packed bytes come out in the original order
+			__m256i b16 = _mm256_packs_epi32(lo, hi);
+			__m128i b8 = _mm_packus_epi16(_mm256_castsi256_si128(b16),
+				                          _mm256_extracti128_si256(b16, 1));
+			_mm_storeu_si128((__m128i*) (out+i), b8);
+		}
+	}
+#endif
+#ifdef __SSE2__
+	if (ostep == 1) {
+		const __m128i r = _mm_set1_epi32(round);
+
+		for (; i+8 <= n; i += 8) {
+			__m128i lo = _mm_setzero_si128();
+			__m128i hi = _mm_setzero_si128();
+			// process the rows in pairs
+			for (c=0; c<count; c+=2) {
+				__m128i a = _mm_loadu_si128((const __m128i*) (rows[c]+i));
+				__m128i b = (c+1 < count) ?
+					_mm_loadu_si128((const __m128i*) (rows[c+1]+i)) :
+					_mm_setzero_si128();
+				__m128i w = tap_pair(wt[c], (c+1 < count) ? wt[c+1] : 0);
+				lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+				hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+			}
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, r), v_shift);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, r), v_shift);
+			__m128i b16 = _mm_packs_epi32(lo, hi);
+			_mm_storel_epi64((__m128i*) (out+i), _mm_packus_epi16(b16, b16));
+		}
+	}
+#endif
+
+	for (; i<n; i++) {
+		int sum = 0;
+		for (c=0; c<count; c++)
+			sum += wt[c]*rows[c][i];
+		sum = (sum + round)>>v_shift;
+		out[i*ostep] = (vxl_byte) vcl_min(vcl_max(sum, 0), 255);
+	}
+}
+
+// Same as above, for a row of 16-bit values
+static void vfilter(const vxl_int_16* const* rows, const int* wt, int count,
+                    int n, vxl_int_16* out, vcl_ptrdiff_t ostep)
+{
+	int i = 0, c;
+	const int round = 1<<(v_shift-1);
+
+#ifdef __AVX2__
+	if (ostep == 1) {
+		const __m256i r = _mm256_set1_epi32(round);
+
+		for (; i+16 <= n; i += 16) {
+			__m256i lo = _mm256_setzero_si256();
+			__m256i hi = _mm256_setzero_si256();
+			for (c=0; c<count; c+=2) {
+				__m256i a = _mm256_loadu_si256((const __m256i*) (rows[c]+i));
+				__m256i b = (c+1 < count) ?
+					_mm256_loadu_si256((const __m256i*) (rows[c+1]+i)) :
+					_mm256_setzero_si256();
+				int hi_tap = (c+1 < count) ? wt[c+1] : 0;
+				__m256i w = _mm256_set_m128i(tap_pair(wt[c], hi_tap),
+					                         tap_pair(wt[c], hi_tap));
+				lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+				hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+			}
+			lo = _mm256_srai_epi32(_mm256_add_epi32(lo, r), v_shift);
+			hi = _mm256_srai_epi32(_mm256_add_epi32(hi, r), v_shift);
+			_mm256_storeu_si256((__m256i*) (out+i), _mm256_packs_epi32(lo, hi));
+		}
+	}
+#endif
+#ifdef __SSE2__
+	if (ostep == 1) {
+		const __m128i r = _mm_set1_epi32(round);
+
+		for (; i+8 <= n; i += 8) {
+			__m128i lo = _mm_setzero_si128();
+			__m128i hi = _mm_setzero_si128();
+			for (c=0; c<count; c+=2) {
+				__m128i a = _mm_loadu_si128((const __m128i*) (rows[c]+i));
+				__m128i b = (c+1 < count) ?
+					_mm_loadu_si128((const __m128i*) (rows[c+1]+i)) :
+					_mm_setzero_si128();
+				__m128i w = tap_pair(wt[c], (c+1 < count) ? wt[c+1] : 0);
+				lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+				hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+			}
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, r), v_shift);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, r), v_shift);
+			_mm_storeu_si128((__m128i*) (out+i), _mm_packs_epi32(lo, hi));
+		}
+	}
+#endif
+
+	for (; i<n; i++) {
+		int sum = 0;
+		for (c=0; c<count; c++)
+			sum += wt[c]*rows[c][i];
+		out[i*ostep] = saturate_16((sum + round)>>v_shift);
+	}
+}
+
+// Same as above, for rows of ints
+static void vfilter(const int* const* rows, const int* wt, int count,
+                        int n, int* out, vcl_ptrdiff_t ostep)
+{
+	const int round = 1<<(v_shift-1);
+
+	for (int i=0; i<n; i++) {
+		int sum = 0;
+		for (int c=0; c<count; c++)
+			sum += wt[c]*rows[c][i];
+		out[i*ostep] = (sum + round)>>v_shift;
+	}
+}
+
+// Same as above, for rows of floats
+static void vfilter(const float* const* rows, const int* wt, int count,
+                    int n, float* out, vcl_ptrdiff_t ostep)
+{
+	const float scale = 1.0f/(1<<tap_bits);
+
+	for (int i=0; i<n; i++) {
+		float sum = 0;
+		for (int c=0; c<count; c++)
+			sum += wt[c]*rows[c][i];
+		out[i*ostep] = sum*scale;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+//               The reduce/expand routines                   //
+////////////////////////////////////////////////////////////////
+
+// The horizontal pass results are kept in a ring of ring_rows row
+// buffers: input row r is stored in slot r%ring_rows. An output row
+// only depends on the 5 (reduce) or 3 (expand) consecutive input rows
+// under the kernel, so each output row can be emitted as soon as the
+// last of these rows has been filtered, and the temporary storage
+// never exceeds ring_rows rows
+static const int ring_rows = 5;
+
+// The type of the row buffers used when expanding images with 
+// pixels of type T: bytes and 16-bit values use 16-bit buffers
+// (and the SIMD code paths), the other types their own type
+template <class T> struct expand_row { typedef vxl_int_16 type; };
+template <> struct expand_row<int> { typedef int type; };
+template <> struct expand_row<float> { typedef float type; };
+
+// The routines below split the output rows into bands that are
+// processed in parallel (see thread/parallel.h). Every band has its
+// own ring buffer and starts by filtering the first input row under
+// the kernel of its first output row, so the output does not depend
+// on the number of bands. Bands have at least 64K output pixels
+static int band_grain(int ni)
+{
+	return vcl_max(1, 65536/vcl_max(ni, 1));
+}
+
+// The arguments of the band routines: the input image(s), the 
+// kernel and the output image
+template <class T, class S>
+struct kernel_job {
+	const vil_image_view<T>* in;
+	const vil_image_view<vxl_byte>* g;
+	const pyramid_kernel* k;
+	vil_image_view<S>* out;
+};
+
+static void reduce_band(int j0, int j1, void* arg)
+{
+	kernel_job<vxl_byte, vxl_byte>* job = (kernel_job<vxl_byte, vxl_byte>*) arg;
+	const vil_image_view<vxl_byte>& im = *job->in;
+	vil_image_view<vxl_byte>& im_red = *job->out;
+	int ni = im.ni(), nj = im.nj(), ni_red = im_red.ni();
+	int src[5], wt[5];
+	const vxl_int_16* rows[5];
+
+	vcl_vector<vxl_int_16> ring((vcl_size_t) ring_rows*ni_red);
+
+	for (unsigned p=0; p<im.nplanes(); p++) {
+		const vxl_byte* in = im.top_left_ptr() + p*im.planestep();
+		vxl_byte* out = im_red.top_left_ptr() + p*im_red.planestep();
+		// the next input row to go through the horizontal pass
+		int filled = -1;
+
+		for (int j=j0; j<j1; j++) {
+			// reduce_taps() lists the input rows in increasing order
+			int count = reduce_taps(j, nj, *job->k, src, wt);
+			if (filled < 0)
+				filled = src[0];
+			for (; filled <= src[count-1]; filled++)
+				hreduce_u8(in + filled*im.jstep(), im.istep(), ni, *job->k,
+				           &ring[(vcl_size_t) (filled%ring_rows)*ni_red], ni_red);
+			for (int c=0; c<count; c++)
+				rows[c] = &ring[(vcl_size_t) (src[c]%ring_rows)*ni_red];
+			vfilter(rows, wt, count, ni_red,
+			        out + j*im_red.jstep(), im_red.istep());
+		}
+	}
+}
+
+void pyramid_reduce_fixed(const vil_image_view<vxl_byte>& im,
+                          const pyramid_kernel& k,
+                          vil_image_view<vxl_byte>& im_red)
+{
+	if ((im.ni() == 0) || (im.nj() == 0))
+		return;
+
+	im_red.set_size((im.ni()-1)/2 + 1, (im.nj()-1)/2 + 1, im.nplanes());
+
+	kernel_job<vxl_byte, vxl_byte> job = {&im, 0, &k, &im_red};
+	parallel_for(im_red.nj(), reduce_band, &job, band_grain(im_red.ni()));
+}
+
+// T is the pixel type and R the type of the row buffers
+template <class T, class R>
+static void expand_band(int j0, int j1, void* arg)
+{
+	kernel_job<T, T>* job = (kernel_job<T, T>*) arg;
+	const vil_image_view<T>& im = *job->in;
+	vil_image_view<T>& im_exp = *job->out;
+	int ni = im.ni(), nj = im.nj(), ni_exp = im_exp.ni();
+	int src[5], wt[5];
+	const R* rows[5];
+
+	vcl_vector<R> ring((vcl_size_t) ring_rows*ni_exp);
+
+	for (unsigned p=0; p<im.nplanes(); p++) {
+		const T* in = im.top_left_ptr() + p*im.planestep();
+		T* out = im_exp.top_left_ptr() + p*im_exp.planestep();
+		int filled = -1;
+
+		for (int j=j0; j<j1; j++) {
+			// expand_taps() lists the input rows in decreasing order
+			int count = expand_taps(j, nj, *job->k, src, wt);
+			if (filled < 0)
+				filled = src[count-1];
+			for (; filled <= src[0]; filled++)
+				hexpand(in + filled*im.jstep(), im.istep(), ni, *job->k,
+				        &ring[(vcl_size_t) (filled%ring_rows)*ni_exp], ni_exp);
+			for (int c=0; c<count; c++)
+				rows[c] = &ring[(vcl_size_t) (src[c]%ring_rows)*ni_exp];
+			vfilter(rows, wt, count, ni_exp,
+			        out + j*im_exp.jstep(), im_exp.istep());
+		}
+	}
+}
+
+template <class T>
+void pyramid_expand_fixed(const vil_image_view<T>& im,
+                          const pyramid_kernel& k,
+                          int ni_exp, int nj_exp,
+                          vil_image_view<T>& im_exp)
+{
+	if ((im.ni() == 0) || (im.nj() == 0))
+		return;
+
+	im_exp.set_size(ni_exp, nj_exp, im.nplanes());
+
+	kernel_job<T, T> job = {&im, 0, &k, &im_exp};
+	parallel_for(nj_exp, expand_band<T, typename expand_row<T>::type>, &job, 
+	             band_grain(ni_exp));
+}
+
+// The Laplacian and collapse routines expand the rows of g_up into
+// a row of bytes and then combine it with the corresponding row of
+// the level below, which has the dimensions of the output image.
+// The Laplacian routine computes out = g - expand(g_up) and the
+// collapse routine out = expand(g_up) + L, rounded and clamped to 
+// [0,255]. Both have SSE2 versions for 16-bit Laplacian levels
+template <class S>
+static void combine_row(const vxl_byte* e, const vxl_byte* g, vcl_ptrdiff_t gstep,
+                        int n, S* out, vcl_ptrdiff_t ostep)
+{
+	for (int i=0; i<n; i++)
+		out[i*ostep] = (S) ((int) g[i*gstep] - (int) e[i]);
+}
+
+static void combine_row(const vxl_byte* e, const vxl_byte* g, vcl_ptrdiff_t gstep,
+                        int n, vxl_int_16* out, vcl_ptrdiff_t ostep)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	if ((gstep == 1) && (ostep == 1))
+		for (; i+8 <= n; i += 8)
+			_mm_storeu_si128((__m128i*) (out+i),
+			                 _mm_sub_epi16(load_u8x8(g+i), load_u8x8(e+i)));
+#endif
+
+	combine_row<vxl_int_16>(e+i, g+i*gstep, gstep, n-i, out+i*ostep, ostep);
+}
+
+static inline int round_pixel(int v)
+{
+	return v;
+}
+
+static inline int round_pixel(float v)
+{
+	return (int) vcl_floor(v + 0.5f);
+}
+
+template <class T>
+static void combine_row(const vxl_byte* e, const T* L, vcl_ptrdiff_t Lstep,
+                        int n, vxl_byte* out, vcl_ptrdiff_t ostep)
+{
+	for (int i=0; i<n; i++) {
+		int value = (int) e[i] + round_pixel(L[i*Lstep]);
+		out[i*ostep] = (vxl_byte) vcl_min(vcl_max(value, 0), 255);
+	}
+}
+
+static void combine_row(const vxl_byte* e, const vxl_int_16* L, vcl_ptrdiff_t Lstep,
+                        int n, vxl_byte* out, vcl_ptrdiff_t ostep)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	// the saturating addition and packing clamp the sums exactly 
+	// like the scalar code
+	if ((Lstep == 1) && (ostep == 1))
+		for (; i+8 <= n; i += 8) {
+			__m128i v = _mm_adds_epi16(load_u8x8(e+i), 
+			                           _mm_loadu_si128((const __m128i*) (L+i)));
+			_mm_storel_epi64((__m128i*) (out+i), _mm_packus_epi16(v, v));
+		}
+#endif
+
+	combine_row<vxl_int_16>(e+i, L+i*Lstep, Lstep, n-i, out+i*ostep, ostep);
+}
+
+// T is the pixel type of the level below g_up (ie. of job->in)
+// and S the pixel type of the output
+template <class T, class S>
+static void combine_band(int j0, int j1, void* arg)
+{
+	kernel_job<T, S>* job = (kernel_job<T, S>*) arg;
+	const vil_image_view<vxl_byte>& g_up = *job->g;
+	const vil_image_view<T>& below = *job->in;
+	vil_image_view<S>& res = *job->out;
+	int ni = below.ni(), ni_up = g_up.ni(), nj_up = g_up.nj();
+	int src[5], wt[5];
+	const vxl_int_16* rows[5];
+
+	vcl_vector<vxl_int_16> ring((vcl_size_t) ring_rows*ni);
+	// one row of expand(g_up)
+	vcl_vector<vxl_byte> row(ni);
+
+	for (unsigned p=0; p<below.nplanes(); p++) {
+		const vxl_byte* up = g_up.top_left_ptr() + p*g_up.planestep();
+		const T* in = below.top_left_ptr() + p*below.planestep();
+		S* out = res.top_left_ptr() + p*res.planestep();
+		int filled = -1;
+
+		for (int j=j0; j<j1; j++) {
+			int count = expand_taps(j, nj_up, *job->k, src, wt);
+			if (filled < 0)
+				filled = src[count-1];
+			for (; filled <= src[0]; filled++)
+				hexpand(up + filled*g_up.jstep(), g_up.istep(), ni_up, *job->k,
+				        &ring[(vcl_size_t) (filled%ring_rows)*ni], ni);
+			for (int c=0; c<count; c++)
+				rows[c] = &ring[(vcl_size_t) (src[c]%ring_rows)*ni];
+			vfilter(rows, wt, count, ni, &row[0], 1);
+
+			combine_row(&row[0], in + j*below.jstep(), below.istep(), ni,
+			            out + j*res.jstep(), res.istep());
+		}
+	}
+}
+
+template <class T>
+void pyramid_laplacian_fixed(const vil_image_view<vxl_byte>& g,
+                             const vil_image_view<vxl_byte>& g_up,
+                             const pyramid_kernel& k,
+                             vil_image_view<T>& L)
+{
+	if ((g_up.ni() == 0) || (g_up.nj() == 0))
+		return;
+
+	kernel_job<vxl_byte, T> job = {&g, &g_up, &k, &L};
+	parallel_for(g.nj(), combine_band<vxl_byte, T>, &job, band_grain(g.ni()));
+}
+
+template <class T>
+void pyramid_collapse_fixed(const vil_image_view<vxl_byte>& g_up,
+                            const vil_image_view<T>& L,
+                            const pyramid_kernel& k,
+                            vil_image_view<vxl_byte>& g)
+{
+	if ((g_up.ni() == 0) || (g_up.nj() == 0))
+		return;
+
+	g.set_size(L.ni(), L.nj(), L.nplanes());
+
+	kernel_job<T, vxl_byte> job = {&L, &g_up, &k, &g};
+	parallel_for(L.nj(), combine_band<T, vxl_byte>, &job, band_grain(L.ni()));
+}
+
+// Instantiate the routines for the supported Laplacian pixel types
+#define PYRAMID_KERNELS_INSTANTIATE(T) \
+template void pyramid_expand_fixed(const vil_image_view<T >&, \
+                                   const pyramid_kernel&, int, int, \
+                                   vil_image_view<T >&); \
+template void pyramid_laplacian_fixed(const vil_image_view<vxl_byte>&, \
+                                      const vil_image_view<vxl_byte>&, \
+                                      const pyramid_kernel&, \
+                                      vil_image_view<T >&); \
+template void pyramid_collapse_fixed(const vil_image_view<vxl_byte>&, \
+                                     const vil_image_view<T >&, \
+                                     const pyramid_kernel&, \
+                                     vil_image_view<vxl_byte>&)
+
+template void pyramid_expand_fixed(const vil_image_view<vxl_byte>&,
+                                   const pyramid_kernel&, int, int,
+                                   vil_image_view<vxl_byte>&);
+PYRAMID_KERNELS_INSTANTIATE(vxl_int_16);
+PYRAMID_KERNELS_INSTANTIATE(int);
+PYRAMID_KERNELS_INSTANTIATE(float);
+
@@ -0,0 +1,85 @@
+#ifndef _pyramid_kernels_h
+#define _pyramid_kernels_h
+
+#include "../vxl_includes.h"
+
+//
+// Fixed-point implementations of the reduce() and expand()
+// routines of the pyramid class
+//
+// The 5-pixel w_hat kernel is converted to 16-bit integer taps
+// with 14 fractional bits. Both routines are separable and run in
+// a single pass over the image: every row of the input image is
+// filtered horizontally into a ring of 5 row buffers of 16-bit values
+// (which keep 6 extra fractional bits), and each row of the output
+// image is produced from the buffered rows as soon as all the input
+// rows under the kernel are available. The temporary storage is
+// therefore proportional to the image width rather than its size.
+//
+// Pixels whose kernel lies entirely inside the image are processed
+// with SSE2 instructions when the compiler targets SSE2 (and with
+// AVX2 instructions for the vertical pass when it targets AVX2).
+// Pixels near the image boundary are processed by scalar code that
+// only uses the taps overlapping the image and renormalizes them so
+// that they sum to one, as described in pyramid.cxx
+//
+// All routines split the output image into bands of rows that are 
+// processed in parallel when more than one thread is available 
+// (see thread/parallel.h); the results do not depend on the number
+// of threads.
+//
+// The routines that operate on Laplacian levels are templates over
+// the pixel type T of these levels, which can be vxl_int_16, int or
+// float. 16-bit levels take the SIMD code paths of the byte images;
+// the other types are processed by scalar code. 16-bit levels must
+// hold values in [-511,511] (the Laplacian levels of 8-bit images 
+// are in [-255,255]), as larger values saturate when expanded.
+//
+
+// The w_hat kernel in 16-bit fixed-point format
+struct pyramid_kernel {
+	// the taps w_hat[-2],...,w_hat[2] are stored in w[0],...,w[4]
+	// and always sum to exactly 1<<14
+	int w[5];
+
+	pyramid_kernel(const double* w_hat);
+};
+
+// Reduce an image of dimensions MxP to an image of dimensions
+// ceil(M/2)xceil(P/2)
+void pyramid_reduce_fixed(const vil_image_view<vxl_byte>& im,
+                          const pyramid_kernel& k,
+                          vil_image_view<vxl_byte>& im_red);
+
+// Expand an image of dimensions MxP to an image of dimensions
+// ni_exp x nj_exp. Each of these must be 2M-1 or 2M (resp. 2P-1 
+// or 2P), ie. the dimensions of the pyramid level that was reduced
+// to MxP. T is vxl_byte or one of the Laplacian pixel types
+template <class T>
+void pyramid_expand_fixed(const vil_image_view<T>& im,
+                          const pyramid_kernel& k,
+                          int ni_exp, int nj_exp,
+                          vil_image_view<T>& im_exp);
+
+// Compute the Laplacian level L = g - expand(g_up) without storing
+// expand(g_up): each of its rows is subtracted from g as soon as it
+// is produced. L must already have the dimensions of g, and the 
+// result is identical to that of pyramid_expand_fixed() followed
+// by a subtraction
+template <class T>
+void pyramid_laplacian_fixed(const vil_image_view<vxl_byte>& g,
+                             const vil_image_view<vxl_byte>& g_up,
+                             const pyramid_kernel& k,
+                             vil_image_view<T>& L);
+
+// Compute the Gauss level g = expand(g_up) + L (rounded and clamped
+// to [0,255]) without storing expand(g_up). g is given the dimensions
+// of L, and the result is identical to that of pyramid_expand_fixed() 
+// followed by an addition
+template <class T>
+void pyramid_collapse_fixed(const vil_image_view<vxl_byte>& g_up,
+                            const vil_image_view<T>& L,
+                            const pyramid_kernel& k,
+                            vil_image_view<vxl_byte>& g);
+
+#endif
@@ -0,0 +1,267 @@
+#include "tile_store.h"
+
+#include <vcl_cstring.h>
+#include <vcl_algorithm.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+static const tile_file no_file = INVALID_HANDLE_VALUE;
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const tile_file no_file = -1;
+#endif
+
+tile_store::tile_store(const char* fname, int tile_size, vcl_size_t budget)
+{
+	tile_size_ = tile_size;
+	budget_ = budget;
+	mapped_bytes_ = 0;
+	peak_mapped_bytes_ = 0;
+	file_size_ = 0;
+
+	// the file remains accessible through fd_ until it is closed, and
+	// is deleted afterwards
+#ifdef _WIN32
+	fd_ = CreateFileA(fname, GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+	                  FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, 0);
+#else
+	fd_ = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd_ != no_file)
+		unlink(fname);
+#endif
+}
+
+tile_store::~tile_store()
+{
+	while (!mapped_.empty())
+		unmap_lru();
+	if (fd_ != no_file) {
+#ifdef _WIN32
+		CloseHandle(fd_);
+#else
+		close(fd_);
+#endif
+	}
+}
+
+bool tile_store::ok() const
+{
+	return (fd_ != no_file);
+}
+
+int tile_store::tile_size() const
+{
+	return tile_size_;
+}
+
+vcl_size_t tile_store::budget() const
+{
+	return budget_;
+}
+
+vcl_size_t tile_store::peak_mapped_bytes() const
+{
+	return peak_mapped_bytes_;
+}
+
+int tile_store::add(int ni, int nj, int nplanes, int pixel_size)
+{
+	image im;
+
+	if (fd_ == no_file)
+		return -1;
+
+	// tiles are mapped at multiples of the page size (of the
+	// allocation granularity on Windows)
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	vcl_size_t page = info.dwAllocationGranularity;
+#else
+	vcl_size_t page = (vcl_size_t) sysconf(_SC_PAGESIZE);
+#endif
+
+	im.ni = ni;
+	im.nj = nj;
+	im.nplanes = nplanes;
+	im.pixel_size = pixel_size;
+	im.ti = (ni + tile_size_ - 1)/tile_size_;
+	im.tj = (nj + tile_size_ - 1)/tile_size_;
+	im.tile_bytes = (vcl_size_t) tile_size_*tile_size_*nplanes*pixel_size;
+	im.tile_bytes = (im.tile_bytes + page - 1)/page*page;
+	im.offset = file_size_;
+
+	// the new tiles read as zeros until they are written
+	tile_offset size = file_size_ + (tile_offset) im.tile_bytes*im.ti*im.tj;
+#ifdef _WIN32
+	// Windows does not resize a file while parts of it are mapped
+	while (!mapped_.empty())
+		unmap_lru();
+
+	LARGE_INTEGER end;
+	end.QuadPart = size;
+	if ((!SetFilePointerEx(fd_, end, 0, FILE_BEGIN)) || (!SetEndOfFile(fd_)))
+		return -1;
+#else
+	if (ftruncate(fd_, size) != 0)
+		return -1;
+#endif
+	file_size_ = size;
+
+	images_.push_back(im);
+	return (int) images_.size() - 1;
+}
+
+void tile_store::unmap_lru()
+{
+	mapped_tile& t = mapped_.back();
+	vcl_size_t bytes = images_[t.image].tile_bytes;
+
+	// the kernel writes modified pages back to the file
+#ifdef _WIN32
+	UnmapViewOfFile(t.data);
+#else
+	munmap(t.data, bytes);
+#endif
+	mapped_bytes_ -= bytes;
+	index_.erase(vcl_make_pair(t.image, t.tile));
+	mapped_.pop_back();
+}
+
+char* tile_store::map_tile(int id, int tile)
+{
+	const image& im = images_[id];
+	vcl_pair<int, int> key(id, tile);
+	vcl_map<vcl_pair<int, int>, vcl_list<mapped_tile>::iterator>::iterator
+		it = index_.find(key);
+
+	// move a mapped tile to the front of the list
+	if (it != index_.end()) {
+		mapped_.splice(mapped_.begin(), mapped_, it->second);
+		return mapped_.front().data;
+	}
+
+	// make room for the tile; the store always keeps at least the
+	// tile being accessed
+	while ((!mapped_.empty()) && (mapped_bytes_ + im.tile_bytes > budget_))
+		unmap_lru();
+
+	tile_offset at = im.offset + (tile_offset) tile*im.tile_bytes;
+#ifdef _WIN32
+	// the view keeps the mapping object alive after it is closed
+	void* data = 0;
+	HANDLE mapping = CreateFileMappingA(fd_, 0, PAGE_READWRITE, 0, 0, 0);
+	if (mapping != 0) {
+		data = MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD) (at >> 32), 
+		                     (DWORD) at, im.tile_bytes);
+		CloseHandle(mapping);
+	}
+	if (data == 0)
+		return 0;
+#else
+	void* data = mmap(0, im.tile_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, at);
+	if (data == MAP_FAILED)
+		return 0;
+#endif
+
+	mapped_tile t;
+	t.image = id;
+	t.tile = tile;
+	t.data = (char*) data;
+	mapped_.push_front(t);
+	index_[key] = mapped_.begin();
+
+	mapped_bytes_ += im.tile_bytes;
+	peak_mapped_bytes_ = vcl_max(peak_mapped_bytes_, mapped_bytes_);
+
+	return t.data;
+}
+
+bool tile_store::copy(int id, int i0, int j0, int ni, int nj, int nplanes, char* data,
+                      vcl_ptrdiff_t istep, vcl_ptrdiff_t jstep, vcl_ptrdiff_t pstep,
+                      bool to_store)
+{
+	if ((id < 0) || (id >= (int) images_.size()))
+		return false;
+
+	const image& im = images_[id];
+	int ps = im.pixel_size;
+	int T = tile_size_;
+
+	if ((i0 < 0) || (j0 < 0) || (i0+ni > im.ni) || (j0+nj > im.nj) ||
+		(nplanes != im.nplanes))
+		return false;
+	if ((ni <= 0) || (nj <= 0))
+		return true;
+
+	// visit the tiles under the window one at a time
+	for (int tj=j0/T; tj<=(j0+nj-1)/T; tj++)
+		for (int ti=i0/T; ti<=(i0+ni-1)/T; ti++) {
+			char* tile = map_tile(id, tj*im.ti + ti);
+			if (tile == 0)
+				return false;
+
+			// the part of the window inside the tile
+			int x0 = vcl_max(i0, ti*T), x1 = vcl_min(i0+ni, (ti+1)*T);
+			int y0 = vcl_max(j0, tj*T), y1 = vcl_min(j0+nj, (tj+1)*T);
+
+			for (int p=0; p<im.nplanes; p++)
+				for (int y=y0; y<y1; y++) {
+					char* t = tile + (((vcl_size_t) p*T + (y-tj*T))*T + (x0-ti*T))*ps;
+					char* d = data + p*pstep + (y-j0)*jstep + (x0-i0)*istep;
+
+					if (istep == ps) {
+						if (to_store)
+							vcl_memcpy(t, d, (vcl_size_t) (x1-x0)*ps);
+						else
+							vcl_memcpy(d, t, (vcl_size_t) (x1-x0)*ps);
+					} else
+						for (int x=x0; x<x1; x++, t+=ps, d+=istep) {
+							if (to_store)
+								vcl_memcpy(t, d, ps);
+							else
+								vcl_memcpy(d, t, ps);
+						}
+				}
+		}
+
+	return true;
+}
+
+bool tile_store::get(int id, int i0, int j0, vil_image_view<vxl_byte>& im)
+{
+	return copy(id, i0, j0, im.ni(), im.nj(), im.nplanes(), (char*) im.top_left_ptr(),
+	            im.istep(), im.jstep(), im.planestep(), false);
+}
+
+bool tile_store::get(int id, int i0, int j0, vil_image_view<vxl_int_16>& im)
+{
+	const vcl_ptrdiff_t s = sizeof(vxl_int_16);
+
+	return copy(id, i0, j0, im.ni(), im.nj(), im.nplanes(), (char*) im.top_left_ptr(),
+	            s*im.istep(), s*im.jstep(), s*im.planestep(), false);
+}
+
+bool tile_store::put(int id, int i0, int j0, const vil_image_view<vxl_byte>& im)
+{
+	return copy(id, i0, j0, im.ni(), im.nj(), im.nplanes(), (char*) im.top_left_ptr(),
+	            im.istep(), im.jstep(), im.planestep(), true);
+}
+
+bool tile_store::put(int id, int i0, int j0, const vil_image_view<vxl_int_16>& im)
+{
+	const vcl_ptrdiff_t s = sizeof(vxl_int_16);
+
+	return copy(id, i0, j0, im.ni(), im.nj(), im.nplanes(), (char*) im.top_left_ptr(),
+	            s*im.istep(), s*im.jstep(), s*im.planestep(), true);
+}
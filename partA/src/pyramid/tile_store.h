@@ -0,0 +1,121 @@
+#ifndef _tile_store_h
+#define _tile_store_h
+
+#include "../vxl_includes.h"
+
+#include <vcl_vector.h>
+#include <vcl_list.h>
+#include <vcl_map.h>
+#include <vcl_utility.h>
+
+#ifdef _WIN32
+// a Win32 HANDLE, and a position in the file
+typedef void* tile_file;
+typedef __int64 tile_offset;
+#else
+#include <sys/types.h>
+typedef int tile_file;
+typedef off_t tile_offset;
+#endif
+
+//
+// A scratch file holding images as fixed-size square tiles
+//
+// Every image added to the store is split into tiles of
+// tile_size x tile_size pixels (all the planes of a tile are stored
+// together), and each tile occupies a whole number of pages of the
+// file. Pixels are only accessed by copying rectangular windows in
+// and out of the store: the tiles under a window are mapped into
+// memory on demand, and the least recently used tiles are unmapped
+// whenever the mapped tiles exceed the memory budget. The amount of
+// image data resident in memory is therefore bounded by the budget
+// (plus one tile) regardless of the size of the images; unmapped
+// tiles live in the file, which is deleted when the store is
+// destroyed
+//
+
+class tile_store {
+	// an image stored in the file
+	struct image {
+		int ni, nj, nplanes;
+		// the size of a pixel in bytes
+		int pixel_size;
+		// the number of tiles along each axis
+		int ti, tj;
+		// the size of a tile in bytes, rounded up to a whole page
+		vcl_size_t tile_bytes;
+		// the position of the first tile in the file
+		tile_offset offset;
+	};
+
+	// a tile mapped in memory
+	struct mapped_tile {
+		int image;
+		int tile;
+		char* data;
+	};
+
+	tile_file fd_;
+	int tile_size_;
+	// the memory budget, and the number of bytes currently (and at
+	// most) mapped
+	vcl_size_t budget_;
+	vcl_size_t mapped_bytes_;
+	vcl_size_t peak_mapped_bytes_;
+	tile_offset file_size_;
+
+	vcl_vector<image> images_;
+	// the mapped tiles, most recently used first, and their position
+	// in the list indexed by (image, tile)
+	vcl_list<mapped_tile> mapped_;
+	vcl_map<vcl_pair<int, int>, vcl_list<mapped_tile>::iterator> index_;
+
+	// Return the address of a tile, mapping it if necessary, or 0 if
+	// the tile could not be mapped
+	char* map_tile(int id, int tile);
+	// Unmap the least recently used tile
+	void unmap_lru();
+
+	// Copy the window of dimensions ni x nj at (i0,j0) of image id
+	// from (to_store=false) or to (to_store=true) the pixels at data,
+	// whose steps are given in bytes. The window must have the number
+	// of planes of the image
+	bool copy(int id, int i0, int j0, int ni, int nj, int nplanes, char* data,
+	          vcl_ptrdiff_t istep, vcl_ptrdiff_t jstep, vcl_ptrdiff_t pstep,
+	          bool to_store);
+
+	// stores own their file, so they cannot be copied
+	tile_store(const tile_store&);
+	tile_store& operator=(const tile_store&);
+public:
+	// Create the scratch file fname. The file is removed from the
+	// file system right away, so it never outlives the store. budget
+	// is the maximum number of bytes of tiles mapped at any time
+	tile_store(const char* fname, int tile_size, vcl_size_t budget);
+	~tile_store();
+
+	// false if the scratch file could not be created
+	bool ok() const;
+
+	int tile_size() const;
+	vcl_size_t budget() const;
+	// the largest number of bytes of tiles mapped so far
+	vcl_size_t peak_mapped_bytes() const;
+
+	// Add an image of dimensions ni x nj x nplanes with pixels of
+	// pixel_size bytes; its pixels are initially 0. The routine returns
+	// the id of the image, or -1 if the file could not be extended
+	int add(int ni, int nj, int nplanes, int pixel_size);
+
+	// Copy the window of image id whose top-left pixel is (i0,j0) and
+	// whose dimensions are those of im into im (get) or copy im into
+	// the window (put). The routines return false if the window is
+	// outside the image, if im does not have the number of planes of
+	// the image, or if a tile could not be mapped
+	bool get(int id, int i0, int j0, vil_image_view<vxl_byte>& im);
+	bool get(int id, int i0, int j0, vil_image_view<vxl_int_16>& im);
+	bool put(int id, int i0, int j0, const vil_image_view<vxl_byte>& im);
+	bool put(int id, int i0, int j0, const vil_image_view<vxl_int_16>& im);
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include "tiled_pyramid.h"
+
+#include <core/vil/vil_plane.h>
+#include <vcl_algorithm.h>
+
+// The tile size of the scratch file of blend_tiled()
+static const int blend_tile_size = 256;
+
+// Return the fixed-point w_hat kernel defined by a
+static pyramid_kernel make_kernel(double a)
+{
+	double w_hat[5];
+
+	pyramid::kernel(a, w_hat + 2);
+	return pyramid_kernel(w_hat + 2);
+}
+
+tiled_pyramid::tiled_pyramid(tile_store& store, 
+                             const vil_image_resource_sptr& im, double a, 
+                             bool gauss)
+	: store_(store), k_(make_kernel(a))
+{
+	a_ = a;
+	N_ = 0;
+	nplanes_ = 0;
+	ok_ = false;
+
+	if ((!im) || (im->pixel_format() != VIL_PIXEL_FORMAT_BYTE))
+		return;
+
+	allocate(im->ni(), im->nj(), gauss ? 1 : im->nplanes(), !gauss);
+
+	// the steps of pyramid::build(), with Gauss level 0 read from the
+	// resource
+	ok_ = ok_ && load(im);
+	for (int l=1; ok_ && (l<=N_); l++)
+		ok_ = reduce_level(l);
+	for (int l=0; ok_ && (l<(int) L_.size()); l++)
+		ok_ = expand_level(l, true);
+}
+
+tiled_pyramid::tiled_pyramid(tile_store& store, int ni, int nj, int nplanes,
+                             double a)
+	: store_(store), k_(make_kernel(a))
+{
+	a_ = a;
+	allocate(ni, nj, nplanes, true);
+}
+
+void tiled_pyramid::allocate(int ni, int nj, int nplanes, bool laplacian)
+{
+	int l;
+
+	// the number of levels and their dimensions are those of an
+	// in-memory pyramid
+	N_ = pyramid::levels(ni, nj);
+	nplanes_ = nplanes;
+
+	ni_.resize(N_+1);
+	nj_.resize(N_+1);
+	ni_[0] = ni;
+	nj_[0] = nj;
+	for (l=1; l<=N_; l++) {
+		ni_[l] = (ni_[l-1]+1)/2;
+		nj_[l] = (nj_[l-1]+1)/2;
+	}
+
+	g_.resize(N_+1);
+	L_.resize(laplacian ? N_ : 0);
+	ok_ = store_.ok();
+	for (l=0; l<=N_; l++) {
+		g_[l] = store_.add(ni_[l], nj_[l], nplanes, sizeof(vxl_byte));
+		ok_ = ok_ && (g_[l] >= 0);
+		if (l < (int) L_.size()) {
+			L_[l] = store_.add(ni_[l], nj_[l], nplanes, sizeof(laplacian_type));
+			ok_ = ok_ && (L_[l] >= 0);
+		}
+	}
+}
+
+bool tiled_pyramid::load(const vil_image_resource_sptr& im)
+{
+	int T = store_.tile_size();
+
+	for (int j0=0; j0<nj_[0]; j0+=T)
+		for (int i0=0; i0<ni_[0]; i0+=T) {
+			vil_image_view<vxl_byte> tile = 
+				im->get_view(i0, vcl_min(T, ni_[0]-i0), j0, vcl_min(T, nj_[0]-j0));
+			// a Gauss-only pyramid keeps the first plane
+			if (tile && ((int) tile.nplanes() > nplanes_))
+				tile = vil_plane(tile, 0);
+			if ((!tile) || (!store_.put(g_[0], i0, j0, tile)))
+				return false;
+		}
+
+	return true;
+}
+
+bool tiled_pyramid::reduce_level(int l)
+{
+	int T = store_.tile_size();
+	vil_image_view<vxl_byte> in, out;
+
+	for (int j0=0; j0<nj_[l]; j0+=T)
+		for (int i0=0; i0<ni_[l]; i0+=T) {
+			int w = vcl_min(T, ni_[l]-i0);
+			int h = vcl_min(T, nj_[l]-j0);
+
+			// the window of level l-1 under the kernel of the tile;
+			// x0 and y0 are even, so pixel (i,j) of the reduced window
+			// is pixel (x0/2+i,y0/2+j) of level l
+			int x0 = vcl_max(0, 2*i0-2), x1 = vcl_min(ni_[l-1], 2*(i0+w)+1);
+			int y0 = vcl_max(0, 2*j0-2), y1 = vcl_min(nj_[l-1], 2*(j0+h)+1);
+
+			in.set_size(x1-x0, y1-y0, nplanes_);
+			if (!store_.get(g_[l-1], x0, y0, in))
+				return false;
+			pyramid_reduce_fixed(in, k_, out);
+			if (!store_.put(g_[l], i0, j0, vil_crop(out, i0-x0/2, w, j0-y0/2, h)))
+				return false;
+		}
+
+	return true;
+}
+
+bool tiled_pyramid::expand_level(int l, bool laplacian)
+{
+	int T = store_.tile_size();
+	vil_image_view<vxl_byte> up, g;
+	vil_image_view<laplacian_type> L;
+
+	for (int j0=0; j0<nj_[l]; j0+=T)
+		for (int i0=0; i0<ni_[l]; i0+=T) {
+			int w = vcl_min(T, ni_[l]-i0);
+			int h = vcl_min(T, nj_[l]-j0);
+
+			// the window of level l+1 under the kernel of the tile
+			int x0 = vcl_max(0, i0/2-1), x1 = vcl_min(ni_[l+1], (i0+w)/2+2);
+			int y0 = vcl_max(0, j0/2-1), y1 = vcl_min(nj_[l+1], (j0+h)/2+2);
+			// it expands to the window of level l whose top-left pixel
+			// is (2*x0,2*y0); the expanded window has an odd dimension
+			// only if it reaches the end of an odd dimension of level l
+			int ei = (x1 == ni_[l+1]) ? ni_[l]-2*x0 : 2*(x1-x0);
+			int ej = (y1 == nj_[l+1]) ? nj_[l]-2*y0 : 2*(y1-y0);
+
+			up.set_size(x1-x0, y1-y0, nplanes_);
+			g.set_size(ei, ej, nplanes_);
+			L.set_size(ei, ej, nplanes_);
+			if (!store_.get(g_[l+1], x0, y0, up))
+				return false;
+
+			// only the pixels of the tile are kept, since the pixels 
+			// near the edges of the window lack some of their neighbours
+			if (laplacian) {
+				if (!store_.get(g_[l], 2*x0, 2*y0, g))
+					return false;
+				pyramid_laplacian_fixed(g, up, k_, L);
+				if (!store_.put(L_[l], i0, j0, vil_crop(L, i0-2*x0, w, j0-2*y0, h)))
+					return false;
+			} else {
+				if (!store_.get(L_[l], 2*x0, 2*y0, L))
+					return false;
+				pyramid_collapse_fixed(up, L, k_, g);
+				if (!store_.put(g_[l], i0, j0, vil_crop(g, i0-2*x0, w, j0-2*y0, h)))
+					return false;
+			}
+		}
+
+	return true;
+}
+
+bool tiled_pyramid::ok() const
+{
+	return ok_;
+}
+
+int tiled_pyramid::N() const
+{
+	return N_;
+}
+
+double tiled_pyramid::a() const
+{
+	return a_;
+}
+
+int tiled_pyramid::ni(int l) const
+{
+	return ni_[l];
+}
+
+int tiled_pyramid::nj(int l) const
+{
+	return nj_[l];
+}
+
+int tiled_pyramid::nplanes() const
+{
+	return nplanes_;
+}
+
+bool tiled_pyramid::g(int l, int i0, int j0, int ni, int nj, 
+                      vil_image_view<vxl_byte>& im) const
+{
+	if ((l < 0) || (l > N_))
+		return false;
+
+	im.set_size(ni, nj, nplanes_);
+	return store_.get(g_[l], i0, j0, im);
+}
+
+bool tiled_pyramid::L(int l, int i0, int j0, int ni, int nj, 
+                      vil_image_view<laplacian_type>& im) const
+{
+	if ((l < 0) || (l >= (int) L_.size()))
+		return false;
+
+	im.set_size(ni, nj, nplanes_);
+	return store_.get(L_[l], i0, j0, im);
+}
+
+bool tiled_pyramid::set_g(int l, int i0, int j0, const vil_image_view<vxl_byte>& im)
+{
+	if ((l < 0) || (l > N_))
+		return false;
+
+	return store_.put(g_[l], i0, j0, im);
+}
+
+bool tiled_pyramid::set_L(int l, int i0, int j0, const vil_image_view<laplacian_type>& im)
+{
+	if ((l < 0) || (l >= (int) L_.size()))
+		return false;
+
+	return store_.put(L_[l], i0, j0, im);
+}
+
+bool tiled_pyramid::collapse()
+{
+	if ((int) L_.size() < N_)
+		return false;
+
+	for (int l=N_-1; l>=0; l--)
+		if (!expand_level(l, false))
+			return false;
+
+	return true;
+}
+
+bool tiled_pyramid::save_g(int l, const vil_image_resource_sptr& im) const
+{
+	int T = store_.tile_size();
+	vil_image_view<vxl_byte> tile;
+
+	if ((l < 0) || (l > N_) || (!im) || 
+		(im->ni() != (unsigned) ni_[l]) || (im->nj() != (unsigned) nj_[l]))
+		return false;
+
+	for (int j0=0; j0<nj_[l]; j0+=T)
+		for (int i0=0; i0<ni_[l]; i0+=T)
+			if ((!g(l, i0, j0, vcl_min(T, ni_[l]-i0), vcl_min(T, nj_[l]-j0), tile)) ||
+				(!im->put_view(tile, i0, j0)))
+				return false;
+
+	return true;
+}
+
+bool blend_tiled(const vil_image_resource_sptr& source0, 
+                 const vil_image_resource_sptr& source1,
+                 const vil_image_resource_sptr& mask,
+                 const vil_image_resource_sptr& result,
+                 const char* fname, vcl_size_t budget)
+{
+	if ((!source0) || (!source1) || (!mask) || (!result))
+		return false;
+
+	// make sure image dimensions match
+	if ((source0->ni() != source1->ni()) ||
+		(source0->nj() != source1->nj()) ||
+		(source0->nplanes() != source1->nplanes()) ||
+		(source0->ni() != mask->ni()) ||
+		(source0->nj() != mask->nj()) ||
+		(source0->nplanes() != result->nplanes()))
+		return false;
+
+	// all pyramids share one scratch file and one memory budget
+	tile_store store(fname, blend_tile_size, budget);
+	if (!store.ok())
+		return false;
+
+	// only the Gauss levels of the first plane of the mask are used
+	tiled_pyramid PA(store, source0);
+	tiled_pyramid PB(store, source1);
+	tiled_pyramid PR(store, mask, 0.4, true);
+	if ((!PA.ok()) || (!PB.ok()) || (!PR.ok()))
+		return false;
+	int N = PA.N();
+
+	// the blended pyramid
+	tiled_pyramid PS(store, PA.ni(0), PA.nj(0), PA.nplanes(), PA.a());
+	if (!PS.ok())
+		return false;
+
+	// Combine the Laplacian levels and the top Gauss levels of the two 
+	// sources tile by tile, using the Gauss pyramid of the mask as 
+	// weights, exactly as blend() does
+	vil_image_view<tiled_pyramid::laplacian_type> LA, LB, LS;
+	vil_image_view<vxl_byte> gA, gB, gS, GR;
+	for (int l=0; l<=N; l++)
+		for (int j0=0; j0<PA.nj(l); j0+=blend_tile_size)
+			for (int i0=0; i0<PA.ni(l); i0+=blend_tile_size) {
+				int w = vcl_min(blend_tile_size, PA.ni(l)-i0);
+				int h = vcl_min(blend_tile_size, PA.nj(l)-j0);
+
+				if (!PR.g(l, i0, j0, w, h, GR))
+					return false;
+
+				if (l < N) {
+					if ((!PA.L(l, i0, j0, w, h, LA)) || (!PB.L(l, i0, j0, w, h, LB)))
+						return false;
+					LS.set_size(w, h, LA.nplanes());
+					for (int p=0; p<LA.nplanes(); p++)
+						for (int j=0; j<h; j++)
+							for (int i=0; i<w; i++) {
+								int wt = GR(i,j);
+								int v = (255-wt)*LA(i,j,p) + wt*LB(i,j,p);
+								// divide by 255, rounding to the nearest integer
+								LS(i,j,p) = (v >= 0) ? (v+127)/255 : -((127-v)/255);
+							}
+					if (!PS.set_L(l, i0, j0, LS))
+						return false;
+				} else {
+					if ((!PA.g(l, i0, j0, w, h, gA)) || (!PB.g(l, i0, j0, w, h, gB)))
+						return false;
+					gS.set_size(w, h, gA.nplanes());
+					for (int p=0; p<gA.nplanes(); p++)
+						for (int j=0; j<h; j++)
+							for (int i=0; i<w; i++) {
+								int wt = GR(i,j);
+								gS(i,j,p) = ((255-wt)*gA(i,j,p) + wt*gB(i,j,p) + 127)/255;
+							}
+					if (!PS.set_g(l, i0, j0, gS))
+						return false;
+				}
+			}
+
+	// Collapse the blended pyramid and write its level 0
+	return PS.collapse() && PS.save_g(0, result);
+}
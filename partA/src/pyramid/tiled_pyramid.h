@@ -0,0 +1,130 @@
+#ifndef _tiled_pyramid_h
+#define _tiled_pyramid_h
+
+#include "../vxl_includes.h"
+
+#include "pyramid.h"
+#include "pyramid_kernels.h"
+#include "tile_store.h"
+
+#include <vcl_vector.h>
+
+//
+// A Laplacian pyramid for images too large to fit in memory
+//
+// The tiled_pyramid class has the geometry and the kernels of the
+// pyramid class, but all its levels (the N Laplacian levels as well 
+// as the N+1 levels of the Gauss pyramid) are images of a tile_store,
+// ie. they live in a memory-mapped scratch file and only the tiles
+// that are being accessed are resident in memory. The pyramid is
+// built, and collapsed, one output tile at a time: each tile of a 
+// level is computed from the window of the level below (reduce) or
+// above (expand) that lies under the kernel, so the memory used by
+// the computation is proportional to the tile size and the levels
+// are identical to those of a pyramid built in memory.
+//
+// Levels are accessed by copying windows in and out of the pyramid
+// with the g() and L() routines below
+//
+
+class tiled_pyramid {
+	// the store holding the levels, which may be shared by several
+	// pyramids
+	tile_store& store_;
+	// the ids of the levels in the store
+	vcl_vector<int> g_;
+	vcl_vector<int> L_;
+	// the dimensions of the levels
+	vcl_vector<int> ni_;
+	vcl_vector<int> nj_;
+	int nplanes_;
+	int N_;
+	double a_;
+	pyramid_kernel k_;
+	bool ok_;
+
+	// Compute the dimensions of the levels of an image of dimensions
+	// ni x nj and add the levels to the store, leaving out the
+	// Laplacian levels if laplacian is false
+	void allocate(int ni, int nj, int nplanes, bool laplacian);
+
+	// Copy an image resource into level 0 of the Gauss pyramid
+	bool load(const vil_image_resource_sptr& im);
+	// Compute every tile of Gauss level l from level l-1
+	bool reduce_level(int l);
+	// Compute every tile of Laplacian level l from Gauss levels l
+	// and l+1 (laplacian=true), or Gauss level l from Laplacian 
+	// level l and Gauss level l+1 (laplacian=false)
+	bool expand_level(int l, bool laplacian);
+
+	// pyramids refer to their levels in the store, so they cannot
+	// be copied
+	tiled_pyramid(const tiled_pyramid&);
+	tiled_pyramid& operator=(const tiled_pyramid&);
+public:
+	// the pixel type of the Laplacian levels
+	typedef pyramid::laplacian_type laplacian_type;
+
+	// Build the pyramid of an image in the store. The image is read
+	// from the resource one tile at a time, so it does not need to
+	// fit in memory; it must have 8-bit pixels. If gauss is true, only
+	// the Gauss pyramid of the first plane of the image is built (eg.
+	// for the weights of a mask), and the pyramid has no Laplacian
+	// levels
+	tiled_pyramid(tile_store& store, const vil_image_resource_sptr& im, 
+	              double a = 0.4, bool gauss = false);
+	// Create a pyramid for an image of dimensions ni x nj x nplanes
+	// whose levels are all 0. Its Laplacian levels and its top Gauss
+	// level are meant to be set with set_L() and set_g(), after which
+	// collapse() reconstructs the rest of the Gauss pyramid
+	tiled_pyramid(tile_store& store, int ni, int nj, int nplanes, 
+	              double a = 0.4);
+
+	// false if the image could not be read, or if the levels could 
+	// not be added to the store
+	bool ok() const;
+
+	// basic accessor functions
+	int N() const;
+	double a() const;
+	// the dimensions of level l of the pyramid, 0<=l<=N
+	int ni(int l) const;
+	int nj(int l) const;
+	int nplanes() const;
+
+	// Copy the window of Gauss level l (resp. Laplacian level l) whose
+	// top-left pixel is (i0,j0) and whose dimensions are ni x nj into
+	// im. The routines return false if l is outside the valid range,
+	// if the window is outside the level, or if the store could not 
+	// map the tiles under the window. L() fails on pyramids that only
+	// have Gauss levels
+	bool g(int l, int i0, int j0, int ni, int nj, 
+	       vil_image_view<vxl_byte>& im) const;
+	bool L(int l, int i0, int j0, int ni, int nj, 
+	       vil_image_view<laplacian_type>& im) const;
+
+	// Copy im into the window of Gauss level l (resp. Laplacian 
+	// level l) whose top-left pixel is (i0,j0)
+	bool set_g(int l, int i0, int j0, const vil_image_view<vxl_byte>& im);
+	bool set_L(int l, int i0, int j0, const vil_image_view<laplacian_type>& im);
+
+	// Reconstruct Gauss levels N-1,...,0 from the Laplacian levels and
+	// Gauss level N (which fails on pyramids without Laplacian levels)
+	bool collapse();
+
+	// Write Gauss level l to an image resource, one tile at a time
+	bool save_g(int l, const vil_image_resource_sptr& im) const;
+};
+
+// Blend two images with the tiled pyramids of the sources and of the
+// mask, writing the result to an image resource. The pyramids are
+// stored in the scratch file fname and at most budget bytes of their 
+// tiles are mapped in memory at any time. The result is identical 
+// to that of the in-memory blend() routine
+bool blend_tiled(const vil_image_resource_sptr& source0, 
+                 const vil_image_resource_sptr& source1,
+                 const vil_image_resource_sptr& mask,
+                 const vil_image_resource_sptr& result,
+                 const char* fname, vcl_size_t budget);
+
+#endif
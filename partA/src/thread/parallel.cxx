@@ -0,0 +1,296 @@
+#include "parallel.h"
+#include "thread.h"
+
+#include <vcl_vector.h>
+#include <vcl_algorithm.h>
+#include <vcl_cstddef.h>
+
+// the thread budget of top-level loops
+static int default_threads = 1;
+
+// the thread budget of the threads started by parallel_for() is
+// stored as thread-specific data; threads without one (eg. the
+// main thread) use default_threads
+static thread_key budget_key;
+static thread_once_flag budget_once = THREAD_ONCE_INIT;
+
+static void create_budget_key()
+{
+	thread_key_create(&budget_key);
+}
+
+static void set_budget(int budget)
+{
+	thread_once(&budget_once, create_budget_key);
+	thread_setspecific(budget_key, (void*) (vcl_ptrdiff_t) budget);
+}
+
+void set_parallel_threads(int n)
+{
+	default_threads = vcl_max(n, 1);
+}
+
+int parallel_threads()
+{
+	thread_once(&budget_once, create_budget_key);
+
+	void* budget = thread_getspecific(budget_key);
+	return budget ? (int) (vcl_ptrdiff_t) budget : default_threads;
+}
+
+// A band of a parallel loop
+struct parallel_band {
+	parallel_body body;
+	void* arg;
+	int begin, end;
+	// the thread budget of the thread running the band
+	int budget;
+};
+
+static void* run_band(void* p)
+{
+	parallel_band* band = (parallel_band*) p;
+
+	set_budget(band->budget);
+	band->body(band->begin, band->end, band->arg);
+
+	return 0;
+}
+
+void parallel_for(int n, parallel_body body, void* arg, int grain)
+{
+	int k;
+
+	if (n <= 0)
+		return;
+
+	int threads = parallel_threads();
+	void* caller_budget = thread_getspecific(budget_key);
+	int nbands = vcl_min(threads, vcl_max(n/vcl_max(grain, 1), 1));
+
+	if (nbands == 1) {
+		body(0, n, arg);
+		return;
+	}
+
+	vcl_vector<parallel_band> bands(nbands);
+	vcl_vector<thread_id> tid(nbands);
+	vcl_vector<bool> started(nbands, false);
+
+	// split the range and the thread budget evenly among the bands
+	for (k=0; k<nbands; k++) {
+		bands[k].body = body;
+		bands[k].arg = arg;
+		bands[k].begin = (int) ((long long) n*k/nbands);
+		bands[k].end = (int) ((long long) n*(k+1)/nbands);
+		bands[k].budget = threads/nbands + ((k < threads%nbands) ? 1 : 0);
+	}
+
+	for (k=1; k<nbands; k++)
+		started[k] = thread_create(&tid[k], run_band, &bands[k]);
+
+	// the calling thread runs the first band with the budget of that
+	// band, as well as any band for which no thread could be created
+	run_band(&bands[0]);
+	for (k=1; k<nbands; k++)
+		if (!started[k])
+			run_band(&bands[k]);
+	thread_setspecific(budget_key, caller_budget);
+
+	for (k=1; k<nbands; k++)
+		if (started[k])
+			thread_join(tid[k]);
+}
+
+// The tasks [begin,end) not yet run by a thread of a stealing loop;
+// the thread takes its tasks from the front and other threads steal
+// them from the back
+struct stealing_queue {
+	thread_mutex mutex;
+	int begin, end;
+};
+
+struct stealing_loop {
+	parallel_body body;
+	void* arg;
+	vcl_vector<stealing_queue> queues;
+};
+
+struct stealing_thread {
+	stealing_loop* loop;
+	// the index of the queue of the thread
+	int k;
+	// the thread budget of the thread
+	int budget;
+};
+
+// The number of tasks left in queue q
+static int remaining(stealing_queue& q)
+{
+	thread_mutex_lock(&q.mutex);
+	int n = q.end - q.begin;
+	thread_mutex_unlock(&q.mutex);
+
+	return n;
+}
+
+// Move the second half of the tasks of the queue with the most tasks
+// to queue k, which is empty; returns false when no tasks are left
+static bool steal(stealing_loop* loop, int k)
+{
+	int nqueues = loop->queues.size();
+
+	for (;;) {
+		int victim = -1, most = 0;
+		for (int v=0; v<nqueues; v++) {
+			int n = (v == k) ? 0 : remaining(loop->queues[v]);
+			if (n > most) {
+				victim = v;
+				most = n;
+			}
+		}
+		if (victim < 0)
+			return false;
+
+		stealing_queue& q = loop->queues[victim];
+		int begin = 0, end = 0;
+		thread_mutex_lock(&q.mutex);
+		if (q.end > q.begin) {
+			end = q.end;
+			begin = q.end - (q.end - q.begin + 1)/2;
+			q.end = begin;
+		}
+		thread_mutex_unlock(&q.mutex);
+
+		// the victim may have run its tasks in the meantime
+		if (end > begin) {
+			stealing_queue& own = loop->queues[k];
+			thread_mutex_lock(&own.mutex);
+			own.begin = begin;
+			own.end = end;
+			thread_mutex_unlock(&own.mutex);
+			return true;
+		}
+	}
+}
+
+static void* run_stealing(void* p)
+{
+	stealing_thread* t = (stealing_thread*) p;
+	stealing_loop* loop = t->loop;
+	stealing_queue& own = loop->queues[t->k];
+
+	set_budget(t->budget);
+	for (;;) {
+		thread_mutex_lock(&own.mutex);
+		int task = (own.begin < own.end) ? own.begin++ : -1;
+		thread_mutex_unlock(&own.mutex);
+
+		if (task >= 0)
+			loop->body(task, task + 1, loop->arg);
+		else if (!steal(loop, t->k))
+			return 0;
+	}
+}
+
+void parallel_for_stealing(int n, parallel_body body, void* arg)
+{
+	int k;
+
+	if (n <= 0)
+		return;
+
+	int threads = parallel_threads();
+	void* caller_budget = thread_getspecific(budget_key);
+	int nthreads = vcl_min(threads, n);
+
+	if (nthreads == 1) {
+		for (k=0; k<n; k++)
+			body(k, k + 1, arg);
+		return;
+	}
+
+	stealing_loop loop;
+	vcl_vector<stealing_thread> workers(nthreads);
+	vcl_vector<thread_id> tid(nthreads);
+	vcl_vector<bool> started(nthreads, false);
+
+	// split the tasks and the thread budget evenly among the threads
+	loop.body = body;
+	loop.arg = arg;
+	loop.queues.resize(nthreads);
+	for (k=0; k<nthreads; k++) {
+		thread_mutex_init(&loop.queues[k].mutex);
+		loop.queues[k].begin = (int) ((long long) n*k/nthreads);
+		loop.queues[k].end = (int) ((long long) n*(k+1)/nthreads);
+		workers[k].loop = &loop;
+		workers[k].k = k;
+		workers[k].budget = threads/nthreads + ((k < threads%nthreads) ? 1 : 0);
+	}
+
+	for (k=1; k<nthreads; k++)
+		started[k] = thread_create(&tid[k], run_stealing, &workers[k]);
+
+	// the calling thread is the first worker; the tasks of the threads
+	// that could not be created are stolen by the others
+	run_stealing(&workers[0]);
+	thread_setspecific(budget_key, caller_budget);
+
+	for (k=1; k<nthreads; k++)
+		if (started[k])
+			thread_join(tid[k]);
+	for (k=0; k<nthreads; k++)
+		thread_mutex_destroy(&loop.queues[k].mutex);
+}
+
+// A worker of parallel_run()
+struct parallel_thread {
+	parallel_worker worker;
+	void* arg;
+	// the thread budget of the worker
+	int budget;
+};
+
+static void* run_worker(void* p)
+{
+	parallel_thread* t = (parallel_thread*) p;
+
+	set_budget(t->budget);
+	t->worker(t->arg);
+
+	return 0;
+}
+
+void parallel_run(int n, parallel_worker worker, void* arg)
+{
+	int k;
+
+	if (n <= 0)
+		return;
+
+	int threads = parallel_threads();
+	void* caller_budget = thread_getspecific(budget_key);
+
+	vcl_vector<parallel_thread> workers(n);
+	vcl_vector<thread_id> tid(n);
+	vcl_vector<bool> started(n, false);
+
+	for (k=0; k<n; k++) {
+		workers[k].worker = worker;
+		workers[k].arg = arg;
+		workers[k].budget = vcl_max(threads/n + ((k < threads%n) ? 1 : 0), 1);
+	}
+
+	for (k=1; k<n; k++)
+		started[k] = thread_create(&tid[k], run_worker, &workers[k]);
+
+	run_worker(&workers[0]);
+	for (k=1; k<n; k++)
+		if (!started[k])
+			run_worker(&workers[k]);
+	thread_setspecific(budget_key, caller_budget);
+
+	for (k=1; k<n; k++)
+		if (started[k])
+			thread_join(tid[k]);
+}
@@ -0,0 +1,55 @@
+#ifndef parallel_h
+#define parallel_h
+
+//
+// Simple data-parallel loops on top of the threads of thread.h
+//
+// parallel_for() splits the range [0,n) into contiguous bands
+// and runs body(begin, end, arg) on each band in a separate thread
+// (the calling thread processes the first band). The bands are
+// determined only by n, the grain and the thread count, and every
+// band writes its own part of the output, so the result of a
+// parallel loop is identical to that of the serial one.
+//
+// Parallel loops can be nested: the threads of a loop share the
+// thread budget of their caller, so a loop over 3 tasks running
+// with a budget of 12 threads gives each task a budget of 4 threads
+// for the loops it runs itself.
+//
+
+// the type of the functions executed by parallel_for()
+typedef void (*parallel_body)(int begin, int end, void* arg);
+
+// the type of the functions executed by parallel_run()
+typedef void (*parallel_worker)(void* arg);
+
+// Set the number of threads available to top-level parallel loops.
+// The default is 1, ie. all loops run serially in the calling thread
+void set_parallel_threads(int n);
+
+// The number of threads available to a parallel loop started from
+// the calling thread
+int parallel_threads();
+
+// Run body() on bands of the range [0,n). No band is smaller than
+// grain, unless n itself is smaller than grain
+void parallel_for(int n, parallel_body body, void* arg, int grain = 1);
+
+// Run body(k, k+1, arg) for every task k of [0,n), for loops whose
+// tasks have very different costs. Every thread starts with an even
+// band of the tasks and runs them in order; a thread that runs out
+// of tasks steals the second half of the remaining tasks of another
+// one. As long as every task writes its own part of the output, the
+// result does not depend on which thread runs it
+void parallel_for_stealing(int n, parallel_body body, void* arg);
+
+// Run worker(arg) in n threads at the same time, for pools of
+// workers that take their tasks from a shared queue (the calling
+// thread is one of the workers). The thread budget is split evenly
+// among the workers, each of which gets at least one thread. The
+// workers whose thread cannot be created are run by the calling
+// thread after the first one, so the queue must not depend on the
+// workers running concurrently
+void parallel_run(int n, parallel_worker worker, void* arg);
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef thread_h
+#define thread_h
+
+//
+// Portable threads, mutexes and condition variables
+//
+// The threaded code of the package is written against these thin
+// wrappers, which map to pthreads on POSIX systems and to the native
+// primitives on Windows (slim condition variables and one-time
+// initialization need Windows Vista or later)
+//
+
+#ifdef _WIN32
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <process.h>
+
+typedef HANDLE thread_id;
+typedef CRITICAL_SECTION thread_mutex;
+typedef CONDITION_VARIABLE thread_cond;
+typedef DWORD thread_key;
+typedef INIT_ONCE thread_once_flag;
+#define THREAD_ONCE_INIT INIT_ONCE_STATIC_INIT
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t thread_id;
+typedef pthread_mutex_t thread_mutex;
+typedef pthread_cond_t thread_cond;
+typedef pthread_key_t thread_key;
+typedef pthread_once_t thread_once_flag;
+#define THREAD_ONCE_INIT PTHREAD_ONCE_INIT
+
+#endif
+
+// the type of the functions run by thread_create()
+typedef void* (*thread_body)(void* arg);
+
+#ifdef _WIN32
+
+// the function and argument of a thread being started
+struct thread_start {
+	thread_body body;
+	void* arg;
+};
+
+inline unsigned __stdcall thread_trampoline(void* p)
+{
+	thread_start start = *(thread_start*) p;
+
+	delete (thread_start*) p;
+	start.body(start.arg);
+
+	return 0;
+}
+
+inline BOOL CALLBACK thread_once_trampoline(PINIT_ONCE, PVOID init, PVOID*)
+{
+	((void (*)()) init)();
+	return TRUE;
+}
+
+inline bool thread_create(thread_id* t, thread_body body, void* arg)
+{
+	thread_start* start = new thread_start;
+	start->body = body;
+	start->arg = arg;
+
+	uintptr_t h = _beginthreadex(0, 0, thread_trampoline, start, 0, 0);
+	if (h == 0) {
+		delete start;
+		return false;
+	}
+
+	*t = (HANDLE) h;
+	return true;
+}
+
+inline void thread_join(thread_id t)
+{
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+}
+
+inline void thread_mutex_init(thread_mutex* m) { InitializeCriticalSection(m); }
+inline void thread_mutex_destroy(thread_mutex* m) { DeleteCriticalSection(m); }
+inline void thread_mutex_lock(thread_mutex* m) { EnterCriticalSection(m); }
+inline void thread_mutex_unlock(thread_mutex* m) { LeaveCriticalSection(m); }
+
+inline void thread_cond_init(thread_cond* c) { InitializeConditionVariable(c); }
+inline void thread_cond_destroy(thread_cond*) {}
+inline void thread_cond_wait(thread_cond* c, thread_mutex* m) { SleepConditionVariableCS(c, m, INFINITE); }
+inline void thread_cond_signal(thread_cond* c) { WakeConditionVariable(c); }
+inline void thread_cond_broadcast(thread_cond* c) { WakeAllConditionVariable(c); }
+
+inline void thread_once(thread_once_flag* once, void (*init)())
+{
+	InitOnceExecuteOnce(once, thread_once_trampoline, (PVOID) init, 0);
+}
+
+inline void thread_key_create(thread_key* key) { *key = TlsAlloc(); }
+inline void* thread_getspecific(thread_key key) { return TlsGetValue(key); }
+inline void thread_setspecific(thread_key key, void* value) { TlsSetValue(key, value); }
+
+#else
+
+// Start body(arg) in a new thread; returns false if no thread could
+// be created
+inline bool thread_create(thread_id* t, thread_body body, void* arg)
+{
+	return pthread_create(t, 0, body, arg) == 0;
+}
+
+inline void thread_join(thread_id t) { pthread_join(t, 0); }
+
+inline void thread_mutex_init(thread_mutex* m) { pthread_mutex_init(m, 0); }
+inline void thread_mutex_destroy(thread_mutex* m) { pthread_mutex_destroy(m); }
+inline void thread_mutex_lock(thread_mutex* m) { pthread_mutex_lock(m); }
+inline void thread_mutex_unlock(thread_mutex* m) { pthread_mutex_unlock(m); }
+
+inline void thread_cond_init(thread_cond* c) { pthread_cond_init(c, 0); }
+inline void thread_cond_destroy(thread_cond* c) { pthread_cond_destroy(c); }
+inline void thread_cond_wait(thread_cond* c, thread_mutex* m) { pthread_cond_wait(c, m); }
+inline void thread_cond_signal(thread_cond* c) { pthread_cond_signal(c); }
+inline void thread_cond_broadcast(thread_cond* c) { pthread_cond_broadcast(c); }
+
+inline void thread_once(thread_once_flag* once, void (*init)()) { pthread_once(once, init); }
+
+inline void thread_key_create(thread_key* key) { pthread_key_create(key, 0); }
+inline void* thread_getspecific(thread_key key) { return pthread_getspecific(key); }
+inline void thread_setspecific(thread_key key, void* value) { pthread_setspecific(key, value); }
+
+#endif
+
+#endif
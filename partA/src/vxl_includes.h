@@ -19,6 +19,7 @@
 // The libraries below are required to manipulate VXL images
 #include<core/vil/vil_load.h>
 #include<core/vil/vil_save.h>
+#include<core/vil/vil_new.h>
 #include<core/vil/vil_image_view.h>
 #include<core/vil/vil_rgb.h> 
 #include<core/vil/vil_convert.h>
@@ -29,6 +30,7 @@
 #include<core/vil/algo/vil_trace_8con_boundary.h>
 
 #include<core/vul/vul_arg.h>
+#include<core/vul/vul_timer.h>
 
 // VXL Libraries used for numerical computations
 #include <vnl/vnl_math.h>